@@ -232,6 +232,7 @@ namespace Afy
 	#define	META_PROP_ASYNC				0x08		/**< PROP_SPEC_SERVICE: force non-blocking read/write operations, PROP_SPEC_STATE, PROP_SPEC_ACTION: asynchronous execution */
 	#define	META_PROP_KEEPALIVE			0x08		/**< PROP_SPEC_ADDRESS: cache connection/device handle */
 	#define	META_PROP_CREATE			0x04		/**< PROP_SPEC_ADDRESS: CREATE flag when openning communication channel */
+	#define	META_PROP_SPATIAL			0x04		/**< PROP_SPEC_PREDICATE: family index over numeric properties ordered by Z-order (bit-interleaved) code */
 	#define	META_PROP_LEAVE				0x04		/**< PROP_SPEC_ACTION:  call on leaving class */
 	#define	META_PROP_WRITE				0x02		/**< write premission in ACLs and device communication */
 	#define	META_PROP_UPDATE			0x02		/**< PROP_SPEC_ACTION: call on update in a class */
@@ -608,6 +609,8 @@ namespace Afy
 		virtual	IStream		*clone() const = 0;
 		virtual	RC			reset() = 0;
 		virtual void		destroy() = 0;
+		virtual	const void	*getSlice(size_t& length,void *&handle) {length=0; handle=NULL; return NULL;}	/**< zero-copy read: next portion of data in place, NULL at the end of stream or if not supported */
+		virtual	void		releaseSlice(void *,size_t) {}													/**< release data returned by getSlice() (handle), advance position by the number of bytes used */
 	};
 	struct	IStreamRef {
 		IStream			*is;
@@ -1244,6 +1247,15 @@ namespace Afy
 	public:
 		virtual	void	trace(long code,const char *msg,va_list) = 0;
 	};
+
+	/**
+	 * index creation progress interface
+	 */
+	class IIndexProgress
+	{
+	public:
+		virtual	void	progress(unsigned nDone,unsigned nTotal) = 0;		/**< number of heap pages processed so far and total */
+	};
 	
 	/**
 	 * PIN batch insert interface
@@ -1377,6 +1389,9 @@ namespace Afy
 		virtual	RC			convDateTime(const DateTime& dts,TIMESTAMP& dt,bool fUTC=true) const = 0;			/**< convert tiemstamp from DateTime to internal representation */
 
 		virtual	uint64_t	getCodeTrace() = 0;																	/**< used for performance Affinity tracing */
+
+		virtual	void		setIndexProgress(IIndexProgress *) = 0;												/**< set index creation progress interface */
+		virtual	RC			getPINs(const PID *ids,unsigned nIds,IPIN **pins,unsigned mode=0) = 0;				/**< retrieve a batch of PINs in page order, pins[i] is NULL if ids[i] is not found; on error all pins[] are NULL */
 	};
 
 	/**
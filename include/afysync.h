@@ -123,6 +123,7 @@ template<typename T> __forceinline T casV(volatile T *ptr,T oldV,T newV) {return
 #define	casV(a,b,c)									__sync_val_compare_and_swap(a,b,c)
 #define	InterlockedIncrement(a)						__sync_add_and_fetch(a,1)
 #define	InterlockedDecrement(a)						__sync_sub_and_fetch(a,1)
+#define	MemoryBarrier()								__sync_synchronize()
 #else		//__arm__
 /**
  * ARM compare-and-swap functions use the same names as glibc but implemented in assembler
@@ -132,6 +133,7 @@ template<typename T> __forceinline T casV(volatile T *ptr,T oldV,T newV) {return
 #define	casV(a,b,c)									__sync_val_compare_and_swap(a,b,c)
 #define	InterlockedIncrement(a)						__sync_add_and_fetch(a,1)
 #define	InterlockedDecrement(a)						__sync_sub_and_fetch(a,1)
+#define	MemoryBarrier()								__sync_synchronize()
 #endif
 
 /**
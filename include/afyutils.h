@@ -731,6 +731,9 @@ public:
 	void lock(T* t,RW_LockType lt) {assert((t->*pList).getIndex()<hashSize); hashTab[(t->*pList).getIndex()].lock.lock(lt);}
 	void unlock(Key key) {hashTab[index(uint32_t(key))].lock.unlock();}
 	void unlock(T* t) {assert((t->*pList).getIndex()<hashSize); hashTab[(t->*pList).getIndex()].lock.unlock();}
+	unsigned getHashSize() const {return hashSize;}
+	void lockBucket(unsigned idx,RW_LockType lt) {assert(idx<hashSize); hashTab[idx].lock.lock(lt);}
+	void unlockBucket(unsigned idx) {assert(idx<hashSize); hashTab[idx].lock.unlock();}
 	void clear(bool fDealloc=true) {
 		for (unsigned i=0; i<hashSize; i++) {
 			HashTabElt *ht=&hashTab[i]; ht->lock.lock(RW_X_LOCK); T *t;
@@ -22,6 +22,6 @@ under the License.
 //interface changes.  Use it for conditional defines
 //within client code.  Format is Year/Month/Date
 //
-#define STORE_IFACE_VER 0x120101
+#define STORE_IFACE_VER 0x261019
 
 #endif
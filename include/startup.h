@@ -74,6 +74,8 @@ using namespace Afy;
 #define	STORE_CREATE_ENCRYPTED		0x0001											/**< created store to be encrypted */
 #define	STORE_CREATE_PAGE_INTEGRITY	0x0002											/**< check integrity of store pages by calculating HMAC */
 #define	STORE_CREATE_NO_PREFIX		0x0004											/**< don't augment #names with a store specific prefix */
+#define	STORE_CREATE_PAGE_COMPRESSION	0x0008										/**< compress heap and SSV pages on write, release unused file blocks */
+#define	STORE_CREATE_DEDUP			0x0010											/**< store identical large SSV and BLOB values once */
 
 /**
  * error/debug information report interface; if not set platform-specific standard report channel is used (e.g. STDERR)
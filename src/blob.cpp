@@ -23,6 +23,7 @@ Written by Mark Venguerov 2004-2014
 #include "txmgr.h"
 #include "fsmgr.h"
 #include "expr.h"
+#include "crypt.h"
 
 using namespace AfyKernel;
 
@@ -67,48 +68,56 @@ uint64_t StreamX::length() const
 	return len;
 }
 
+const byte *StreamX::getData(const PBlock *pb,const PageAddr& addr,size_t& l,PageAddr& next)
+{
+	const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage*)pb->getPageBuf();
+	const HeapPageMgr::HeapObjHeader *hdr=hp->getObject(hp->getOffset(addr.idx)); next=PageAddr::noAddr; l=0;
+	if (hdr!=NULL) switch (hdr->getType()) {
+	default: break;
+	case HO_SSVALUE: l=hdr->length-sizeof(HeapPageMgr::HeapObjHeader); return (const byte*)(hdr+1);
+	case HO_BLOB: memcpy(&next,((const HeapPageMgr::HeapLOB*)hdr)->next,PageAddrSize); l=hdr->length-sizeof(HeapPageMgr::HeapLOB); return (const byte*)hdr+sizeof(HeapPageMgr::HeapLOB);
+	}
+	return NULL;
+}
+
 size_t StreamX::read(void *buf,size_t maxLength)
 {
-	PBlock *pb=NULL; size_t lData=0;
-	do {
-		if (pos>=len || (pb=ctx->bufMgr->getPage(current.pageID,ctx->ssvMgr,0,pb))==NULL) break;
-		const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage*)pb->getPageBuf();
-		const HeapPageMgr::HeapObjHeader *hdr=hp->getObject(hp->getOffset(current.idx));
-		size_t lbuf=0; const byte *p=NULL; HeapObjType hty=HO_ALL;
-		if (hdr!=NULL) switch (hty=hdr->getType()) {
-		default: break;
-		case HO_SSVALUE: p=(byte*)(hdr+1); lbuf=hdr->length-sizeof(HeapPageMgr::HeapObjHeader); break;
-		case HO_BLOB: p=(byte*)hdr+sizeof(HeapPageMgr::HeapLOB); lbuf=hdr->length-sizeof(HeapPageMgr::HeapLOB); break;
-		}
-		if (p!=NULL && shift<lbuf) {
-			size_t l=lbuf-shift; if (l>maxLength) l=maxLength;
-			memcpy((byte*)buf+lData,p+shift,l);
-			lData+=l; maxLength-=l; pos+=l; 
-			if ((shift+=l)<lbuf) break;
-		}
-		if (hty==HO_BLOB) memcpy(&current,((const HeapPageMgr::HeapLOB*)hdr)->next,PageAddrSize); else current=PageAddr::noAddr;
-		shift=0; if (current.pageID==INVALID_PAGEID||current.idx==INVALID_INDEX) {pos=len; break;}
-	} while (maxLength>0);
-	if (pb!=NULL) pb->release();
+	size_t lData=0,l; const void *p; void *h;
+	while (lData<maxLength && (p=getSlice(l,h))!=NULL) {
+		if (l>maxLength-lData) l=maxLength-lData;
+		memcpy((byte*)buf+lData,p,l); lData+=l; releaseSlice(h,l);
+	}
 	return lData;
 }
 
+const void *StreamX::getSlice(size_t& l,void *&handle)
+{
+	PBlock *pb=NULL; PageAddr next; handle=NULL;
+	while (pos<len && (pb=ctx->bufMgr->getPage(current.pageID,ctx->ssvMgr,0,pb))!=NULL) {
+		const byte *p=getData(pb,current,l,next);
+		if (p!=NULL && shift<l) {l-=shift; handle=pb; return p+shift;}
+		shift=0; if ((current=next).pageID==INVALID_PAGEID||current.idx==INVALID_INDEX) pos=len;
+	}
+	if (pb!=NULL) pb->release();
+	l=0; return NULL;
+}
+
+void StreamX::releaseSlice(void *handle,size_t lUsed)
+{
+	PBlock *pb=(PBlock*)handle; size_t l; PageAddr next;
+	if (pb!=NULL) {
+		getData(pb,current,l,next); pos+=lUsed;
+		if ((shift+=lUsed)>=l) {shift=0; if ((current=next).pageID==INVALID_PAGEID||current.idx==INVALID_INDEX) pos=len;}
+		pb->release();
+	}
+}
+
 size_t StreamX::readChunk(uint64_t offset,void *buf,size_t maxLength)
 {
 	PBlock *pb=NULL; size_t lData=0; uint64_t sht=0; PageAddr addr=start;
 	do {
 		if ((pb=ctx->bufMgr->getPage(addr.pageID,ctx->ssvMgr,0,pb))==NULL) break;
-		const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage*)pb->getPageBuf(); 
-		const HeapPageMgr::HeapObjHeader *hdr=hp->getObject(hp->getOffset(addr.idx));
-		size_t lbuf=0; const byte *p=NULL; addr=PageAddr::noAddr;
-		if (hdr!=NULL) switch (hdr->getType()) {
-		default: break;
-		case HO_SSVALUE:
-			p=(byte*)(hdr+1); lbuf=hdr->length-sizeof(HeapPageMgr::HeapObjHeader); break;
-		case HO_BLOB:
-			p=(byte*)hdr+sizeof(HeapPageMgr::HeapLOB); lbuf=hdr->length-sizeof(HeapPageMgr::HeapLOB); 
-			memcpy(&addr,((HeapPageMgr::HeapLOB*)hdr)->next,PageAddrSize); break;
-		}
+		size_t lbuf; const byte *p=getData(pb,addr,lbuf,addr);
 		if (p!=NULL && sht+lbuf>offset) {
 			size_t sh=sht>=offset?0:size_t(offset-sht); 
 			size_t l=lbuf-sh; if (l>maxLength) l=maxLength;
@@ -1122,8 +1131,10 @@ RC CollFactory::createTree(const byte *params,byte lparams,Tree *&tree)
 
 //-----------------------------------------------------------------------------------------------------
 
+static const IndexFormat dedupIndexFmt(KT_BIN,SHA_DIGEST_BYTES,PageAddrSize+sizeof(uint32_t));
+
 BigMgr::BigMgr(StoreCtx *ct,unsigned blobReadTabSize) 
-: ctx(ct),blobReadTab(blobReadTabSize,(MemAlloc*)ct),freeBlob((MemAlloc*)ct,DEFAULT_BLOBREAD_BLOCK)
+: ctx(ct),blobReadTab(blobReadTabSize,(MemAlloc*)ct),freeBlob((MemAlloc*)ct,DEFAULT_BLOBREAD_BLOCK),dedupMap(MA_DEDUP,dedupIndexFmt,ct,TF_WITHDEL)
 {
 	ct->treeMgr->registerFactory(CollFactory::factory);
 }
@@ -1136,3 +1147,91 @@ bool BigMgr::canBePurged(const PageAddr& addr)
 	findBlob.unlock();
 	return blob==NULL;	// race cond?
 }
+
+RC BigMgr::getDigest(const PageAddr& start,byte *digest,uint64_t& len,Session *ses,PBlockP *pbp)
+{
+	SHA256 sha; PBlockP pb; PageAddr addr=start,next; len=0;
+	do {
+		const PBlock *pg; const byte *p; size_t l;
+		if (pbp!=NULL && !pbp->isNull() && (*pbp)->getPageID()==addr.pageID) pg=*pbp;
+		else if ((pg=pb.getPage(addr.pageID,ctx->ssvMgr,0,ses))==NULL) return RC_NOTFOUND;
+		if ((p=StreamX::getData(pg,addr,l,next))==NULL) return RC_NOTFOUND;
+		if (addr==start && next.pageID==INVALID_PAGEID && l<DEDUP_THRESHOLD) return RC_FALSE;
+		sha.add(p,l); len+=l; addr=next;
+	} while (addr.pageID!=INVALID_PAGEID);
+	memcpy(digest,sha.result(),SHA_DIGEST_BYTES); return RC_OK;
+}
+
+RC BigMgr::findDup(const byte *digest,PageAddr& addr,Session *ses)
+{
+	SearchKey key(digest,SHA_DIGEST_BYTES); byte buf[PageAddrSize+sizeof(uint32_t)]; size_t size=sizeof(buf); uint32_t cnt;
+	DedupOp *dop=(DedupOp*)ses->malloc(sizeof(DedupOp)); if (dop==NULL) return RC_NOMEM;
+	MutexP lck(&dedupLock); RC rc=dedupMap.find(key,buf,size);
+	if (rc==RC_OK) {
+		memcpy(&cnt,buf+PageAddrSize,sizeof(uint32_t));
+		if (++cnt==0) rc=RC_NOTFOUND;
+		else {
+			// committed at once, so that the value can't be purged by another transaction; dropped in finishDedup() on rollback
+			MiniTx tx(ses,0); if ((rc=dedupMap.edit(key,&cnt,sizeof(uint32_t),sizeof(uint32_t),PageAddrSize))==RC_OK) tx.ok();
+		}
+	}
+	if (rc!=RC_OK) {ses->free(dop); return rc;}
+	memcpy(&addr,buf,PageAddrSize); dop->op=DedupOp::DDP_ACQUIRED; dop->addr=addr; memcpy(dop->digest,digest,SHA_DIGEST_BYTES);
+	dop->next=ses->tx.dedup; ses->tx.dedup=dop; return RC_OK;
+}
+
+RC BigMgr::addDup(const byte *digest,const PageAddr& addr,Session *ses)
+{
+	DedupOp *dop=(DedupOp*)ses->malloc(sizeof(DedupOp)); if (dop==NULL) return RC_NOMEM;
+	dop->op=DedupOp::DDP_REGISTER; dop->addr=addr; memcpy(dop->digest,digest,SHA_DIGEST_BYTES);
+	dop->next=ses->tx.dedup; ses->tx.dedup=dop; return RC_OK;
+}
+
+RC BigMgr::releaseDup(const PageAddr& start,Session *ses,PBlockP *pbp)
+{
+	// a value stored by this transaction is not registered yet and can be purged at once
+	for (SubTx *st=&ses->tx; st!=NULL; st=st->next)
+		for (DedupOp **pdop=&st->dedup,*dop; (dop=*pdop)!=NULL; pdop=&dop->next)
+			if (dop->op==DedupOp::DDP_REGISTER && dop->addr==start) {*pdop=dop->next; ses->free(dop); return RC_OK;}
+	byte digest[SHA_DIGEST_BYTES]; uint64_t len; RC rc=getDigest(start,digest,len,ses,pbp);
+	if (rc!=RC_OK || len<DEDUP_THRESHOLD) return RC_OK;
+	SearchKey key(digest,SHA_DIGEST_BYTES); byte buf[PageAddrSize+sizeof(uint32_t)]; size_t size=sizeof(buf); PageAddr addr;
+	{MutexP lck(&dedupLock); if ((rc=dedupMap.find(key,buf,size))!=RC_OK) return rc==RC_NOTFOUND?RC_OK:rc;}
+	memcpy(&addr,buf,PageAddrSize); if (addr!=start) return RC_OK;
+	// the entry can't go away while this transaction holds its reference
+	DedupOp *dop=(DedupOp*)ses->malloc(sizeof(DedupOp)); if (dop==NULL) return RC_NOMEM;
+	dop->op=DedupOp::DDP_RELEASE; dop->addr=start; memcpy(dop->digest,digest,SHA_DIGEST_BYTES);
+	dop->next=ses->tx.dedup; ses->tx.dedup=dop; return RC_FALSE;
+}
+
+void BigMgr::finishDedup(Session *ses,DedupOp *list,bool fCommit)
+{
+	DedupOp *purge=NULL; RC rc=RC_OK;
+	{
+		MutexP lck(&dedupLock); MiniTx tx(ses,0);
+		for (DedupOp *dop=list,*next; dop!=NULL; dop=next) {
+			next=dop->next; SearchKey key(dop->digest,SHA_DIGEST_BYTES); byte buf[PageAddrSize+sizeof(uint32_t)]; size_t size=sizeof(buf); PageAddr addr; uint32_t cnt;
+			if (dop->op==DedupOp::DDP_REGISTER) {
+				if (fCommit && rc==RC_OK) {
+					cnt=1; memcpy(buf,&dop->addr,PageAddrSize); memcpy(buf+PageAddrSize,&cnt,sizeof(uint32_t));
+					if ((rc=dedupMap.insert(key,buf,sizeof(buf)))==RC_ALREADYEXISTS) rc=RC_OK;		// another copy was registered first, this one stays unshared
+				}
+			} else if ((dop->op==DedupOp::DDP_RELEASE)==fCommit && rc==RC_OK) {
+				if ((rc=dedupMap.find(key,buf,size))==RC_NOTFOUND) rc=RC_OK;
+				else if (rc==RC_OK && (memcpy(&addr,buf,PageAddrSize),addr==dop->addr)) {
+					memcpy(&cnt,buf+PageAddrSize,sizeof(uint32_t));
+					if (cnt>1) {--cnt; rc=dedupMap.edit(key,&cnt,sizeof(uint32_t),sizeof(uint32_t),PageAddrSize);}
+					else if ((rc=dedupMap.remove(key,NULL,0))==RC_OK) {dop->next=purge; purge=dop; continue;}
+				}
+			}
+			ses->free(dop);
+		}
+		if (rc==RC_OK) tx.ok(); else report(MSG_ERROR,"Failed to update dedup index (%d), values may be left unreferenced\n",rc);
+	}
+	// unreferenced values are purged outside of dedupLock: deleteData() may wait for a page latched by a transaction waiting for dedupLock
+	if (purge!=NULL) {
+		MiniTx tx(ses,0); const bool fPurge=rc==RC_OK;		// otherwise removal of the entries was rolled back
+		for (DedupOp *dop=purge,*next; dop!=NULL; dop=next) {next=dop->next; if (fPurge && rc==RC_OK) rc=ctx->queryMgr->deleteData(dop->addr,ses,NULL,false); ses->free(dop);}
+		if (rc==RC_OK) tx.ok();
+	}
+}
@@ -50,6 +50,8 @@ protected:
 			uint64_t	pos;
 			PageAddr	current;
 			size_t		shift;
+	friend	class	BigMgr;
+	static	const	byte	*getData(const PBlock *pb,const PageAddr& addr,size_t& l,PageAddr& next);
 public:
 	StreamX() : start(), type(VT_BSTR), allc(NULL), ctx(NULL), len(0) {}
 public:
@@ -63,6 +65,8 @@ public:
 	IStream				*clone() const;
 	RC					reset();
 	void				destroy();
+	const	void		*getSlice(size_t& l,void *&handle);
+	void				releaseSlice(void *handle,size_t lUsed);
 	void				destroyObj();
 };
 
@@ -417,6 +421,15 @@ struct BlobRead
 
 typedef SyncHashTab<BlobRead,const PageAddr&,&BlobRead::list> BlobReadTab;
 
+/**
+ * SSV and BLOB deduplication (STFLG_DEDUP stores)
+ * values of DEDUP_THRESHOLD bytes or longer are indexed by SHA-256 digest of their content
+ * index entry contains address of the stored value and its reference count
+ * the index is changed only in committed mini-transactions: new values are registered and released references are dropped after
+ * the transaction commits, a reference to a found value is taken at once and dropped if the transaction is rolled back (see DedupOp)
+ */
+#define	DEDUP_THRESHOLD				1024
+
 class BigMgr
 {
 	friend	class	StreamX;
@@ -424,10 +437,17 @@ class BigMgr
 	StoreCtx		*const ctx;
 	BlobReadTab		blobReadTab;
 	LIFO			freeBlob;
+	TreeGlobalRoot	dedupMap;
+	Mutex			dedupLock;
+	RC				getDigest(const PageAddr& start,byte *digest,uint64_t& len,Session *ses,PBlockP *pbp);
 public:
 	BigMgr(StoreCtx *ct,unsigned blobReadTabSize=DEFAULT_BLOBREADTAB_SIZE);
 	void *operator new(size_t s,StoreCtx *ctx) {void *p=ctx->malloc(s); if (p==NULL) throw RC_NOMEM; return p;}
 	bool canBePurged(const PageAddr& addr);
+	RC	findDup(const byte *digest,PageAddr& addr,Session *ses);						/**< finds stored copy, adds reference */
+	RC	addDup(const byte *digest,const PageAddr& addr,Session *ses);					/**< registers newly stored value on commit */
+	RC	releaseDup(const PageAddr& addr,Session *ses,PBlockP *pbp=NULL);				/**< drops reference, RC_FALSE if value is purged after commit */
+	void	finishDedup(Session *ses,DedupOp *list,bool fCommit);						/**< applies changes of a committed or rolled back (sub)transaction */
 };
 
 };
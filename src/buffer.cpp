@@ -62,7 +62,7 @@ void *BufMgr::operator new(size_t s,StoreCtx *ctx)
 
 RC BufMgr::init()
 {
-	if (ctx->getEncKey()!=NULL) setLockType(RW_X_LOCK);
+	if (ctx->getEncKey()!=NULL || (ctx->theCB->flags&STFLG_COMPRESSED)!=0) setLockType(RW_X_LOCK);
 	MutexP lck(&initLock);
 	if (!fInit) {InitializeSListHead(&freeBuffers); fInit=true;}
 	if (nStoreBuffers>xBuffers) xBuffers=nStoreBuffers;
@@ -452,7 +452,7 @@ RC PBlock::flushBlock()
 	if (pageMgr!=NULL) {
 		LSN lsn(pageMgr->getLSN(frame,mgr->lPage)); 
 		if (!lsn.isNull()) rc=mgr->ctx->logMgr->flushTo(lsn);
-		if (!pageMgr->beforeFlush(frame,mgr->lPage,pageID)) rc=RC_CORRUPTED;
+		if (rc==RC_OK && !pageMgr->beforeFlush(frame,mgr->lPage,pageID)) rc=RC_CORRUPTED;
 	}
 	if (rc==RC_OK) {
 		if ((rc=mgr->ctx->fileMgr->io(FIO_WRITE,pageID,frame,mgr->lPage))!=RC_OK) {
@@ -460,7 +460,7 @@ RC PBlock::flushBlock()
 			//error processing
 		}
 		if (pageMgr!=NULL) {
-			if (mgr->ctx->getEncKey()!=NULL) pageMgr->afterIO(this,mgr->lPage,false);
+			pageMgr->afterWrite(this,mgr->lPage,rc);
 			if (rc==RC_OK && !pageMgr->getLSN(frame,mgr->lPage).isNull()) 
 				mgr->ctx->logMgr->insert(NULL,LR_FLUSH,pageMgr->getPGID(),pageID);
 		}
@@ -519,7 +519,7 @@ void PBlock::writeResult(RC rc,bool fAsync)
 		if (mgr->drop(this)) destroy();		// destroy inside drop() ???
 	} else {
 		PBlock *dep=NULL; const bool fChain=(state&BLOCK_FLUSH_CHAIN)!=0;
-		if (pageMgr!=NULL && mgr->ctx->getEncKey()!=NULL) pageMgr->afterIO(this,mgr->lPage,false);
+		if (pageMgr!=NULL) pageMgr->afterWrite(this,mgr->lPage,rc);
 		if (rc!=RC_OK) {
 			report(rc==RC_REPEAT?MSG_WARNING:MSG_ERROR,"Write error %d for page %08X\n",rc,pageID);
 			resetStateBits(BLOCK_IO_WRITE|BLOCK_ASYNC_IO|BLOCK_FLUSH_CHAIN);
@@ -199,6 +199,8 @@ public:
 	size_t				getPageSize() const {return lPage;}
 	PBlock*				newPage(PageID pid,PageMgr*,PBlock *old=NULL,unsigned flags=0,Session *ses=NULL);
 	PBlock*				getPage(PageID pid,PageMgr*,unsigned flags=0,PBlock *old=NULL,Session *ses=NULL);
+	PBlock*				pinPage(PageID pid,PageMgr *pageMgr) {PBlock *pb=pin(pid); if (pb!=NULL && pb->pageMgr!=pageMgr) {unpin(pb); pb=NULL;} return pb;}
+	void				unpinPage(PBlock *pb) {unpin(pb);}
 	void				prefetch(const PageID *pages,int nPages,PageMgr *mgr,PageMgr *const *mgrs=NULL);
 	void				asyncWrite();
 	RC					close(FileID fid,bool fAll=false);
@@ -591,6 +591,7 @@ RC SimpleVar::build(BuildCtx& qctx,QueryOp *&q) const
 {
 	q=NULL;	assert(type==QRY_SIMPLE && (stype!=SEL_CONST||qctx.cu.op==STMT_INSERT));
 	RC rc=RC_OK; QueryOp *qq,*primary=NULL; const unsigned nqs0=qctx.nqs,ncqs0=qctx.ncqs;
+	const Stmt **sqs=(const Stmt**)alloca(nSrcs*sizeof(Stmt*)); const SourceSpec **sss=(const SourceSpec**)alloca(nSrcs*sizeof(SourceSpec*));
 	const bool fTrans=groupBy!=NULL && nGroupBy!=0 || outs!=NULL && nOuts!=0;
 	
 	if (fTrans) {
@@ -614,7 +615,7 @@ RC SimpleVar::build(BuildCtx& qctx,QueryOp *&q) const
 			else {
 				qq=cid==CLASS_OF_STORES || cid==CLASS_OF_SERVICES ? (QueryOp*)new(&qctx.cu.alloc) SpecClassScan(&qctx.cu.ectx,cid,qctx.flg) 
 																	: (QueryOp*)new(&qctx.cu.alloc) ClassScan(&qctx.cu.ectx,cid,qctx.flg);
-				if ((qctx.src[qctx.nqs]=qq)!=NULL) qctx.nqs++; else rc=RC_NOMEM;
+				if ((qctx.src[qctx.nqs]=qq)!=NULL) {sqs[qctx.nqs-nqs0]=NULL; sss[qctx.nqs-nqs0]=&cs; qctx.nqs++;} else rc=RC_NOMEM;
 			}
 			continue;
 		}
@@ -628,26 +629,31 @@ RC SimpleVar::build(BuildCtx& qctx,QueryOp *&q) const
 				if ((qs.qry=cqry->clone(STMT_QUERY,&qctx.cu.alloc))==NULL) rc=RC_NOMEM; else {qs.params=(Value*)cs.params; qs.nParams=cs.nParams;}
 			}
 		} else if (cidx==NULL) {
-			if ((qctx.src[qctx.nqs++]=new(&qctx.cu.alloc) ClassScan(&qctx.cu.ectx,cid,qctx.flg))==NULL) rc=RC_NOMEM;
-			else if (cqry!=NULL && cqry->hasParams() && cs.params!=NULL && cs.nParams!=0) {
-				if (qctx.ncqs>=sizeof(qctx.condQs)/sizeof(qctx.condQs[0])) rc=RC_NOMEM;
-				else {
-					QueryWithParams &qs=qctx.condQs[qctx.ncqs++]; qs.params=NULL; qs.nParams=0;
-					if ((qs.qry=cqry->clone(STMT_QUERY,&qctx.cu.alloc))==NULL) rc=RC_NOMEM; else {qs.params=(Value*)cs.params; qs.nParams=cs.nParams;}
+			if ((qctx.src[qctx.nqs]=new(&qctx.cu.alloc) ClassScan(&qctx.cu.ectx,cid,qctx.flg))==NULL) rc=RC_NOMEM;
+			else {
+				// membership is the stored classification, which the predicate alone doesn't reproduce (e.g. hidden PINs): not pruned
+				sqs[qctx.nqs-nqs0]=NULL; sss[qctx.nqs-nqs0]=&cs; qctx.nqs++;
+				if (cqry!=NULL && cqry->hasParams() && cs.params!=NULL && cs.nParams!=0) {
+					if (qctx.ncqs>=sizeof(qctx.condQs)/sizeof(qctx.condQs[0])) rc=RC_NOMEM;
+					else {
+						QueryWithParams &qs=qctx.condQs[qctx.ncqs++]; qs.params=NULL; qs.nParams=0;
+						if ((qs.qry=cqry->clone(STMT_QUERY,&qctx.cu.alloc))==NULL) rc=RC_NOMEM; else {qs.params=(Value*)cs.params; qs.nParams=cs.nParams;}
+					}
 				}
 			}
 		} else {
 			assert(cqry!=NULL && cqry->top!=NULL && cqry->top->getType()==QRY_SIMPLE && ((SimpleVar*)cqry->top)->condIdx!=NULL);
 			ushort flags=SCAN_EXACT; unsigned i=0,nRanges=0; const Value *param; const unsigned nSegs=((SimpleVar*)cqry->top)->nCondIdx;
+			bool fFilter=cs.nParams!=0;		// can be replaced by a filter in prune(): Stmt::checkConditions() must accept the same set as IndexScan
 			struct IdxParam {const Value *param; uint32_t idx;} *iparams=(IdxParam*)alloca(nSegs*sizeof(IdxParam));
 			const Value **curValues=(const Value**)alloca(nSegs*sizeof(Value*)),*cv;
 			if (iparams==NULL || curValues==NULL) rc=RC_NOMEM;
 			else {
 				if (cs.nParams==0) flags&=~SCAN_EXACT;
 				else for (CondIdx *pci=((SimpleVar*)cqry->top)->condIdx; pci!=NULL; pci=pci->next,++i) {
-					if (pci->param>=cs.nParams) {iparams[i].param=NULL; flags&=~SCAN_EXACT;}
+					if (pci->param>=cs.nParams) {iparams[i].param=NULL; flags&=~SCAN_EXACT; fFilter=false;}
 					else if ((param=&cs.params[pci->param])->type==VT_RANGE && param->varray[0].type==VT_ANY && param->varray[1].type==VT_ANY || param->type==VT_ANY && param->fcalc!=0) {
-						iparams[i].param=param; iparams[i].idx=0; flags&=~SCAN_EXACT;
+						iparams[i].param=param; iparams[i].idx=0; flags&=~SCAN_EXACT; fFilter=false;
 					} else {
 						if (param->type==VT_VARREF && (param->refV.flags&VAR_TYPE_MASK)==VAR_PARAM) {
 							if (param->length!=0 || param->refV.refN>=qctx.cu.vctx[QV_PARAMS].nValues) {rc=RC_INVPARAM; break;}
@@ -656,8 +662,9 @@ RC SimpleVar::build(BuildCtx& qctx,QueryOp *&q) const
 						iparams[i].param=param; iparams[i].idx=0; unsigned nVals=param->count();
 						if (nVals>1) {
 							if (pci->ks.op!=OP_EQ && pci->ks.op!=OP_IN && pci->ks.op!=OP_BEGINS) {rc=RC_TYPE; break;}
-							flags&=~SCAN_EXACT;
+							flags&=~SCAN_EXACT; fFilter=false;
 						}
+						if (param->type==VT_ANY || param->type==VT_RANGE && (param->varray[0].type==VT_ANY || param->varray[1].type==VT_ANY)) fFilter=false;
 						if (nVals>nRanges) nRanges=nVals;
 					}
 				}
@@ -703,7 +710,7 @@ RC SimpleVar::build(BuildCtx& qctx,QueryOp *&q) const
 						}
 					}
 					if (rc==RC_OK) {
-						qctx.src[qctx.nqs++]=is;
+						sqs[qctx.nqs-nqs0]=fFilter?dev->getQuery():NULL; sss[qctx.nqs-nqs0]=&cs; qctx.src[qctx.nqs++]=is;
 #if 0
 						if ((qctx.req&QRQ_SORT)!=0 && primary==NULL) {
 							//assert(orderProps!=NULL);
@@ -718,6 +725,7 @@ RC SimpleVar::build(BuildCtx& qctx,QueryOp *&q) const
 		}
 		if (cidx==NULL || rc!=RC_OK) dev->release();
 	}
+	if (rc==RC_OK && qctx.nqs>nqs0+1 && (qctx.cu.mode&MODE_DELETED)==0) rc=qctx.prune(nqs0,sqs,sss);
 	if ((qctx.cu.mode&MODE_DELETED)==0 && rc==RC_OK) for (CondFT *cf=condFT; cf!=NULL; cf=cf->next) {
 		if ((rc=qctx.mergeFT(qq,cf))!=RC_OK) break;
 		if (qctx.nqs<sizeof(qctx.src)/sizeof(qctx.src[0])) qctx.src[qctx.nqs++]=qq; else {rc=RC_NOMEM; break;}
@@ -771,6 +779,23 @@ bool BuildCtx::checkSort(QueryOp *q,const OrderSegQ *req,unsigned nReq,unsigned&
 		else if (nP==0) fRev=true; else if (!fRev) return false;
 }
 
+RC BuildCtx::prune(unsigned nqs0,const Stmt **cqs,const SourceSpec **css)
+{
+	const unsigned n=nqs-nqs0; uint64_t *est=(uint64_t*)alloca(n*sizeof(uint64_t)),xmin=~0ULL; unsigned i,j;
+	for (i=0; i<n; i++) if ((est[i]=src[nqs0+i]->estimate())<xmin) xmin=est[i];
+	if (xmin==~0ULL) return RC_OK;
+	for (i=j=0; i<n; i++) {
+		QueryOp *qop=src[nqs0+i];
+		if (cqs[i]!=NULL && est[i]!=~0ULL && est[i]/STATS_FILTER_RATIO>xmin && ncqs<sizeof(condQs)/sizeof(condQs[0])) {
+			QueryWithParams &qs=condQs[ncqs]; if ((qs.qry=cqs[i]->clone(STMT_QUERY,&cu.alloc))==NULL) return RC_NOMEM;
+			qs.params=(Value*)css[i]->params; qs.nParams=css[i]->nParams; ncqs++; qop->~QueryOp(); continue;
+		}
+		const uint64_t e=est[i];
+		for (unsigned k=j++; ; k--) if (k==0 || est[k-1]<=e) {src[nqs0+k]=qop; est[k]=e; break;} else {src[nqs0+k]=src[nqs0+k-1]; est[k]=est[k-1];}
+	}
+	nqs=nqs0+j; return RC_OK;
+}
+
 RC BuildCtx::sort(QueryOp *&qop,const OrderSegQ *os,unsigned no,PropListP *pl,bool fTmp)
 {
 	if (os==NULL || no==1 && (os->flags&ORDER_EXPR)==0 && os->pid==PROP_SPEC_PINID) no=0;
@@ -965,11 +990,9 @@ RC BuildCtx::load(QueryOp *&qop,const PropListP& plp)
 		bool fFound=true;
 		for (unsigned j=0; fFound; j++) {
 			if (j>=plp.nPls) return RC_OK;
-			const PropertyID *pp,*qp=qop->props[j].props; unsigned np=qop->props[j].nProps;
-			for (unsigned i=0; i<plp.pls[j].nProps; i++) {
-				if ((pp=BIN<PropertyID,PropertyID,ExprPropCmp>::find(plp.pls[j].props[i]&STORE_MAX_URIID,qp,np))==NULL) {fFound=false; break;}
-				np-=unsigned(pp-qp)+1; qp=pp+1;
-			}
+			const PropertyID *qp=qop->props[j].props; const unsigned np=qop->props[j].nProps;
+			for (unsigned i=0; i<plp.pls[j].nProps; i++)		// plp is in projection order, not sorted
+				if (BIN<PropertyID,PropertyID,ExprPropCmp>::find(plp.pls[j].props[i]&STORE_MAX_URIID,qp,np)==NULL) {fFound=false; break;}
 		}
 	}
 	if (propsReq.nPls!=0) {
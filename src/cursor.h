@@ -96,6 +96,8 @@ public:
 	friend	class		Stmt;
 };
 
+#define	STATS_FILTER_RATIO	16		/**< intersected source estimated to return this many times more PINs than the smallest one is replaced by a filter */
+
 struct BuildCtx {
 	Cursor&				cu;
 	unsigned			flg;
@@ -116,6 +118,7 @@ public:
 	RC	filter(QueryOp *&qop,const Expr *c,const PropertyID *props=NULL,unsigned nProps=0,const CondIdx *condIdx=NULL,unsigned ncq=0);
 	RC	load(QueryOp *&qop,const PropListP& plp);
 	RC	out(QueryOp *&qop,const class QVar *qv);
+	RC	prune(unsigned nqs0,const Stmt **cqs,const SourceSpec **css);
 	static	bool	checkSort(QueryOp *qop,const OrderSegQ *req,unsigned nReq,unsigned& nP);
 };
 
@@ -25,6 +25,7 @@ Written by Mark Venguerov 2004-2014
 #include "txmgr.h"
 #include "maps.h"
 #include "blob.h"
+#include "request.h"
 
 //#define REPORT_INDEX_CREATION_TIMES
 
@@ -160,6 +161,7 @@ RC DataEvent::load(int,unsigned)
 				if (cidx==NULL) return RC_NOMEM; unsigned i=0;
 				for (const CondIdx *ci=((SimpleVar*)query->top)->condIdx; ci!=NULL && i<nSegs; ci=ci->next,++i)
 					cidx->indexSegs[i]=ci->ks;
+				if ((flags&META_PROP_SPATIAL)!=0 && isZOrderable(cidx->indexSegs,nSegs)) cidx->indexSegs[0].flags|=SEG_ZORDER;
 			}
 		}
 	} catch (RC rc2) {rc=rc2;}
@@ -282,6 +284,11 @@ RC DataEventMgr::detect(PIN *pin,DetectedEvents& res,Session *ses,const ModProps
 	return dataEventIndex.detect(pin,res,ses,mp);
 }
 
+bool DataEventMgr::dependsOn(PIN *pin,PropertyID pid,Session *ses)
+{
+	return ses->classLocked==RW_X_LOCK || dataEventIndex.dependsOn(pin,pid);
+}
+
 void DataEventMgr::findBase(SimpleVar *qv)
 {
 }
@@ -344,6 +351,31 @@ RC DataEventRegistry::detect(PIN *pin,DetectedEvents& res,Session *ses,const Mod
 	return RC_OK;
 }
 
+bool DataEventRegistry::dependsOn(PIN *pin,PropertyID pid) const
+{
+	if (ndevs!=0) {
+		const DataEventRefT *const *cpp;
+		if (pin->fPartial==0) {
+			for (DataEventRegistry::it<Value> it(*this,pin->properties,pin->nProperties); (cpp=it.next())!=NULL; ) if (dependsOn(*cpp,pid)) return true;
+		} else {
+			unsigned nProps; const HeapPageMgr::HeapV *hprops=(const HeapPageMgr::HeapV *)pin->getPropTab(nProps);
+			if (hprops!=NULL) for (DataEventRegistry::it<HeapPageMgr::HeapV> it(*this,hprops,nProps); (cpp=it.next())!=NULL; ) if (dependsOn(*cpp,pid)) return true;
+		}
+	}
+	return false;
+}
+
+bool DataEventRegistry::dependsOn(const DataEventRefT *cr,PropertyID pid)
+{
+	if (cr->sub!=NULL || cr->acts!=NULL || cr->wnd!=NULL || (cr->notifications&CLASS_NOTIFY_CHANGE)!=0) return true;
+	for (unsigned i=0; i<cr->nIndexProps+cr->nrProps; i++) if (cr->props[i]==pid) return true;
+	if (cr->cond!=NULL) {
+		const PropertyID *pids; unsigned nPids; cr->cond->getExtRefs(pids,nPids);
+		for (unsigned i=0; i<nPids; i++) if ((pids[i]&STORE_MAX_URIID)==pid) return true;
+	}
+	return false;
+}
+
 RC DetectedEvents::insert(const DataEventRef *cr,const DataEventRef **cins)
 {
 	if (cins==NULL && devs!=NULL) {BIN<DataEventRef,DataEventID,DataEventRefT::DataEventRefCmp>::find(cr->cid,devs,ndevs,&cins); assert(cins!=NULL);}
@@ -541,6 +573,7 @@ struct RefData
 	}
 	int	cmp(unsigned i,unsigned j) const {assert(cbuf!=NULL&&i<nkeys&&j<nkeys); return PINRef::cmpPIDs((byte*)cbuf+cbuf[i],(byte*)cbuf+cbuf[j]);}
 	void swap(unsigned i,unsigned j) {assert(cbuf!=NULL&&i<nkeys&&j<nkeys); ushort tmp=cbuf[i]; cbuf[i]=cbuf[j]; cbuf[j]=tmp;}
+	RC append(RefData& src);
 	class MultiKey : public IMultiKey {
 	protected:
 		RefData			*rd;
@@ -603,6 +636,8 @@ public:
 	}
 	virtual	RC		insert(const byte *ext,SearchKey *key=NULL) = 0;
 	virtual	RC		flush(Tree& tr,bool fFinal=false) = 0;
+	virtual	IndexData *clone(Session *s,StackAlloc *sa) const = 0;
+	virtual	RC		merge(IndexData& src) = 0;
 };
 
 
@@ -631,6 +666,18 @@ struct DataEventData : public IndexData, public SubTreeInit
 		}
 		return rc;
 	}
+	IndexData *clone(Session *s,StackAlloc *sa) const {
+		DataEventData *dd=new(sa) DataEventData(s,sa,cid,qry,flags,fSorted);
+		if (dd!=NULL) {dd->fSkip=fSkip; dd->fFlushed=true;}		// worker copy only collects references
+		return dd;
+	}
+	RC merge(IndexData& src) {
+		RefData::MultiKey mk; const SearchKey *key; const void *val; ushort lv; unsigned n; RC rc;
+		if (((DataEventData&)src).refs.cbuf==NULL) return RC_OK;
+		for (mk.setRefData(&((DataEventData&)src).refs); (rc=mk.nextKey(key,val,lv,n,false))==RC_OK; )
+			for (unsigned i=0; i<n; i++) if ((rc=insert((byte*)val+((ushort*)val)[i]))!=RC_OK) return rc;
+		return rc==RC_EOF?RC_OK:rc;
+	}
 };
 
 /**
@@ -652,6 +699,31 @@ struct IndexValue
  */
 typedef SList<IndexValue,IndexValue> IndexList;
 
+/**
+ * multi-key iterator over an ordered list of index values
+ */
+class IndexListKey : public RefData::MultiKey
+{
+	IndexList	*const	il;
+	const	uint32_t	ity;
+	SearchKey			key;
+	IndexValue			*iv;
+public:
+	IndexListKey(IndexList *l,uint32_t ty) : il(l),ity(ty),iv(NULL) {if (l!=NULL) {l->start(); fAdv=true;}}
+	RC	nextKey(const SearchKey *&nk,const void *&value,ushort& lValue,unsigned& multi,bool fAppend) {
+		RC rc=RC_OK; assert(il!=NULL);
+		for (;;iv=NULL) {
+			if (!fAdv) {if (iv==NULL) return RC_EOF;}
+			else if (iv==NULL || iv->refs.nlevels==0) {
+				do if ((iv=(IndexValue*)il->next())==NULL) {fAdv=false; return RC_EOF;} while (iv->refs.cbuf==NULL);
+				new(&key) SearchKey(iv->key,(TREE_KT)ity,SearchKey::PLC_EMB);	// SPTR?
+				if (!setRefData(&iv->refs)) return RC_EOF;
+			}
+			if ((rc=RefData::MultiKey::nextKey(nk,value,lValue,multi,fAppend))!=RC_EOF) {nk=&key; return rc;}
+		}
+	}
+};
+
 /**
  * family index container
  */
@@ -668,11 +740,16 @@ struct FamilyData : public IndexData, public TreeStdRoot
 	FamilyData(Session *s,DataEventID id,const Stmt *q,unsigned flg,const CondIdx *ci,unsigned nS,StackAlloc *ma,bool fS) 
 		: IndexData(s,id,q,flg,nS),TreeStdRoot(INVALID_PAGEID,ses->getStore(),TF_SPLITINTX|TF_NOPOST),sa(ma),il(NULL),ity(KT_VAR),anchor(INVALID_PAGEID),fmt(KT_VAR,KT_VARKEY,KT_PINREFS),fSorted(fS),fFlushed(false) {
 		for (unsigned i=0; i<nS; i++,ci=ci->next) {assert(ci!=NULL); indexSegs[i]=ci->ks;}
+		if ((flg&META_PROP_SPATIAL)!=0 && isZOrderable(indexSegs,nS)) indexSegs[0].flags|=SEG_ZORDER;
 		if (nS==1) {
 			s->getStore()->classMgr->indexFormat(indexSegs[0].type==VT_ANY&&(indexSegs[0].lPrefix!=0||(indexSegs[0].flags&ORD_NCASE)!=0)?VT_STRING:indexSegs[0].type,fmt);
 			ity=fmt.keyType();
 		}
 	}
+	FamilyData(Session *s,const FamilyData& src,StackAlloc *ma)
+		: IndexData(s,src.cid,src.qry,src.flags,src.nSegs),TreeStdRoot(INVALID_PAGEID,s->getStore(),TF_SPLITINTX|TF_NOPOST),sa(ma),il(NULL),ity(src.ity),anchor(INVALID_PAGEID),fmt(src.fmt),fSorted(src.fSorted),fFlushed(false) {
+		memcpy(indexSegs,src.indexSegs,nSegs*sizeof(IndexSeg)); fSkip=src.fSkip;
+	}
 	void *operator new(size_t s,unsigned nSegs,MemAlloc *ma) {return ma->malloc(s+int(nSegs-1)*sizeof(IndexSeg));}
 	RC initDataEventCreate(CreateDataEvent& cc,PIN *pin) {cc.fmt=fmt; cc.anchor=anchor; cc.root=root; cc.height=height; memcpy(cc.indexSegs,indexSegs,nSegs*sizeof(IndexSeg)); return IndexData::initDataEventCreate(cc,pin);}
 	PageID startPage(const SearchKey *key,int& level,bool fRead,bool fBefore) {bool f=root==INVALID_PAGEID; PageID pid=TreeStdRoot::startPage(key,level,fRead,fBefore); if (f) anchor=pid; return pid;}
@@ -690,32 +767,31 @@ struct FamilyData : public IndexData, public TreeStdRoot
 	}
 	RC flush(Tree& tr,bool fFinal) {
 		if (il!=NULL) {
-			MultiKey imk(*this); RC rc;
-			if ((rc=Tree::insert(imk))!=RC_OK) return rc;
+			IndexListKey imk(il,ity); RC rc;
+			if ((rc=load(imk,&anchor))!=RC_OK) return rc;
 			il=NULL; fFlushed=true;
 		}
 		return RC_OK;
 	}
-	class MultiKey : public RefData::MultiKey {
-		FamilyData&		ci;
-		SearchKey		key;
-		IndexValue		*iv;
-		bool			fSub;
-	public:
-		MultiKey(FamilyData& c) : ci(c),iv(NULL),fSub(false) {if (c.il!=NULL) {c.il->start(); fAdv=true;}}
-		RC	nextKey(const SearchKey *&nk,const void *&value,ushort& lValue,unsigned& multi,bool fAppend) {
-			RC rc=RC_OK; assert(ci.il!=NULL); // fSub? !fSorted?
-			for (;;iv=NULL) {
-				if (!fAdv) {if (iv==NULL) return RC_EOF;}
-				else if (iv==NULL || iv->refs.nlevels==0) {
-					do if ((iv=(IndexValue*)ci.il->next())==NULL) {fAdv=false; return RC_EOF;} while (iv->refs.cbuf==NULL);
-					new(&key) SearchKey(iv->key,(TREE_KT)ci.ity,SearchKey::PLC_EMB);	// SPTR?
-					if (!setRefData(&iv->refs)) return RC_EOF;
-				}
-				if ((rc=RefData::MultiKey::nextKey(nk,value,lValue,multi,fAppend))!=RC_EOF) {nk=&key; return rc;}
+	IndexData *clone(Session *s,StackAlloc *ma) const {return new(nSegs,ma) FamilyData(s,*this,ma);}
+	RC merge(IndexData& src) {
+		IndexList *sl=((FamilyData&)src).il; RC rc; if (sl==NULL) return RC_OK;
+		if (il==NULL && (il=new(sa) IndexList(*sa,ity))==NULL) return RC_NOMEM;
+		sl->start();
+		for (IndexValue *iv,*pi; (iv=(IndexValue*)sl->next())!=NULL; ) switch (il->add(*iv,&pi)) {
+		default: return RC_NOMEM;
+		case SLO_INSERT:
+			// the node is a shallow copy: key data and references are moved out of the worker's memory into the allocator counted against the flush limit
+			if (ity>=KT_BIN && pi->key.ptr.p!=NULL) {
+				void *p=sa->malloc(pi->key.ptr.l); if (p==NULL) return RC_NOMEM;
+				memcpy(p,pi->key.ptr.p,pi->key.ptr.l); pi->key.ptr.p=p;
 			}
+			new(&pi->refs) RefData(sa,fSorted); if ((rc=pi->refs.append(iv->refs))!=RC_OK) return rc;
+			break;
+		case SLO_NOOP: if ((rc=pi->refs.append(iv->refs))!=RC_OK) return rc; break;
 		}
-	};
+		return RC_OK;
+	}
 };
 
 struct IndexingCtx
@@ -728,24 +804,216 @@ struct IndexingCtx
 	unsigned		idx;
 	size_t			limit;
 	RC	insert(IndexData& id,const byte *ext,SearchKey *key=NULL) {
-		if (sa->getTotal()>limit) {
-			RC rc; void *skey=NULL;
-			if (key!=NULL && key->type>=KT_BIN && key->v.ptr.p!=NULL) {
-				if ((skey=alloca(key->v.ptr.l))==NULL) return RC_NOMEM;
-				memcpy(skey,key->v.ptr.p,key->v.ptr.l);
-			}
-			for (unsigned i=0; i<ndevs; i++) 
-				if (cid[i]!=NULL && !cid[i]->fSkip && (cid[i]->flags&META_PROP_INMEM)==0 && 
-					(rc=cid[i]->flush(ses->getStore()->classMgr->getDataEventMap()))!=RC_OK) return rc;
-			sa->truncate(TR_REL_ALLBUTONE,&mrk);
-			if (skey!=NULL) {
-				if ((key->v.ptr.p=sa->malloc(key->v.ptr.l))==NULL) return RC_NOMEM;
-				memcpy((void*)key->v.ptr.p,skey,key->v.ptr.l);
-			}
-		}
+		RC rc; if (sa->getTotal()>limit && (rc=flush(key))!=RC_OK) return rc;
 		return id.insert(ext,key);
 	}
+	RC	flush(SearchKey *key=NULL) {
+		RC rc; void *skey=NULL;
+		if (key!=NULL && key->type>=KT_BIN && key->v.ptr.p!=NULL) {
+			if ((skey=alloca(key->v.ptr.l))==NULL) return RC_NOMEM;
+			memcpy(skey,key->v.ptr.p,key->v.ptr.l);
+		}
+		for (unsigned i=0; i<ndevs; i++) 
+			if (cid[i]!=NULL && !cid[i]->fSkip && (cid[i]->flags&META_PROP_INMEM)==0 && 
+				(rc=cid[i]->flush(ses->getStore()->classMgr->getDataEventMap()))!=RC_OK) return rc;
+		sa->truncate(TR_REL_ALLBUTONE,&mrk);
+		if (skey!=NULL) {
+			if ((key->v.ptr.p=sa->malloc(key->v.ptr.l))==NULL) return RC_NOMEM;
+			memcpy((void*)key->v.ptr.p,skey,key->v.ptr.l);
+		}
+		return RC_OK;
+	}
+};
+
+/**
+ * key extraction for index creation
+ */
+struct IndexBuilder
+{
+	struct ArrayVal {ArrayVal *prev; const Value *cv; uint32_t idx,vidx;};
+	Session		*const	ses;
+	IndexData	**const	cid;
+	const unsigned		nPINs;
+	Value		*const	indexed;
+	const unsigned		nIndexed;
+	const Value	**const	vals;
+	ArrayVal			*freeAV;
+	const bool			fCheck;
+	const uint32_t		mask;
+	IndexBuilder(Session *s,IndexData **ci,unsigned np,Value *ind,unsigned ni,const Value **vs,bool fC,uint32_t msk)
+		: ses(s),cid(ci),nPINs(np),indexed(ind),nIndexed(ni),vals(vs),freeAV(NULL),fCheck(fC),mask(msk) {}
+	~IndexBuilder() {while (freeAV!=NULL) {ArrayVal *av=freeAV; freeAV=av->prev; ses->free(av);}}
+};
+
+/**
+ * state shared by index creation workers
+ */
+struct IndexBuildCtl
+{
+	StoreCtx		*const	ctx;
+	IndexData		**const	cid;
+	const unsigned			nPINs;
+	const Value		*const	indexed;
+	const unsigned			nIndexed;
+	const unsigned			xSegs;
+	const PageID	*const	pages;
+	const size_t			limit;
+	const bool				fTest;
+	Mutex					lock;
+	WaitEvent				done;
+	unsigned				nActive;
+	volatile long			nDone;
+	IndexBuildCtl(StoreCtx *ct,IndexData **ci,unsigned np,const Value *ind,unsigned ni,unsigned xs,const PageID *pg,size_t lim,bool fT)
+		: ctx(ct),cid(ci),nPINs(np),indexed(ind),nIndexed(ni),xSegs(xs),pages(pg),limit(lim),fTest(fT),nActive(0),nDone(0) {}
+};
+
+/**
+ * index creation worker - extracts keys from a range of heap pages into its own lists
+ */
+class IndexBuildRQ : public Request
+{
+	IndexBuildCtl&	ctl;
+public:
+	StackAlloc		sa;
+	IndexData		**cid;
+	const unsigned	start;
+	const unsigned	end;
+	unsigned		next;
+	RC				rc;
+	IndexBuildRQ(IndexBuildCtl& c,unsigned st,unsigned e) : ctl(c),sa(c.ctx),cid(NULL),start(st),end(e),next(st),rc(RC_OK) {}
+	void	process();
+	void	destroy() {MutexP lck(&ctl.lock); if (--ctl.nActive==0) ctl.done.signal();}
 };
+
+}
+
+RC RefData::append(RefData& src)
+{
+	RefData::MultiKey mk; const SearchKey *key; const void *val; ushort lv; unsigned n; RC rc;
+	if (src.cbuf==NULL) return RC_OK;
+	for (mk.setRefData(&src); (rc=mk.nextKey(key,val,lv,n,false))==RC_OK; )
+		for (unsigned i=0; i<n; i++) if ((rc=add((byte*)val+((ushort*)val)[i]))!=RC_OK) return rc;
+	return rc==RC_EOF?RC_OK:rc;
+}
+
+void IndexBuildRQ::process()
+{
+	Session *ses=Session::getSession(); if (ses==NULL) {rc=RC_NOSESSION; return;}
+	IndexData **ci=new(&sa) IndexData*[ctl.nPINs]; if (ci==NULL) {rc=RC_NOMEM; return;}
+	for (unsigned i=0; i<ctl.nPINs; i++) if (ctl.cid[i]==NULL) ci[i]=NULL; else if ((ci[i]=ctl.cid[i]->clone(ses,&sa))==NULL) {rc=RC_NOMEM; return;}
+	Value *indexed=NULL; const Value **vals=NULL;
+	if (ctl.nIndexed!=0) {if ((indexed=(Value*)sa.malloc(ctl.nIndexed*sizeof(Value)))!=NULL) memcpy(indexed,ctl.indexed,ctl.nIndexed*sizeof(Value)); else {rc=RC_NOMEM; return;}}
+	if (ctl.xSegs!=0 && (vals=(const Value**)sa.malloc(ctl.xSegs*sizeof(Value*)))==NULL) {rc=RC_NOMEM; return;}
+	StackAlloc::SubMark mrk; sa.mark(mrk); IndexingCtx cctx={ses,ci,ctl.nPINs,&sa,mrk,0,~size_t(0)}; cid=ci;
+	IndexBuilder bld(ses,ci,ctl.nPINs,indexed,ctl.nIndexed,vals,true,ctl.fTest?0:HOH_DELETED|HOH_HIDDEN);
+	PINx qr(ses),*pqr=&qr; Values vctx[QV_ALL]; memset(vctx,0,sizeof(vctx)); EvalCtx ectx(ses,NULL,0,(PIN**)&pqr,1,vctx,QV_ALL);
+	for (; next<end && sa.getTotal()<=ctl.limit && !ctl.ctx->inShutdown(); next++) {
+		if ((rc=ctl.ctx->classMgr->scan(bld,ctl.pages[next],qr,ectx,cctx))!=RC_OK) break;
+		InterlockedIncrement(&ctl.nDone);
+	}
+}
+
+RC DataEventMgr::index(IndexBuilder& bld,PINx *pin,const EvalCtx& ectx,IndexingCtx& cctx)
+{
+	Session *const ses=bld.ses; IndexData **const cid=bld.cid; const unsigned nPINs=bld.nPINs,nIndexed=bld.nIndexed; Value *const indexed=bld.indexed;
+	const Value **const vals=bld.vals; IndexBuilder::ArrayVal *&freeAV=bld.freeAV; const bool fCheck=bld.fCheck; RC rc=RC_OK;
+	byte extc[XPINREFSIZE]; bool fExtC=false,fLoaded=false;
+	if (pin->epr.buf[0]!=0) PINRef::changeFColl(pin->epr.buf,false);
+	for (cctx.idx=0; cctx.idx<nPINs; cctx.idx++) {
+		IndexData &ci=*cid[cctx.idx]; if (ci.fSkip) continue;
+		if (fCheck && (pin->hpin->hdr.descr&HOH_DELETED)!=0) continue;
+		if (!fCheck || ci.qry->checkConditions(ectx,0,true)) {
+			if (pin->epr.buf[0]==0 && pin->pack()!=RC_OK) continue;
+			if (ci.nSegs==0) rc=cctx.insert(ci,pin->epr.buf,NULL);
+			else {
+				unsigned nidxd,nNulls=0;
+				if (pin->properties!=NULL) nidxd=pin->nProperties;
+				else {
+					nidxd=nIndexed; assert(indexed!=NULL && nIndexed>0);
+					if (!fLoaded) {
+						if (pin->hpin!=NULL || (rc=pin->getBody())==RC_OK) fLoaded=true; else break;		// release?
+						bool fSSV=false;
+						for (unsigned i=0; i<nIndexed; i++) {
+							RC rc=pin->getV(indexed[i].property,indexed[i]);
+							if (rc!=RC_OK) {if (rc==RC_NOTFOUND) {rc=RC_OK; nNulls++;} else {fLoaded=false; break;}} 
+							else if ((indexed[i].flags&VF_SSV)!=0) fSSV=true;
+						}
+						if (fSSV) rc=PINx::loadSSVs(indexed,nIndexed,0,ses,ses);
+					}
+				}
+				if (rc==RC_OK && nNulls<nidxd) {
+					FamilyData &fi=(FamilyData&)ci;
+					const unsigned nSegs=fi.nSegs; IndexBuilder::ArrayVal *avs0=NULL,*avs=NULL;
+					for (unsigned k=nNulls=0; k<nSegs; k++) {
+						IndexSeg& ks=fi.indexSegs[k];
+						const Value *cv=vals[k]=VBIN::find(ks.propID,indexed,nIndexed); assert(cv!=NULL);
+						if (cv->type==VT_ANY) nNulls++;
+						else if (cv->type==VT_COLLECTION) {
+							IndexBuilder::ArrayVal *av=freeAV;
+							if (av!=NULL) freeAV=av->prev;
+							else if ((av=(IndexBuilder::ArrayVal*)ses->malloc(sizeof(IndexBuilder::ArrayVal)))==NULL) {rc=RC_NOMEM; break;}
+							av->prev=avs; avs=av; av->idx=0; av->cv=cv; av->vidx=k; if (avs0==NULL) avs0=av;
+							vals[k]=!cv->isNav()?cv->varray:cv->nav->navigate(GO_FIRST);
+							if (!fExtC) {memcpy(extc,pin->epr.buf,PINRef::len(pin->epr.buf)); PINRef::changeFColl(extc,true); fExtC=true;}
+						}
+					}
+					if (nNulls<nSegs) for (;;) {		// || derived!
+						SearchKey key;
+						if ((rc=key.toKey(vals,nSegs,fi.indexSegs,-1,ses,cctx.sa))==RC_TYPE||rc==RC_SYNTAX) rc=RC_OK;
+						else if (rc==RC_OK) {if ((rc=cctx.insert(fi,avs!=NULL?extc:pin->epr.buf,&key))!=RC_OK) break;}
+						else break;
+						bool fNext=false;
+						for (IndexBuilder::ArrayVal *av=avs; !fNext && av!=NULL; av=av->prev) {
+							const Value *cv; assert(av->cv->type==VT_COLLECTION);
+							if (!av->cv->isNav()) {
+								if (++av->idx>=av->cv->length) av->idx=0; else fNext=true;
+								cv=&av->cv->varray[av->idx];
+							} else {
+								if ((cv=av->cv->nav->navigate(GO_NEXT))!=NULL) fNext=true;
+								else if (av->prev!=NULL) {cv=av->cv->nav->navigate(GO_FIRST); assert(cv!=NULL);}
+							}
+							vals[av->vidx]=cv;
+						}
+						if (!fNext) break;
+					}
+					if (avs!=NULL) {avs0->prev=freeAV; freeAV=avs;}
+				}
+			}
+		}
+	}
+	if (fLoaded) for (unsigned i=0; i<nIndexed; i++)
+		{PropertyID pid=indexed[i].property; freeV(indexed[i]); indexed[i].setError(pid);}
+	return rc;
+}
+
+RC DataEventMgr::scan(IndexBuilder& bld,PageID pid,PINx& qr,const EvalCtx& ectx,IndexingCtx& cctx)
+{
+	PBlock *pb=ctx->bufMgr->getPage(pid,ctx->heapMgr,QMGR_SCAN|PGCTL_RLATCH,NULL,bld.ses); if (pb==NULL) return RC_OK;
+	const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage*)pb->getPageBuf(); RC rc=RC_OK;
+	for (unsigned slot=0; rc==RC_OK && slot<hp->nSlots; slot++) {
+		const HeapPageMgr::HeapPIN *hpin=(const HeapPageMgr::HeapPIN *)hp->getObject(hp->getOffset(PageIdx(slot)));
+		if (hpin==NULL || hpin->hdr.getType()!=HO_PIN || (hpin->hdr.descr&bld.mask)!=bld.mask>>16) continue;
+		qr.addr.pageID=pid; qr.addr.idx=PageIdx(slot);
+		if (!hpin->getAddr(const_cast<PID&>(qr.id))) {const_cast<PID&>(qr.id).pid=qr.addr; const_cast<PID&>(qr.id).ident=STORE_OWNER;}
+		qr.pb=pb; qr.pb.set(PGCTL_NOREL); qr.hpin=hpin; qr.copyFlags(); qr.epr.flags|=PINEX_ADDRSET;
+		rc=index(bld,&qr,ectx,cctx); qr.cleanup();
+	}
+	pb->release(0,bld.ses); return rc;
+}
+
+RC DataEventMgr::getHeapPages(Session *ses,PageID *&pages,unsigned& nPages)
+{
+	unsigned xPages=0; pages=NULL; nPages=0; PBlockP pb;
+	for (PageID pid=ctx->theCB->getRoot(MA_HEAPDIRFIRST); pid!=INVALID_PAGEID; pid=((const HeapDirMgr::HeapDirPage*)pb->getPageBuf())->next) {
+		if (pb.getPage(pid,ctx->hdirMgr,QMGR_SCAN,ses)==NULL) return RC_CORRUPTED;
+		const HeapDirMgr::HeapDirPage *hd=(const HeapDirMgr::HeapDirPage*)pb->getPageBuf();
+		if (nPages+hd->nSlots>xPages) {
+			xPages=max(xPages*2,nPages+hd->nSlots);
+			if ((pages=(PageID*)ses->realloc(pages,xPages*sizeof(PageID),nPages*sizeof(PageID)))==NULL) return RC_NOMEM;
+		}
+		memcpy(pages+nPages,hd+1,hd->nSlots*sizeof(PageID)); nPages+=hd->nSlots;
+	}
+	return RC_OK;
 }
 
 RC DataEventMgr::buildIndex(PIN *const *pins,unsigned nPINs,Session *ses,bool fDrop)
@@ -753,7 +1021,7 @@ RC DataEventMgr::buildIndex(PIN *const *pins,unsigned nPINs,Session *ses,bool fD
 	if (pins==NULL || nPINs==0) return RC_INVPARAM; if (ses==NULL) return RC_NOSESSION; 
 	assert(ctx->namedMgr->fInit && ses->inWriteTx());
 
-	IndexData **cid; StackAlloc sa(ses); DataEventID commonBase=STORE_INVALID_URIID;
+	IndexData **cid; StackAlloc sa(ses);
 	if ((cid=new(&sa) IndexData*[nPINs])!=NULL) memset(cid,0,nPINs*sizeof(IndexData*)); else return RC_NOMEM;
 	Value *indexed=NULL; unsigned nIndexed=0,xIndexed=0,xSegs=0; unsigned nIndex=0; RC rc=RC_OK;
 	for (unsigned i=0; i<nPINs; i++) {
@@ -796,86 +1064,57 @@ RC DataEventMgr::buildIndex(PIN *const *pins,unsigned nPINs,Session *ses,bool fD
 	TIMESTAMP st,mid,end; getTimestamp(st);
 #endif
 
-	StackAlloc::SubMark mrk; sa.mark(mrk); unsigned nS=StoreCtx::getNStores();
-	IndexingCtx cctx={ses,cid,nPINs,&sa,mrk,0,INDEX_BUF_LIMIT/max(nS,1u)};
+	StackAlloc::SubMark mrk; sa.mark(mrk); unsigned nS=StoreCtx::getNStores(),nSlices=1;
+	IndexingCtx cctx={ses,cid,nPINs,&sa,mrk,0,INDEX_BUF_LIMIT/max(nS,1u)}; IndexBuildRQ **rqs=NULL;
 
 	if (rc==RC_OK && nIndex!=0) {
-		MutexP lck(&lock); bool fTest=false; ses->resetAbortQ(); Cursor cu(ses);
-		rc=nIndex==1&&cid[0]->qry!=NULL&&!fDrop?cu.init((Stmt*)cid[0]->qry,~0ULL,0,MODE_DEVENT|MODE_NODEL):(fTest=true,cu.init(commonBase));
-		const Value **vals=NULL; struct ArrayVal {ArrayVal *prev; const Value *cv; uint32_t idx,vidx;} *freeAV=NULL;
+		MutexP lck(&lock); ses->resetAbortQ(); const Value **vals=NULL;
+		const bool fTest=nIndex!=1||cid[0]->qry==NULL||fDrop,fScan=fTest||cid[0]->qry->top->type==QRY_SIMPLE&&((SimpleVar*)cid[0]->qry->top)->nSrcs==0;
 		if (xSegs>0 && (vals=(const Value**)alloca(xSegs*sizeof(Value*)))==NULL) rc=RC_NOMEM;
-
-		PINx pc(ses); PIN *pp[2]={NULL,(PIN*)&pc}; PINx *pin;
-		while (rc==RC_OK && (rc=cu.next(pin))==RC_OK) {
-			byte extc[XPINREFSIZE]; bool fExtC=false,fLoaded=false; pp[0]=pin;
-			if (pin->epr.buf[0]!=0) PINRef::changeFColl(pin->epr.buf,false);
-			for (cctx.idx=0; cctx.idx<nPINs; cctx.idx++) {
-				IndexData &ci=*cid[cctx.idx]; if (ci.fSkip) continue;
-				if (fTest && (pin->hpin->hdr.descr&HOH_DELETED)!=0) continue;
-				if (pc.id!=pins[cctx.idx]->id) {pc.cleanup(); pc.id=pins[cctx.idx]->id;}
-				if (!fTest || ci.qry->checkConditions(cu.getCtx(),0,true)) {
-					if (pin->epr.buf[0]==0 && pin->pack()!=RC_OK) continue;
-					if (ci.nSegs==0) rc=cctx.insert(ci,pin->epr.buf,NULL);
-					else {
-						unsigned nidxd,nNulls=0;
-						if (pin->properties!=NULL) nidxd=pin->nProperties;
-						else {
-							nidxd=nIndexed; assert(indexed!=NULL && nIndexed>0);
-							if (!fLoaded) {
-								if (pin->hpin!=NULL || (rc=pin->getBody())==RC_OK) fLoaded=true; else break;		// release?
-								bool fSSV=false;
-								for (unsigned i=0; i<nIndexed; i++) {
-									RC rc=pin->getV(indexed[i].property,indexed[i]);
-									if (rc!=RC_OK) {if (rc==RC_NOTFOUND) {rc=RC_OK; nNulls++;} else {fLoaded=false; break;}} 
-									else if ((indexed[i].flags&VF_SSV)!=0) fSSV=true;
-								}
-								if (fSSV) rc=PINx::loadSSVs(indexed,nIndexed,0,ses,ses);
-							}
-						}
-						if (rc==RC_OK && nNulls<nidxd) {
-							FamilyData &fi=(FamilyData&)ci;
-							const unsigned nSegs=fi.nSegs; ArrayVal *avs0=NULL,*avs=NULL; assert(nSegs<=xSegs);
-							for (unsigned k=nNulls=0; k<nSegs; k++) {
-								IndexSeg& ks=fi.indexSegs[k];
-								const Value *cv=vals[k]=VBIN::find(ks.propID,indexed,nIndexed); assert(cv!=NULL);
-								if (cv->type==VT_ANY) nNulls++;
-								else if (cv->type==VT_COLLECTION) {
-									ArrayVal *av=freeAV;
-									if (av!=NULL) freeAV=av->prev;
-									else if ((av=(ArrayVal*)ses->malloc(sizeof(ArrayVal)))==NULL) {rc=RC_NOMEM; break;}
-									av->prev=avs; avs=av; av->idx=0; av->cv=cv; av->vidx=k; if (avs0==NULL) avs0=av;
-									vals[k]=!cv->isNav()?cv->varray:cv->nav->navigate(GO_FIRST);
-									if (!fExtC) {memcpy(extc,pin->epr.buf,PINRef::len(pin->epr.buf)); PINRef::changeFColl(extc,true); fExtC=true;}
-								}
-							}
-							if (nNulls<nSegs) for (;;) {		// || derived!
-								SearchKey key;
-								if ((rc=key.toKey(vals,nSegs,fi.indexSegs,-1,ses,&sa))==RC_TYPE||rc==RC_SYNTAX) rc=RC_OK;
-								else if (rc==RC_OK) {if ((rc=cctx.insert(fi,avs!=NULL?extc:pin->epr.buf,&key))!=RC_OK) break;}
-								else break;
-								bool fNext=false;
-								for (ArrayVal *av=avs; !fNext && av!=NULL; av=av->prev) {
-									const Value *cv; assert(av->cv->type==VT_COLLECTION);
-									if (!av->cv->isNav()) {
-										if (++av->idx>=av->cv->length) av->idx=0; else fNext=true;
-										cv=&av->cv->varray[av->idx];
-									} else {
-										if ((cv=av->cv->nav->navigate(GO_NEXT))!=NULL) fNext=true;
-										else if (av->prev!=NULL) {cv=av->cv->nav->navigate(GO_FIRST); assert(cv!=NULL);}
-									}
-									vals[av->vidx]=cv;
-								}
-								if (!fNext) break;
-							}
-							if (avs!=NULL) {avs0->prev=freeAV; freeAV=avs;}
-						}
+		IndexBuilder bld(ses,cid,nPINs,indexed,nIndexed,vals,fScan,fTest?0:HOH_DELETED|HOH_HIDDEN);
+		if (rc!=RC_OK) ;
+		else if (!fScan) {
+			Cursor cu(ses); PINx *pin;
+			if ((rc=cu.init((Stmt*)cid[0]->qry,~0ULL,0,MODE_DEVENT|MODE_NODEL))==RC_OK)
+				while ((rc=cu.next(pin))==RC_OK && (rc=index(bld,pin,cu.getCtx(),cctx))==RC_OK);
+		} else {
+			PageID *pages=NULL; unsigned nPages=0;
+			if ((rc=getHeapPages(ses,pages,nPages))==RC_OK) {
+				IIndexProgress *const prg=ses->getIndexProgress(); PINx qr(ses),*pqr=&qr; Values vctx[QV_ALL]; memset(vctx,0,sizeof(vctx));
+				EvalCtx ectx(ses,NULL,0,(PIN**)&pqr,1,vctx,QV_ALL); const unsigned end=(nSlices=min(min((unsigned)getNProcessors(),nPages/INDEX_PAGES_PER_WORKER),INDEX_MAX_WORKERS+1u))>1?nPages/nSlices:nPages;
+				IndexBuildCtl ctl(ctx,cid,nPINs,indexed,nIndexed,xSegs,pages,cctx.limit/max(nSlices,1u),fTest); unsigned nDone=0;
+				if (nSlices<=1) nSlices=1; else if ((rqs=(IndexBuildRQ**)alloca(nSlices*sizeof(IndexBuildRQ*)))==NULL) rc=RC_NOMEM;
+				else for (unsigned i=1; i<nSlices; i++) {
+					if ((rqs[i]=new(ses) IndexBuildRQ(ctl,nPages*i/nSlices,nPages*(i+1)/nSlices))==NULL) {nSlices=i; rc=RC_NOMEM; break;}
+					{MutexP lck(&ctl.lock); ctl.nActive++;}
+					if (!RequestQueue::postRequest(rqs[i],ctx)) {MutexP lck(&ctl.lock); ctl.nActive--;}
+				}
+				for (; rc==RC_OK && nDone<end; nDone++) {
+					if ((rc=ses->testAbortQ())==RC_OK && (rc=scan(bld,pages[nDone],qr,ectx,cctx))==RC_OK && prg!=NULL) prg->progress(nDone+ctl.nDone+1,nPages);
+				}
+				if (rqs!=NULL) {
+					for (ctl.lock.lock(); ctl.nActive!=0; ) {
+						ctl.done.wait(ctl.lock,INDEX_PROGRESS_WAIT);
+						if (prg!=NULL) {ctl.lock.unlock(); prg->progress(nDone+ctl.nDone,nPages); ctl.lock.lock();}
 					}
+					ctl.lock.unlock(); nDone+=ctl.nDone;
+					for (unsigned i=1; i<nSlices; i++) {
+						IndexBuildRQ *rq=rqs[i];
+						if (rc==RC_OK && (rc=rq->rc)==RC_OK && rq->cid!=NULL) for (unsigned j=0; j<nPINs; j++)
+							if (cid[j]!=NULL && !cid[j]->fSkip && (rc=cid[j]->merge(*rq->cid[j]))!=RC_OK) break;
+						if (rc==RC_OK && cctx.sa->getTotal()>cctx.limit) rc=cctx.flush();
+						for (unsigned j=rq->next; rc==RC_OK && j<rq->end; j++)				// left by the worker: not started or out of memory
+							if ((rc=ses->testAbortQ())==RC_OK && (rc=scan(bld,pages[j],qr,ectx,cctx))==RC_OK && prg!=NULL) prg->progress(++nDone,nPages);
+						rq->~IndexBuildRQ(); ses->free(rq); rqs[i]=NULL;		// merged lists are copied, worker memory is released before the next slice is merged
+					}
+				}
+				for (SubTx *stx=&ses->tx; rc==RC_OK && stx!=NULL; stx=stx->next) if ((unsigned)stx->defHeap!=0) {
+					PageSet::it it(stx->defHeap);
+					for (PageID pid; rc==RC_OK && (pid=++it)!=INVALID_PAGEID; ) rc=scan(bld,pid,qr,ectx,cctx);
 				}
 			}
-			if (fLoaded) for (unsigned i=0; i<nIndexed; i++)
-				{PropertyID pid=indexed[i].property; freeV(indexed[i]); indexed[i].setError(pid);}
+			if (pages!=NULL) ses->free(pages);
 		}
-		while (freeAV!=NULL) {ArrayVal *av=freeAV; freeAV=av->prev; ses->free(av);}
 		if (rc==RC_EOF) rc=RC_OK;
 	}
 	if (indexed!=NULL) ses->free(indexed);
@@ -1005,7 +1244,65 @@ void DropDataEvent::destroy(Session *s)
 
 enum SubSetV {NewV,DelV,AllPrevV,AllCurV,UnchagedV};
 
-RC DataEventMgr::updateIndex(Session *ses,PIN *pin,const DetectedEvents& clr,DataIndexOp op,const ModProps *mp,const PageAddr *oldAddr)
+struct IndexBatch::IndexKeys
+{
+	IndexKeys	*next;
+	DataEventID	cid;
+	uint32_t	ity;
+	IndexList	il;
+	IndexKeys(IndexKeys *nxt,DataEventID id,uint32_t ty,StackAlloc& sa) : next(nxt),cid(id),ity(ty),il(sa,ty) {}
+};
+
+RC IndexBatch::insert(DataEventID cid,const SearchKey& key,const byte *ext)
+{
+	IndexKeys *ik; IndexValue *pi=NULL; RC rc;
+	if (sa.getTotal()>INDEX_BATCH_LIMIT && (rc=flush())!=RC_OK) return rc;
+	for (ik=keys; ik!=NULL && ik->cid!=cid; ik=ik->next);
+	if (ik==NULL && (ik=keys=new(&sa) IndexKeys(keys,cid,key.type,sa))==NULL) return RC_NOMEM;
+	IndexKeyV kv=key.v; if (key.type>=KT_BIN) kv.ptr.p=key.getPtr2();
+	IndexValue v(kv,&sa,false);
+	switch (ik->il.add(v,&pi)) {
+	default: return RC_NOMEM;
+	case SLO_INSERT:
+		if (key.type>=KT_BIN) {		// key memory is released by the caller
+			void *p=sa.malloc(kv.ptr.l); if (p==NULL) return RC_NOMEM;
+			memcpy(p,kv.ptr.p,kv.ptr.l); pi->key.ptr.p=p;
+		}
+	case SLO_NOOP:
+		if (pi->refs.lcbuf>=0x1000 && PINRef::len(ext)+sizeof(ushort)>pi->refs.left) {
+			// references of one key are kept in a single block small enough for a leaf update
+			DataEvent *dev=NULL; Tree *tr=getTree(cid,dev); ushort nk,l;
+			if (pi->refs.nkeys>1) QSort<RefData>::sort(pi->refs,pi->refs.nkeys); l=pi->refs.compact(nk);
+			rc=tr!=NULL?tr->insert(SearchKey(pi->key,(TREE_KT)ik->ity,SearchKey::PLC_EMB),pi->refs.cbuf,l,nk):RC_NOTFOUND;
+			if (dev!=NULL) dev->release(); if (rc!=RC_OK) return rc;
+			new(&pi->refs) RefData(&sa,false);
+		}
+		break;
+	}
+	return pi->refs.add(ext);
+}
+
+Tree *IndexBatch::getTree(DataEventID cid,DataEvent *&dev) const
+{
+	DataEventMgr *mgr=ses->getStore()->classMgr; if (cid==STORE_INVALID_CLASSID) {dev=NULL; return &mgr->getDataEventMap();}
+	if ((dev=mgr->getDataEvent(cid))!=NULL && dev->getIndex()!=NULL) return dev->getIndex();
+	report(MSG_ERROR,"Family %d not found\n",cid); return NULL;
+}
+
+RC IndexBatch::flush()
+{
+	RC rc=RC_OK;
+	for (IndexKeys *ik=keys; rc==RC_OK && ik!=NULL; ik=ik->next) {
+		ik->il.start();
+		for (IndexValue *iv; (iv=(IndexValue*)ik->il.next())!=NULL; ) if (iv->refs.nkeys>1) QSort<RefData>::sort(iv->refs,iv->refs.nkeys);
+		IndexListKey imk(&ik->il,ik->ity); DataEvent *dev=NULL; Tree *tr=getTree(ik->cid,dev);
+		if (tr!=NULL && (rc=tr->insert(imk))!=RC_OK) report(MSG_ERROR,"Error %d updating(%d) index %d\n",rc,CI_INSERT,ik->cid);
+		if (dev!=NULL) dev->release();
+	}
+	keys=NULL; sa.truncate(TR_REL_ALLBUTONE); return rc;
+}
+
+RC DataEventMgr::updateIndex(Session *ses,PIN *pin,const DetectedEvents& clr,DataIndexOp op,const ModProps *mp,const PageAddr *oldAddr,IndexBatch *ib)
 {
 	RC rc=RC_OK; const bool fMigrated=op==CI_UPDATE && pin->addr!=*oldAddr;
 	DataEvent *dev=NULL; DataIndex *cidx; byte ext[XPINREFSIZE],ext2[XPINREFSIZE]; pin->fReload=1;
@@ -1036,7 +1333,7 @@ RC DataEventMgr::updateIndex(Session *ses,PIN *pin,const DetectedEvents& clr,Dat
 						break;
 					}
 				}
-				if (rc==RC_OK) rc=dataEventMap.insert(key,ext,lext); break;
+				if (rc==RC_OK) rc=ib!=NULL&&op==CI_INSERT&&cr->wnd==NULL?ib->insert(STORE_INVALID_CLASSID,key,ext):dataEventMap.insert(key,ext,lext); break;
 			case CI_UPDATE: if (fMigrated) {if (lext2==0) {pr.addr=*oldAddr; lext2=pr.enc(ext2);} rc=dataEventMap.update(key,ext2,lext2,ext,lext);} break;	// check same?
 			case CI_SDELETE: case CI_DELETE: rc=dataEventMap.remove(key,ext,lext); break;
 			}
@@ -1130,7 +1427,7 @@ RC DataEventMgr::updateIndex(Session *ses,PIN *pin,const DetectedEvents& clr,Dat
 					} else {
 						switch (kop) {
 						default: assert(0);
-						case CI_INSERT: case CI_UDELETE: rc=cidx->insert(key,ext,lext); break;
+						case CI_INSERT: case CI_UDELETE: rc=ib!=NULL&&kop==CI_INSERT?ib->insert(cr->cid,key,ext):cidx->insert(key,ext,lext); break;
 						case CI_DELETE: case CI_SDELETE: rc=cidx->remove(key,ext,lext); break;
 						case CI_UPDATE: rc=cidx->update(key,ext2,lext2,ext,lext); break;
 						}
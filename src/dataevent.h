@@ -40,6 +40,11 @@ namespace AfyKernel
 #define	INDEX_BUF_LIMIT		0x40000000
 #endif
 
+#define	INDEX_PAGES_PER_WORKER	0x100				/**< minimum number of heap pages per index creation worker */
+#define	INDEX_MAX_WORKERS		16					/**< maximum number of index creation workers */
+#define	INDEX_PROGRESS_WAIT		200					/**< interval of progress reports while waiting for workers (ms) */
+#define	INDEX_BATCH_LIMIT		0x1000000			/**< memory limit for index insertions deferred in a batch of new PINs */
+
 #define	META_PROP_ACL				0x100
 
 #define	DEFAULT_DATA_HASH_SIZE		0x100
@@ -143,7 +148,7 @@ class DataIndex : public TreeStdRoot
 	IndexSeg		indexSegs[1];
 public:
 	DataIndex(DataEvent& cl,unsigned nS,PageID rt,PageID anc,IndexFormat fm,uint32_t h,StoreCtx *ct)
-				: TreeStdRoot(rt,ct),dev(cl),fmt(fm),anchor(anc),state(0),nSegs(nS) {height=h;}
+				: TreeStdRoot(rt,ct,TF_WITHDEL|TF_KEYFILTER|TF_KEYSTATS|TF_DEFRAG),dev(cl),fmt(fm),anchor(anc),state(0),nSegs(nS) {height=h;}
 	virtual			~DataIndex();
 	void			*operator new(size_t s,unsigned nSegs,MemAlloc *ma) {return ma->malloc(s+int(nSegs-1)*sizeof(IndexSeg));}
 	operator		DataEvent&() const {return dev;}
@@ -297,6 +302,8 @@ private:
 	RC					insert(const DataEventRef& inf,const Stmt *qry,DataEventRefT *&cr,const DataEventRefT **&pc,unsigned& n);
 	RC					detect(PIN *pin,DetectedEvents& res,Session *ses,const ModProps *mp=NULL);
 	RC					detect(const DataEventRefT *cp,PIN *pin,DetectedEvents& res,Session *ses,const ModProps *mp=NULL);
+	bool				dependsOn(PIN *pin,PropertyID pid) const;
+	static	bool		dependsOn(const DataEventRefT *cr,PropertyID pid);
 	template<typename T> class it {
 		const	DataEventRegistry&	pidx;
 		const	T					*pt;
@@ -360,6 +367,23 @@ public:
 	void	operator	delete(void *p) {if (p!=NULL) ((IndexNavImpl*)p)->ses->free(p);}
 };
 
+/**
+ * index insertions of a batch of new PINs collected per index in key order (see QueryPrc::persistPINs)
+ */
+class IndexBatch
+{
+	struct	IndexKeys;
+	Session		*const	ses;
+	StackAlloc			sa;
+	IndexKeys			*keys;
+	Tree	*getTree(DataEventID cid,DataEvent *&dev) const;
+public:
+	IndexBatch(Session *s) : ses(s),sa(s),keys(NULL) {}
+	RC		insert(DataEventID cid,const SearchKey& key,const byte *ext);
+	RC		flush();
+	bool	isEmpty() const {return keys==NULL;}
+};
+
 typedef QMgr<DataEvent,DataEventID,DataEventID,int> DataEventHash;
 
 /**
@@ -375,6 +399,7 @@ class DataEventMgr : public DataEventHash, public TreeFactory, public TreeConnec
 	friend	class		FamilyCreate;
 	friend	class		DropDataEvent;
 	friend	class		TimerQueue;
+	friend	class		IndexBuildRQ;
 	StoreCtx			*const ctx;
 	RWLock				rwlock;
 	DataEventRegistry	dataEventIndex;
@@ -385,11 +410,12 @@ class DataEventMgr : public DataEventHash, public TreeFactory, public TreeConnec
 public:
 	DataEventMgr(StoreCtx *ct,unsigned timeout,unsigned hashSize=DEFAULT_DATA_HASH_SIZE,unsigned cacheSize=DEFAULT_DATA_CACHE_SIZE);
 	RC					detect(PIN *pin,DetectedEvents& res,Session *ses,const ModProps *mp=NULL);
+	bool				dependsOn(PIN *pin,PropertyID pid,Session *ses);
 	RC					enable(Session *ses,DataEvent *dev,unsigned notifications);
 	void				disable(Session *ses,DataEvent *dev,unsigned notifications);
 	RWLock				*getLock() {return &rwlock;}
 	RC					getDataEventInfo(DataEventID cid,DataEvent *&dev,uint64_t& nPINs);
-	RC					updateIndex(Session *ses,PIN *pin,const DetectedEvents& clr,DataIndexOp op,const ModProps *mp=NULL,const PageAddr *old=NULL);
+	RC					updateIndex(Session *ses,PIN *pin,const DetectedEvents& clr,DataIndexOp op,const ModProps *mp=NULL,const PageAddr *old=NULL,IndexBatch *ib=NULL);
 	RC					rebuildAll(Session *ses);
 	RC					buildIndex(PIN *const *pins,unsigned nPins,Session *ses,bool fDrop=false);
 	void				findBase(SimpleVar *qv);
@@ -412,6 +438,9 @@ private:
 	DataEventRegistry	*getRegistry(const SimpleVar *qv,Session *ses,bool fAdd=true);
 	Tree				*connect(uint32_t handle);
 	RC					copyActions(const Value *pv,DataEventActions *&acts,unsigned idx);
+	RC					getHeapPages(Session *ses,PageID *&pages,unsigned& nPages);
+	RC					index(struct IndexBuilder& bld,PINx *pin,const struct EvalCtx& ectx,struct IndexingCtx& cctx);
+	RC					scan(struct IndexBuilder& bld,PageID pid,PINx& qr,const struct EvalCtx& ectx,struct IndexingCtx& cctx);
 	void				destroyActions(DataEventActions *acts);
 };
 
@@ -1297,6 +1297,15 @@ RC AggAcc::next(const Value& v)
 	return rc;
 }
 
+RC AggAcc::next(const Value& v,uint64_t n)
+{
+	RC rc=RC_OK;
+	if (op==OP_COUNT) count+=n;
+	else if (op==OP_MIN || op==OP_MAX) {if (n!=0 && (rc=next(v))==RC_OK) count+=n-1;}
+	else while (n--!=0 && (rc=next(v))==RC_OK);
+	return rc;
+}
+
 RC AggAcc::result(Value& res,bool fRestore)
 {
 	try {
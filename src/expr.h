@@ -380,6 +380,7 @@ struct AggAcc
 	AggAcc() : count(0),sum2(0.),eid(0),hist(NULL),op(OP_COUNT),flags(0),ma(NULL),ctx(NULL) {}
 	AggAcc(ExprOp o,uint16_t f,const EvalCtx *ct,Histogram *h,MemAlloc *m=NULL) : count(0),sum2(0.),hist(h),op(o),flags(f),ma(m!=NULL?m:ct->ma),ctx(ct) {}
 	RC			next(const Value& v);
+	RC			next(const Value& v,uint64_t n);
 	RC			process(const Value& v);
 	RC			result(Value& res,bool fRestore=false);
 	void		reset() {count=0; sum.setEmpty(); sum2=0.; if (hist!=NULL) hist->clear();}
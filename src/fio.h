@@ -148,6 +148,7 @@ public:
 	off64_t	getFileSize(FileID fid);
 	size_t	getFileName(FileID fid,char buf[],size_t lbuf) const;
 	RC		growFile(FileID file, off64_t newsize);
+	RC		punchHole(FileID file,off64_t offset,off64_t len);
 	static RC deleteFile(const char *fname);
 	static void	deleteLogFiles(unsigned maxFile,const char *lDir,bool fArchived=true);
 	RC		loadExt(const char *fname,size_t l,class Session *ses,const Value *pars,unsigned nPars,bool fNew);
@@ -149,6 +149,18 @@ RC GFileMgr::growFile(FileID file, off64_t newSize)
 	return rc;
 }
 
+RC GFileMgr::punchHole(FileID file,off64_t offset,off64_t len)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	lock.lock(RW_S_LOCK);
+	if (file>=xSlotTab || !slotTab[file].isOpen()) {lock.unlock(); return RC_NOTFOUND;}
+	HANDLE h=slotTab[file].osFile; lock.unlock();
+	return fallocate64(h,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,offset,len)!=0?convCode(errno):RC_OK;
+#else
+	return RC_INVOP;
+#endif
+}
+
 #ifdef ANDROID
 namespace AfyKernel
 {
@@ -346,6 +346,18 @@ RC GFileMgr::growFile(FileID file, off64_t newSize)
 	return rc;
 }
 
+RC GFileMgr::punchHole(FileID file,off64_t offset,off64_t len)
+{
+#ifdef F_PUNCHHOLE
+	lock.lock(RW_S_LOCK);
+	if (file>=xSlotTab || !slotTab[file].isOpen()) {lock.unlock(); return RC_NOTFOUND;}
+	HANDLE h=slotTab[file].osFile; lock.unlock();
+	struct fpunchhole ph={0,0,offset,len}; return fcntl(h,F_PUNCHHOLE,&ph)!=0?convCode(errno):RC_OK;
+#else
+	return RC_INVOP;
+#endif
+}
+
 
 RC FileMgr::listIO(int mode,int nent,myaio* const* pcbs,bool fSync)
 {
@@ -149,6 +149,11 @@ RC GFileMgr::growFile(FileID file, off64_t newSize)
 	return rc;
 }
 
+RC GFileMgr::punchHole(FileID,off64_t,off64_t)
+{
+	return RC_INVOP;		// requires sparse files
+}
+
 RC FileMgr::listIO(int mode,int nent,myaio* const* pcbs,bool fSync)
 {
 	RC rc=RC_OK; int i,i0=0,i1=0; AsyncWait aw;
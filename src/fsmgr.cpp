@@ -513,8 +513,23 @@ PGID ExtentDirPage::getPGID() const
 
 //-------------------------------------------------------------------------------------------------
 
-RC FreeSpacePage::update(PBlock*,size_t len,unsigned info,const byte *rec,size_t lrec,unsigned flags,PBlock*)
+void FreeSpacePage::initPage(byte *page,size_t lPage,PageID pid)
 {
+	TxPage::initPage(page,lPage,pid);
+	FreeSpaceHeader *fh=(FreeSpaceHeader*)page; fh->next=INVALID_PAGEID; fh->nEntries=0;
+}
+
+RC FreeSpacePage::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_t lrec,unsigned flags,PBlock*)
+{
+	FreeSpaceHeader *fh=(FreeSpaceHeader*)pb->getPageBuf(); const FreeSpaceImage *fi=(const FreeSpaceImage*)rec;
+	switch (info) {
+	default: return RC_CORRUPTED;
+	case FSU_IMAGE:
+		if (rec==NULL || lrec<sizeof(FreeSpaceImage) || lrec!=sizeof(FreeSpaceImage)+fi->nEntries*sizeof(PartialInfo) || lrec-sizeof(FreeSpaceImage)>contentSize(len)) return RC_CORRUPTED;
+		if ((flags&TXMGR_UNDO)!=0) fh->nEntries=0;		// the map is only a hint, old content is not restored
+		else {fh->next=fi->next; fh->nEntries=fi->nEntries; memcpy((PartialInfo*)(fh+1),fi+1,fi->nEntries*sizeof(PartialInfo));}
+		break;
+	}
 	return RC_OK;
 }
 
@@ -522,3 +537,59 @@ PGID FreeSpacePage::getPGID() const
 {
 	return PGID_FSPACE;
 }
+
+RC FSMgr::saveFreeSpace(const PartialInfo *pis,unsigned nPis)
+{
+	Session *ses=Session::getSession(); if (ses==NULL) return RC_NOSESSION; if (ctx->memory!=NULL) return RC_OK;
+	const unsigned xEntries=unsigned(FreeSpacePage::contentSize(ctx->bufMgr->getPageSize())/sizeof(PartialInfo));
+	unsigned nPages=nPis==0?1:(nPis+xEntries-1)/xEntries,nOld=0; PageID *pages=NULL; PBlockP pb; RC rc=RC_OK;
+	MiniTx mtx(ses);
+	for (PageID pid=ctx->theCB->getRoot(MA_FREESPACE); pid!=INVALID_PAGEID; pid=((const FreeSpacePage::FreeSpaceHeader*)pb->getPageBuf())->next) {
+		if (nOld>=MAXFREESPACEPAGES) {rc=RC_CORRUPTED; break;}
+		if ((nOld&15)==0 && (pages=(PageID*)ses->realloc(pages,(nOld+16)*sizeof(PageID)))==NULL) return RC_NOMEM;
+		if (pb.getPage(pid,&freeSpacePage,PGCTL_XLOCK,ses)==NULL) {rc=RC_CORRUPTED; break;}
+		pages[nOld++]=pid;
+	}
+	pb.release(ses);
+	if (rc==RC_OK && nPages>nOld) {
+		if ((pages=(PageID*)ses->realloc(pages,nPages*sizeof(PageID)))==NULL) rc=RC_NOMEM;
+		else rc=allocPages(nPages-nOld,pages+nOld);
+	}
+	if (rc==RC_OK) {
+		// old pages left after the last filled one stay in the chain with no entries
+		FreeSpacePage::FreeSpaceImage *fi=(FreeSpacePage::FreeSpaceImage*)ses->malloc(sizeof(FreeSpacePage::FreeSpaceImage)+xEntries*sizeof(PartialInfo));
+		if (fi==NULL) rc=RC_NOMEM;
+		else {
+			for (unsigned i=0,n=max(nPages,nOld); rc==RC_OK && i<n; i++) {
+				fi->next=i+1<n?pages[i+1]:INVALID_PAGEID; fi->nEntries=i*xEntries<nPis?min(nPis-i*xEntries,xEntries):0;
+				if (fi->nEntries!=0) memcpy(fi+1,pis+i*xEntries,fi->nEntries*sizeof(PartialInfo));
+				if ((i<nOld?pb.getPage(pages[i],&freeSpacePage,PGCTL_XLOCK,ses):pb.newPage(pages[i],&freeSpacePage,0,ses))==NULL) rc=RC_NOMEM;
+				else rc=ctx->txMgr->update(pb,&freeSpacePage,FSU_IMAGE,(byte*)fi,sizeof(FreeSpacePage::FreeSpaceImage)+fi->nEntries*sizeof(PartialInfo));
+			}
+			pb.release(ses); ses->free(fi);
+		}
+		if (rc==RC_OK && nOld==0) {
+			MapAnchorUpdate anchorUpdate; anchorUpdate.oldPageID=INVALID_PAGEID; anchorUpdate.newPageID=pages[0];
+			ctx->cbLSN=ctx->logMgr->insert(ses,LR_UPDATE,MA_FREESPACE<<PGID_SHIFT|PGID_MASTER,INVALID_PAGEID,NULL,&anchorUpdate,sizeof(MapAnchorUpdate));
+			rc=ctx->theCB->update(ctx,MA_FREESPACE,(byte*)&anchorUpdate,sizeof(MapAnchorUpdate));
+		}
+	}
+	if (rc==RC_OK) mtx.ok();
+	if (pages!=NULL) ses->free(pages);
+	return rc;
+}
+
+RC FSMgr::loadFreeSpace(PartialInfo *&pis,unsigned& nPis,MemAlloc *ma)
+{
+	pis=NULL; nPis=0; PBlockP pb; unsigned nPages=0;
+	for (PageID pid=ctx->theCB->getRoot(MA_FREESPACE); pid!=INVALID_PAGEID; pid=((const FreeSpacePage::FreeSpaceHeader*)pb->getPageBuf())->next) {
+		if (++nPages>MAXFREESPACEPAGES || pb.getPage(pid,&freeSpacePage,0)==NULL) return RC_CORRUPTED;
+		const FreeSpacePage::FreeSpaceHeader *fh=(const FreeSpacePage::FreeSpaceHeader*)pb->getPageBuf();
+		if (fh->nEntries*sizeof(PartialInfo)>FreeSpacePage::contentSize(ctx->bufMgr->getPageSize())) return RC_CORRUPTED;
+		if (fh->nEntries!=0) {
+			if ((pis=(PartialInfo*)ma->realloc(pis,(nPis+fh->nEntries)*sizeof(PartialInfo)))==NULL) {nPis=0; return RC_NOMEM;}
+			memcpy(pis+nPis,fh+1,fh->nEntries*sizeof(PartialInfo)); nPis+=fh->nEntries;
+		}
+	}
+	return RC_OK;
+}
@@ -37,6 +37,7 @@ namespace AfyKernel
 #define	MAXBITNUMBER	0x0007FFFF
 #define	RESETBIT		0x00080000
 #define	FREEPAGEFLAG	0x80000000
+#define	MAXFREESPACEPAGES	256		/**< sanity limit for the length of the persistent free space map chain */
 
 /**
  * extent directory page descritptor
@@ -80,21 +81,29 @@ class ExtentMapPage : public TxPage
 	static	size_t	contentSize(size_t lPage) {return lPage - sizeof(ExtentMapHeader) - FOOTERSIZE;}
 };
 
+enum {FSU_IMAGE};
+
 /**
- * in-memory descriptor of free space in heap pages
+ * persistent map of free space in heap pages
+ * chain of pages anchored in MA_FREESPACE, rewritten on shutdown, used as a hint on startup
  */
 class FreeSpacePage : public TxPage
 {
 	friend	class	FSMgr;
-	struct PageInfo {
-		uint16_t	pgid;
-		uint16_t	left;
-		uint32_t	pageID;
+	struct FreeSpaceHeader {
+		TxPageHeader	hdr;
+		PageID			next;
+		uint32_t		nEntries;
+	};
+	struct FreeSpaceImage {
+		PageID			next;
+		uint32_t		nEntries;
 	};
 	FreeSpacePage(StoreCtx *ctx) : TxPage(ctx) {}
+	void	initPage(byte *page,size_t lPage,PageID pid);
 	RC		update(class PBlock *,size_t len,unsigned info,const byte *rec,size_t lrec,unsigned flags,class PBlock *newp=NULL);
 	PGID	getPGID() const;
-	static	size_t	contentSize(size_t lPage) {return lPage - sizeof(TxPageHeader) - FOOTERSIZE;}
+	static	size_t	contentSize(size_t lPage) {return lPage - sizeof(FreeSpaceHeader) - FOOTERSIZE;}
 };
 
 class PBlock;
@@ -149,6 +158,8 @@ public:
 	RC			freePage(PageID pid);
 	RC			freeTxPages(const PageSet& ps);
 	void		txUnlock() {txLock.unlock();}
+	RC			saveFreeSpace(const struct PartialInfo *pis,unsigned nPis);
+	RC			loadFreeSpace(struct PartialInfo *&pis,unsigned& nPis,MemAlloc *ma);
 
 private:
 	RC			allocNewExtent(ExtentInfo*&ext,PBlock*&pb,bool fForce=false);
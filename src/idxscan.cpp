@@ -130,6 +130,23 @@ private:
 		if (!key->isSet() || findPage(key)!=RC_OK) {index=0; state&=~SC_KEYSET; return false;}
 		return ((const TreePageMgr::TreePage*)pb->getPageBuf())->findKey(*key,index);
 	}
+	/** Z-order key outside of the query box: re-descend to the next Z-code inside the box (BIGMIN) instead of stepping through all keys in between */
+	RC seekZ() {
+		const byte *zk=savedKey->getPtr2(),*zs=start->getPtr2(),*ze=finish->getPtr2(); const ushort lz=zk[1];
+		if (savedKey->v.ptr.l<lz+2 || start->v.ptr.l<lz+2 || finish->v.ptr.l<lz+2 || zs[1]!=lz || ze[1]!=lz || lz>ZORDER_MAX_DIMS*sizeof(uint64_t)) return RC_FALSE;
+		byte zbuf[2+ZORDER_MAX_DIMS*sizeof(uint64_t)]; IndexKeyV kv; kv.ptr.p=zbuf; kv.ptr.l=lz+2; SearchKey key(kv,KT_VAR,SearchKey::PLC_SPTR);
+		if (!zBigMin(zk+2,zs+2,ze+2,lz,nSegs,zbuf+2)) {pb.release(ses); state=state&~SC_KEYSET|SC_EOF; return RC_EOF;}
+		if (memcmp(zbuf+2,zk+2,lz)<=0) return RC_FALSE; zbuf[0]=zk[0]; zbuf[1]=zk[1];
+		pb.release(ses); parent.release(ses); depth=0; savedKey->reset(); const TreePageMgr::TreePage *tp;
+		if (findPage(&key)!=RC_OK) {state=state&~SC_KEYSET|SC_EOF; return RC_EOF;}
+		for (tp=(const TreePageMgr::TreePage*)pb->getPageBuf(); !tp->findKey(key,index) && index>=tp->info.nSearchKeys; ) {
+			if (!tp->hasSibling() || !checkBounds(tp,true,true)) {pb.release(ses); state=state&~SC_KEYSET|SC_EOF; return RC_EOF;}
+			if (pb.getPage(tp->info.sibling,ctx->trpgMgr,PGCTL_COUPLE|QMGR_SCAN,ses)==NULL) {state=state&~SC_KEYSET|SC_EOF; return RC_EOF;}
+			tp=(const TreePageMgr::TreePage*)pb->getPageBuf(); if (tp->info.nSearchKeys>0) {index=0; break;}
+		}
+		if (!checkBounds(tp,true)) {pb.release(ses); state=state&~SC_KEYSET|SC_EOF; return RC_EOF;}
+		return RC_OK;
+	}
 public:
 	TreeScanImpl(Session *se,Tree& tr,const SearchKey *st,const SearchKey *fi,unsigned flgs,const IndexSeg *sg,unsigned nS,IKeyCallback *kcb)
 		: TreeCtx(tr),LatchHolder(se),ses(se),ctx(ses->getStore()),state(flgs|SC_INIT),start(st),finish(fi),segs(sg),nSegs(nS),keycb(kcb),fHyper(false),
@@ -224,6 +241,7 @@ public:
 				}
 			}	
 			index=0; state=state&~(SC_INIT|SC_LASTKEY|SC_KEYSET)|(skip==NULL?SC_EOF|SC_BOF:fF?SC_EOF:SC_BOF); savedKey->reset();
+			if ((state&(SCAN_EXACT|SCAN_PREFIX))==SCAN_EXACT && skip==NULL && !tree->mayContain(*start)) return RC_EOF;
 			if (fF) {
 				const SearchKey *key=skip!=NULL?skip:start; if (findPage(key)!=RC_OK) return RC_EOF;
 				const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)pb->getPageBuf(); //assert(key==NULL||tp->cmpKey(*key)==0);
@@ -286,7 +304,11 @@ retkey:
 				skip=NULL; saveKey(); if (savedKey==NULL) return RC_NOMEM;
 				if (start!=NULL && !checkHyperRect(start->getPtr2(),start->v.ptr.l,savedKey->getPtr2(),savedKey->v.ptr.l,segs,nSegs,true) ||
 					finish!=NULL && !checkHyperRect(savedKey->getPtr2(),savedKey->v.ptr.l,finish->getPtr2(),finish->v.ptr.l,segs,nSegs,false))
-						{op=fF?GO_NEXT:GO_PREVIOUS; continue;}
+				{
+					RC rc; op=fF?GO_NEXT:GO_PREVIOUS;
+					if (fF && (segs->flags&SEG_ZORDER)!=0 && start!=NULL && finish!=NULL && (rc=seekZ())!=RC_FALSE) {if (rc==RC_OK) goto retkey; return rc;}
+					continue;
+				}
 				// exclude boundaries, skip to next
 			}
 			if (keycb!=NULL) keycb->newKey(); return RC_OK;
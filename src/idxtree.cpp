@@ -63,48 +63,83 @@ public:
 	void		process() {
 		if (tcon!=NULL && (tree=tcon->connect(thndl))==NULL || tree!=NULL && (tree->mode&TF_NOPOST)!=0) return;
 		if (op!=Tree::TO_DELETE) {ctx->trpgMgr->addNewPage(*this,key,child); return;}
-		assert((tree->mode&TF_WITHDEL)!=0); PBlock *pbl; unsigned pos;
-		if (getParentPage(key,PTX_FORUPDATE|PTX_FORDELETE)!=RC_OK) return;
-		TreePageMgr::TreePage *tp=(TreePageMgr::TreePage*)pb->getPageBuf();
-		if (tp->isLeaf()) {
-			assert(!tp->info.fmt.isFixedLenData() || tp->info.fmt.isKeyOnly());
-			// find SubTree based on key
-			// removeRootPage
-			return;
-		}
-		if (tp->info.level==1 && tp->info.stamp!=stamps[PITREE_1STLEV]) return;	//????
-		if (tp->info.nSearchKeys==0 || !tp->findKey(key,pos) || tp->getPageID(pos)!=child) return;
-		PageID lpid=tp->getPageID(pos-1); assert(lpid!=INVALID_PAGEID);
-		if (pb->isULocked()) pb->upgradeLock();
-		if ((pbl=ctx->bufMgr->getPage(lpid,ctx->trpgMgr,PGCTL_XLOCK))==NULL) return;
-		const TreePageMgr::TreePage *ltp=(const TreePageMgr::TreePage*)pbl->getPageBuf();
-		if (ltp->info.sibling==child) {
-			PBlock *pbr=ctx->bufMgr->getPage(child,ctx->trpgMgr,PGCTL_XLOCK);
-			if (pbr!=NULL) {
-				RC rc=ctx->trpgMgr->merge(pbl,pbr,pb,*tree,key,pos);
-				if (rc==RC_OK) {
-					if (tp->info.nSearchKeys==0) {
-						// post
-						if (tp->info.leftMost!=INVALID_PAGEID) {
-						} else {
-						}
-					}
-				} else if (rc!=RC_FALSE)
-					report(MSG_ERROR,"TreeRQ: cannot merge pages %08X %08X, parent %08X (%d)\n",lpid,child,pb->getPageID(),rc);
-			}
-		}
-		pbl->release();
+		assert((tree->mode&TF_WITHDEL)!=0); mergePages(key,child);
 	}
 	void		destroy() {StoreCtx *ct=ctx; this->~TreeRQ(); ct->free(this);}
 	static	RC	post(const TreeCtx& tctx,Tree::TreeOp op,PageID pid,const SearchKey *key,PBlock *pb=NULL,ushort idx=0);
 };
 
+class DefragRQ : public Request
+{
+	StoreCtx		*const	ctx;
+	TreeConnect		*const	tcon;
+	const	uint32_t		thndl;
+	DefragRQ(StoreCtx *ct,TreeConnect *tc,uint32_t h) : ctx(ct),tcon(tc),thndl(h) {}
+public:
+	void		process() {
+		Tree *tree=tcon->connect(thndl); if (tree==NULL) return; DefragReport rep;
+		RC rc=(tree->mode&TF_NOPOST)==0?tree->defragment(rep):RC_OK;
+		if (rc!=RC_OK) report(MSG_WARNING,"Cannot defragment index %u (%d)\n",thndl,rc);
+		else if ((tree->mode&TF_NOPOST)==0 && rep.nFreed!=0)
+			report(MSG_INFO,"Index %u defragmented: %u of %u leaf pages reclaimed, depth %u -> %u\n",thndl,rep.nFreed,rep.nLeaves,rep.depth,rep.newDepth);
+		tree->fDefragRQ=0; tree->destroy();
+	}
+	void		destroy() {StoreCtx *ct=ctx; this->~DefragRQ(); ct->free(this);}
+	static	void	post(Tree& tree) {
+		StoreCtx *ctx=tree.getStoreCtx(); uint32_t h; TreeConnect *tc=tree.persist(h); void *p; DefragRQ *rq;
+		if (tc==NULL || (ctx->mode&STARTUP_RT)!=0 || (p=ctx->malloc(sizeof(DefragRQ)))==NULL) tree.fDefragRQ=0;
+		else if (!RequestQueue::postRequest(rq=new(p) DefragRQ(ctx,tc,h),ctx)) {rq->destroy(); tree.fDefragRQ=0;}
+	}
+};
+
 class TreeRQTable : public SyncHashTab<TreeRQ,PageID,&TreeRQ::list>
 {
 public:
 	TreeRQTable(unsigned hashSize,MemAlloc *ma) : SyncHashTab<TreeRQ,PageID,&TreeRQ::list>(hashSize,ma) {}
 };
 
+class KeyFilterRQ : public Request
+{
+	StoreCtx		*const	ctx;
+	TreeConnect		*const	tcon;
+	const	uint32_t		thndl;
+	KeyFilterRQ(StoreCtx *ct,TreeConnect *tc,uint32_t h) : ctx(ct),tcon(tc),thndl(h) {}
+public:
+	void		process() {
+		Tree *tree=tcon->connect(thndl); if (tree==NULL) return;
+		RC rc=(tree->mode&TF_NOPOST)==0?tree->buildFilter():RC_OK;
+		if (rc!=RC_OK) report(MSG_WARNING,"Cannot build key filter for index %u (%d)\n",thndl,rc);
+		tree->nFilterProbes=0; tree->destroy();
+	}
+	void		destroy() {StoreCtx *ct=ctx; this->~KeyFilterRQ(); ct->free(this);}
+	static	void	post(Tree& tree) {
+		StoreCtx *ctx=tree.getStoreCtx(); uint32_t h; TreeConnect *tc=tree.persist(h); void *p; KeyFilterRQ *rq;
+		if (tc==NULL || (ctx->mode&STARTUP_RT)!=0 || (p=ctx->malloc(sizeof(KeyFilterRQ)))==NULL) tree.nFilterProbes=0;
+		else if (!RequestQueue::postRequest(rq=new(p) KeyFilterRQ(ctx,tc,h),ctx)) {rq->destroy(); tree.nFilterProbes=0;}
+	}
+};
+
+class KeyStatsRQ : public Request
+{
+	StoreCtx		*const	ctx;
+	TreeConnect		*const	tcon;
+	const	uint32_t		thndl;
+	KeyStatsRQ(StoreCtx *ct,TreeConnect *tc,uint32_t h) : ctx(ct),tcon(tc),thndl(h) {}
+public:
+	void		process() {
+		Tree *tree=tcon->connect(thndl); if (tree==NULL) return;
+		RC rc=(tree->mode&TF_NOPOST)==0?tree->collectStats():RC_OK;
+		if (rc!=RC_OK) report(MSG_WARNING,"Cannot collect statistics for index %u (%d)\n",thndl,rc);
+		tree->fStatsRQ=0; tree->destroy();
+	}
+	void		destroy() {StoreCtx *ct=ctx; this->~KeyStatsRQ(); ct->free(this);}
+	static	void	post(Tree& tree) {
+		StoreCtx *ctx=tree.getStoreCtx(); uint32_t h; TreeConnect *tc=tree.persist(h); void *p; KeyStatsRQ *rq;
+		if (tc==NULL || (ctx->mode&STARTUP_RT)!=0 || (p=ctx->malloc(sizeof(KeyStatsRQ)))==NULL) tree.fStatsRQ=0;
+		else if (!RequestQueue::postRequest(rq=new(p) KeyStatsRQ(ctx,tc,h),ctx)) {rq->destroy(); tree.fStatsRQ=0;}
+	}
+};
+
 };
 
 TreeMgr::TreeMgr(StoreCtx *ct,unsigned timeout) : ctx(ct)
@@ -116,7 +151,9 @@ TreeMgr::TreeMgr(StoreCtx *ct,unsigned timeout) : ctx(ct)
 TreeMgr::~TreeMgr()
 {
 	if (traverse!=0 && (ctx->mode&STARTUP_PRINT_STATS)!=0)
-		report(MSG_INFO,"\tIndex access stats: %d/%d/%g/%d\n",(long)sideLink,(long)pageRead,double(pageRead)/double(traverse),(long)sibRead);
+		report(MSG_INFO,"\tIndex access stats: %d/%d/%g/%d/%d\n",(long)sideLink,(long)pageRead,double(pageRead)/double(traverse),(long)sibRead,(long)optRetry);
+	if (filterNeg!=0 && (ctx->mode&STARTUP_PRINT_STATS)!=0)
+		report(MSG_INFO,"\tIndex key filter: %d lookups without leaf access\n",(long)filterNeg);
 	//delete ptrt;
 }
 
@@ -214,6 +251,41 @@ RC TreeCtx::getParentPage(const SearchKey &key,unsigned flags)
 	return pb.isNull()?RC_NOTFOUND:RC_OK;
 }
 
+RC TreeCtx::mergePages(const SearchKey& key,PageID child)
+{
+	StoreCtx *ctx=tree->getStoreCtx(); PBlock *pbl; unsigned pos; RC rc;
+	if ((rc=getParentPage(key,PTX_FORUPDATE|PTX_FORDELETE))!=RC_OK) return rc;
+	TreePageMgr::TreePage *tp=(TreePageMgr::TreePage*)pb->getPageBuf();
+	if (tp->isLeaf()) {
+		assert(!tp->info.fmt.isFixedLenData() || tp->info.fmt.isKeyOnly());
+		// find SubTree based on key
+		// removeRootPage
+		return RC_FALSE;
+	}
+	if (tp->info.level==1 && tp->info.stamp!=stamps[PITREE_1STLEV]) return RC_FALSE;	//????
+	if (tp->info.nSearchKeys==0 || !tp->findKey(key,pos) || tp->getPageID(pos)!=child) return RC_FALSE;
+	PageID lpid=tp->getPageID(pos-1); assert(lpid!=INVALID_PAGEID);
+	if (pb->isULocked()) pb->upgradeLock();
+	if ((pbl=ctx->bufMgr->getPage(lpid,ctx->trpgMgr,PGCTL_XLOCK))==NULL) return RC_FALSE;
+	const TreePageMgr::TreePage *ltp=(const TreePageMgr::TreePage*)pbl->getPageBuf(); rc=RC_FALSE;
+	if (ltp->info.sibling==child) {
+		PBlock *pbr=ctx->bufMgr->getPage(child,ctx->trpgMgr,PGCTL_XLOCK);
+		if (pbr!=NULL) {
+			rc=ctx->trpgMgr->merge(pbl,pbr,pb,*tree,key,pos);
+			if (rc==RC_OK) {
+				if (tp->info.nSearchKeys==0) {
+					// post
+					if (tp->info.leftMost!=INVALID_PAGEID) {
+					} else {
+					}
+				}
+			} else if (rc!=RC_FALSE)
+				report(MSG_ERROR,"TreeRQ: cannot merge pages %08X %08X, parent %08X (%d)\n",lpid,child,pb->getPageID(),rc);
+		}
+	}
+	pbl->release(); return rc;
+}
+
 RC TreeCtx::getPreviousPage(bool fRead)
 {
 	const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage *)pb->getPageBuf();
@@ -240,12 +312,54 @@ RC TreeCtx::getPreviousPage(bool fRead)
 	return RC_NOTFOUND;
 }
 
+bool TreeCtx::optDescent(const SearchKey& key,PageID& pid,int& level,unsigned flags)
+{
+	// internal pages are pinned but not latched; a page is valid if it was not X-locked and its version didn't change while it was read
+	StoreCtx *ctx=tree->getStoreCtx(); BufMgr *bm=ctx->bufMgr; const PageID start=pid; const int startLevel=level; const unsigned startDepth=depth;
+	const size_t lPage=bm->getPageSize(); PBlock *cur=bm->pinPage(pid,ctx->trpgMgr); if (cur==NULL) return false;
+	for (unsigned nRetries=0;;) {
+		const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)cur->getPageBuf();
+		const uint16_t vers=tp->getVers(); MemoryBarrier();
+		if (!cur->isXLocked()) {
+			unsigned lvl; const unsigned stamp=tp->info.stamp; const PageID child=tp->getChildOpt(key,lPage,lvl);
+			MemoryBarrier();
+			if (!cur->isXLocked() && tp->getVers()==vers) {
+				// leaf, empty page, sibling link or a page format not searched optimistically - the rest is done by latched descent which also posts tree repair requests
+				++ctx->treeMgr->pageRead; if (child==INVALID_PAGEID || depth>=TREE_MAX_DEPTH) break;
+				if (lvl==1) {
+					// latch the leaf, then check that its parent wasn't modified in between
+					if (pb.getPage(child,ctx->trpgMgr,flags)!=NULL) {
+						MemoryBarrier();
+						if (!cur->isXLocked() && tp->getVers()==vers)
+							{stack[depth++]=pid; stamps[PITREE_1STLEV]=stamp; bm->unpinPage(cur); pid=child; level=0; return true;}
+						pb.release();
+					}
+				} else {
+					PBlock *next=bm->pinPage(child,ctx->trpgMgr); MemoryBarrier();
+					if (!cur->isXLocked() && tp->getVers()==vers) {
+						stack[depth++]=pid; pid=child; level=int(lvl)-1; bm->unpinPage(cur);
+						if ((cur=next)!=NULL) {nRetries=0; continue;}
+						if ((tree->mode&TF_WITHDEL)==0) return false;
+						break;
+					}
+					if (next!=NULL) bm->unpinPage(next);
+				}
+			}
+		}
+		++ctx->treeMgr->optRetry; if (++nRetries>=OPT_READ_RETRIES) break;
+	}
+	if (cur!=NULL) bm->unpinPage(cur);
+	// pages of trees with deletion can be freed when not latched - restart from the top
+	if ((tree->mode&TF_WITHDEL)!=0) {pid=start; level=startLevel; depth=startDepth;}
+	return false;
+}
+
 RC TreeCtx::findPage(const SearchKey *key)
 {
 	StoreCtx *ctx=tree->getStoreCtx(); getStamps(stamps);
 	int level=-1; PageID pid=startPage(key,level); parent.moveTo(pb);
 	unsigned xlock=(tree->mode&TF_WITHDEL)!=0?PGCTL_COUPLE:0,kpos=~0u; ++ctx->treeMgr->traverse;
-	if (pid!=INVALID_PAGEID) while (pb.getPage(pid,ctx->trpgMgr,xlock)!=NULL) {
+	if (pid!=INVALID_PAGEID) for (bool fOpt=key!=NULL && mainKey==NULL && optDescent(*key,pid,level,xlock); fOpt || pb.getPage(pid,ctx->trpgMgr,xlock)!=NULL; fOpt=false) {
 		const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)pb->getPageBuf();
 		++ctx->treeMgr->pageRead; if (tp->info.level>TREE_MAX_DEPTH) break;
 		if (tp->info.nSearchKeys==0 && depth>0 && key!=NULL)
@@ -267,8 +381,9 @@ RC TreeCtx::findPage(const SearchKey *key)
 RC TreeCtx::findPageForUpdate(const SearchKey *key,bool fIns)
 {
 	StoreCtx *ctx=tree->getStoreCtx(); ++ctx->treeMgr->traverse; getStamps(stamps); assert(key!=NULL);
-	int level=-1; PageID pid=startPage(key,level,false); unsigned xlock=level==0||level==1?PGCTL_ULOCK:0; unsigned kpos=~0u;
-	while (pid!=INVALID_PAGEID && pb.getPage(pid,ctx->trpgMgr,xlock)!=NULL) {
+	int level=-1; PageID pid=startPage(key,level,false); bool fOpt=pid!=INVALID_PAGEID && mainKey==NULL && optDescent(*key,pid,level,PGCTL_ULOCK);
+	unsigned xlock=level==0||level==1?PGCTL_ULOCK:0; unsigned kpos=~0u;
+	for (; pid!=INVALID_PAGEID && (fOpt || pb.getPage(pid,ctx->trpgMgr,xlock)!=NULL); fOpt=false) {
 		++ctx->treeMgr->pageRead; xlock&=~PGCTL_COUPLE;
 		const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)pb->getPageBuf();
 		if (tp->info.level>TREE_MAX_DEPTH) break;
@@ -365,7 +480,7 @@ unsigned Tree::checkTree(StoreCtx *ctx,PageID root,CheckTreeReport& res,CheckTre
 
 RC Tree::find(const SearchKey& key,void *buf,size_t &size)
 {
-	RC rc; TreeCtx tctx(*this); ushort lData;
+	RC rc; TreeCtx tctx(*this); ushort lData; if (!mayContain(key)) return RC_NOTFOUND;
 	if ((rc=tctx.findPage(&key))==RC_OK) {
 		const void *p=((const TreePageMgr::TreePage*)tctx.pb->getPageBuf())->getValue(key,lData);
 		if (p!=NULL) {if (size+lData>0 && buf!=NULL) memcpy(buf,p,min(ushort(size),lData)); size=lData;} else rc=RC_NOTFOUND;
@@ -373,6 +488,158 @@ RC Tree::find(const SearchKey& key,void *buf,size_t &size)
 	return rc;
 }
 
+bool Tree::mayContain(const SearchKey& key)
+{
+	KeyFilter *kf=filter;
+	if (kf!=NULL && kf->isReady()) {
+		if (!kf->test(key)) {++ctx->treeMgr->filterNeg; return false;}
+		if (!kf->isFull() || (kf->mask+1ULL)*2>KEYFILTER_MAX_BITS) return true;
+	} else if (kf!=NULL && kf->state==KFS_BUILDING || (mode&TF_KEYFILTER)==0 || !KeyFilter::isSupported(indexFormat().keyType())) return true;
+	if (InterlockedIncrement(&nFilterProbes)==KEYFILTER_PROBES) KeyFilterRQ::post(*this);
+	return true;
+}
+
+RC Tree::buildFilter()
+{
+	Session *ses=Session::getSession(); if (ses==NULL) return RC_NOSESSION;
+	KeyFilter *old=filter,*kf=KeyFilter::create(ctx,old!=NULL?old->getNKeys()*2:0,old); if (kf==NULL) return RC_NOMEM;
+	filter=kf; MemoryBarrier();		// from now on every leaf insert adds its key to kf under the leaf page latch
+	TreeScan *ts=scan(ses,NULL); if (ts==NULL) {kf->invalidate(); return RC_NOMEM;}
+	RC rc; while ((rc=ts->nextKey())==RC_OK) kf->add(ts->getKey());
+	ts->destroy(); if (rc!=RC_EOF) {kf->invalidate(); return rc;}
+	cas(&kf->state,(long)KFS_BUILDING,(long)KFS_READY); return RC_OK;
+}
+
+KeyFilter *KeyFilter::create(StoreCtx *ctx,unsigned nKeys,KeyFilter *prev)
+{
+	uint64_t nBits=uint64_t(max(nKeys,(unsigned)KEYFILTER_MIN_KEYS))*KEYFILTER_BITS_PER_KEY; unsigned msk=sizeof(long)*8-1;
+	while (msk<nBits-1 && msk<KEYFILTER_MAX_BITS-1) msk=msk<<1|1;
+	size_t lbits=(msk+1ULL)/8; void *p=ctx->malloc(sizeof(KeyFilter)-sizeof(long)+lbits); if (p==NULL) return NULL;
+	KeyFilter *kf=new(p) KeyFilter(prev,msk); memset((void*)kf->bits,0,lbits); return kf;
+}
+
+void KeyFilter::free(StoreCtx *ctx,KeyFilter *kf)
+{
+	for (KeyFilter *prev; kf!=NULL; kf=prev) {prev=kf->prev; ctx->free(kf);}
+}
+
+const KeyStats *Tree::getStats()
+{
+	KeyStats *ks=stats; if ((mode&TF_KEYSTATS)==0) return NULL;
+	if ((ks==NULL || uint64_t(nStatMods)>max(ks->nValues/KEYSTATS_STALE,(uint64_t)KEYSTATS_MIN_MODS)) && cas(&fStatsRQ,0L,1L)) KeyStatsRQ::post(*this);
+	return ks;
+}
+
+RC Tree::collectStats()
+{
+	Session *ses=Session::getSession(); if (ses==NULL) return RC_NOSESSION;
+	void *p=ctx->malloc(sizeof(KeyStats)); if (p==NULL) return RC_NOMEM;
+	KeyStats *ks=new(p) KeyStats(stats); uint64_t nValues=0,nKeys=0,cnt=0; size_t l; RC rc; nStatMods=0;
+	TreeScan *ts=scan(ses,NULL); if (ts==NULL) {ctx->free(ks); return RC_NOMEM;}
+	while ((rc=ts->nextKey())==RC_OK) {nKeys++; while (ts->nextValue(l)!=NULL) nValues++;}
+	if (rc==RC_EOF && nValues!=0 && (rc=ts->rewind())==RC_OK) {
+		ks->nValues=nValues; ks->nKeys=nKeys;
+		while ((rc=ts->nextKey())==RC_OK) {
+			const SearchKey& key=ts->getKey(); uint64_t n=0; while (ts->nextValue(l)!=NULL) n++;
+			while (rc==RC_OK && ks->nBounds<KEYSTATS_BUCKETS && cnt+n>nValues*ks->nBounds/KEYSTATS_BUCKETS) rc=ks->addBound(ctx,key);
+			if (rc!=RC_OK) break; if ((cnt+=n)>=nValues) {rc=ks->addBound(ctx,key); break;}
+		}
+	}
+	ts->destroy(); if (rc==RC_EOF) rc=RC_OK;
+	if (rc!=RC_OK) {for (unsigned i=0; i<ks->nBounds; i++) ks->bounds[i].free(ctx); ctx->free(ks); return rc;}
+	stats=ks; return RC_OK;
+}
+
+RC Tree::defragment(DefragReport& rep,unsigned budget)
+{
+	const size_t xSize=ctx->trpgMgr->contentSize(),lmax=xSize*DEFRAG_FILL/100;
+	SearchKey *key=(SearchKey*)ctx->malloc(sizeof(SearchKey)+xSize); if (key==NULL) return RC_NOMEM;
+	unsigned nIO=0; bool fStart=true,fEnd=false; RC rc=RC_OK; memset(&rep,0,sizeof(DefragReport)); nDelMods=0;
+	while (!fEnd && (mode&TF_NOPOST)==0) {
+		// the walk is restarted from a key after every merge and pause: no latches are held and the pages can change in between
+		TreeCtx tctx(*this); if ((rc=tctx.findPage(fStart?(SearchKey*)0:key))!=RC_OK) {if (rc==RC_NOTFOUND) rc=RC_OK; break;}
+		if (fStart) {rep.depth=tctx.depth+1; fStart=false;} rep.newDepth=tctx.depth+1; nIO+=tctx.depth+1;
+		for (;;) {
+			const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)tctx.pb->getPageBuf(); const PageID rpid=tp->info.sibling;
+			if (rpid==INVALID_PAGEID || tp->info.nEntries!=tp->info.nSearchKeys+1) {fEnd=true; rep.nLeaves++; break;}
+			tp->getKey(uint16_t(~0u),*key); if (nIO>=budget) {tctx.pb.release(); threadSleep(DEFRAG_PAUSE); nIO=0; break;}
+			const size_t lleft=tp->info.nSearchKeys!=0?xSize-tp->info.freeSpaceLength-tp->info.scatteredFreeSpace:xSize; rep.nLeaves++;
+			if (tctx.pb.getPage(rpid,ctx->trpgMgr,PGCTL_COUPLE)==NULL) {fEnd=true; break;} nIO++;
+			tp=(const TreePageMgr::TreePage*)tctx.pb->getPageBuf();
+			if (lleft+xSize-tp->info.freeSpaceLength-tp->info.scatteredFreeSpace<=lmax) {
+				// re-descend to the right page to get its parent and merge it into the left sibling
+				tctx.pb.release(); TreeCtx mctx(*this);
+				if (mctx.findPage(key)==RC_OK && mctx.pb->getPageID()==rpid) {mctx.pb.release(); if (mctx.mergePages(*key,rpid)==RC_OK) {rep.nFreed++; nIO+=3;}}
+				nIO+=mctx.depth+1; break;
+			}
+		}
+	}
+	nDefragLeaves=rep.nLeaves; ctx->free(key); return rc;
+}
+
+RC KeyStats::addBound(StoreCtx *ctx,const SearchKey& key)
+{
+	SearchKey &bk=bounds[nBounds];
+	if (key.type<KT_BIN || key.type>=KT_ALL) bk=key;
+	else {
+		void *p=ctx->malloc(key.v.ptr.l); if (p==NULL) return RC_NOMEM;
+		memcpy(p,key.getPtr2(),key.v.ptr.l); bk=SearchKey(p,key.v.ptr.l,key.type==KT_REF); bk.loc=SearchKey::PLC_ALLC;
+	}
+	nBounds++; return RC_OK;
+}
+
+void KeyStats::free(StoreCtx *ctx,KeyStats *ks)
+{
+	for (KeyStats *prev; ks!=NULL; ks=prev) {
+		prev=ks->prev; for (unsigned i=0; i<ks->nBounds; i++) ks->bounds[i].free(ctx);
+		ctx->free(ks);
+	}
+}
+
+uint64_t KeyStats::estimate(const SearchKey *start,const SearchKey *finish) const
+{
+	if (nBounds<2 || nKeys==0) return nValues; unsigned n=0;
+	const bool fS=start!=NULL && start->isSet(),fF=finish!=NULL && finish->isSet();
+	if (fS && fF && start->cmp(*finish)==0) {
+		for (unsigned i=0; i<nBounds; i++) if (bounds[i].cmp(*start)==0) n++;
+		return n>1?n*nValues/KEYSTATS_BUCKETS:max(nValues/nKeys,(uint64_t)1);
+	}
+	for (unsigned i=0; i<nBounds; i++) if ((!fS || bounds[i].cmp(*start)>=0) && (!fF || bounds[i].cmp(*finish)<=0)) n++;
+	return min(nValues,(n+1)*nValues/KEYSTATS_BUCKETS);
+}
+
+bool KeyFilter::hash(const SearchKey& key,uint64_t& h)
+{
+	const byte *p; unsigned l; float f; double d;
+	switch (key.type) {
+	case KT_UINT: case KT_INT: p=(const byte*)&key.v.u; l=sizeof(uint64_t); break;
+	case KT_FLOAT: if (key.v.f!=key.v.f) return false; f=key.v.f==0.f?0.f:key.v.f; p=(const byte*)&f; l=sizeof(float); break;		// -0==+0, NaN is equal to anything
+	case KT_DOUBLE: if (key.v.d!=key.v.d) return false; d=key.v.d==0.?0.:key.v.d; p=(const byte*)&d; l=sizeof(double); break;
+	case KT_BIN: p=key.getPtr2(); l=key.v.ptr.l; break;
+	default: return false;
+	}
+	h=0xCBF29CE484222325ULL; for (unsigned i=0; i<l; i++) h=(h^p[i])*0x100000001B3ULL;
+	h^=h>>33; h*=0xFF51AFD7ED558CCDULL; h^=h>>33; return true;
+}
+
+void KeyFilter::add(const SearchKey& key)
+{
+	uint64_t h; if (!hash(key,h)) return; const unsigned nb=sizeof(long)*8; bool fNew=false;
+	for (unsigned i=0,h1=uint32_t(h),h2=uint32_t(h>>32)|1; i<KEYFILTER_NHASH; i++,h1+=h2) {
+		const unsigned bit=h1&mask; volatile long *pw=&bits[bit/nb]; const long m=1L<<bit%nb; long w;
+		while (((w=*pw)&m)==0) if (cas(pw,w,w|m)) {fNew=true; break;}
+	}
+	if (fNew) InterlockedIncrement(&nKeys);
+}
+
+bool KeyFilter::test(const SearchKey& key) const
+{
+	uint64_t h; if (!hash(key,h)) return true; const unsigned nb=sizeof(long)*8;
+	for (unsigned i=0,h1=uint32_t(h),h2=uint32_t(h>>32)|1; i<KEYFILTER_NHASH; i++,h1+=h2)
+		{const unsigned bit=h1&mask; if ((bits[bit/nb]&1L<<bit%nb)==0) return false;}
+	return true;
+}
+
 RC Tree::findByPrefix(const SearchKey& key,uint32_t prefix,byte *buf,byte& l)
 {
 	RC rc; TreeCtx tctx(*this);
@@ -389,7 +656,8 @@ RC Tree::countValues(const SearchKey& key,uint64_t& nValues)
 RC Tree::insert(const SearchKey& key,const void *value,ushort lval,unsigned multi,bool fUnique)
 {
 	TreeCtx tctx(*this); RC rc=tctx.findPageForUpdate(&key,true);
-	return rc==RC_OK?ctx->trpgMgr->insert(tctx,key,value,lval,multi,fUnique):rc;
+	if (rc==RC_OK && (rc=ctx->trpgMgr->insert(tctx,key,value,lval,multi,fUnique))==RC_OK && stats!=NULL) nStatMods+=(multi&0xFFFF)!=0?multi&0xFFFF:1;
+	return rc;
 }
 
 RC Tree::insert(const SearchKey& key,SubTreeInit& st,Session *ses)
@@ -413,6 +681,7 @@ RC Tree::insert(IMultiKey& mk)
 			if (cmp<0 && (tctx.depth=0,rc=tctx.findPageForUpdate(pkey,true))!=RC_OK) break;
 		}
 		if ((rc=ctx->trpgMgr->insert(tctx,*pkey,value,lval,multi))!=RC_OK) break;
+		if (stats!=NULL) nStatMods+=(multi&0xFFFF)!=0?multi&0xFFFF:1;
 	}
 	return rc==RC_EOF?RC_OK:rc;
 }
@@ -450,7 +719,11 @@ RC Tree::truncate(const SearchKey& key,uint64_t val,bool fCount)
 RC Tree::remove(const SearchKey& key,const void *value,ushort lval,unsigned multi)
 {
 	TreeCtx tctx(*this); RC rc=tctx.findPageForUpdate(&key);
-	return rc==RC_OK?ctx->trpgMgr->remove(tctx,key,value,lval,multi):rc;
+	if (rc==RC_OK && (rc=ctx->trpgMgr->remove(tctx,key,value,lval,multi))==RC_OK) {
+		const long n=(multi&0xFFFF)!=0?multi&0xFFFF:1; if (stats!=NULL) nStatMods+=n;
+		if ((mode&TF_DEFRAG)!=0 && uint64_t(nDelMods+=n)>max((uint64_t)DEFRAG_MIN_DELETES,uint64_t(nDefragLeaves)*DEFRAG_DELETES_PER_LEAF) && cas(&fDefragRQ,0L,1L)) DefragRQ::post(*this);
+	}
+	return rc;
 }
 
 RC Tree::drop(PageID pid,StoreCtx *ctx,TreeFreeData *dd)
@@ -489,6 +762,7 @@ TreeConnect *Tree::persist(uint32_t&) const
 
 TreeStdRoot::~TreeStdRoot()
 {
+	KeyFilter::free(ctx,filter); KeyStats::free(ctx,stats);
 }
 
 PageID TreeStdRoot::startPage(const SearchKey*,int& level,bool fRead,bool fBefore)
@@ -527,6 +801,17 @@ RC TreeStdRoot::addRootPage(const SearchKey& key,PageID& pageID,unsigned level)
 	pb->release(); return rc;
 }
 
+RC TreeStdRoot::load(IMultiKey& mk,PageID *first)
+{
+	if (root==INVALID_PAGEID) {
+		Session *ses=Session::getSession(); if (ses==NULL) return RC_NOSESSION; if (!ses->inWriteTx()) return RC_READTX;
+		TreeLoader tl(ses,indexFormat()); PageID f; RC rc; if (filter!=NULL) filter->invalidate();		// loaded keys bypass the filter
+		if ((rc=tl.load(mk,root,height,f))!=RC_OK) return rc;
+		if (first!=NULL && f!=INVALID_PAGEID) *first=f;
+	}
+	return insert(mk);
+}
+
 RC TreeStdRoot::removeRootPage(PageID page,PageID leftmost,unsigned level)
 {
 	if (level!=height || root!=page || leftmost==INVALID_PAGEID) return RC_FALSE;
@@ -704,10 +989,62 @@ const static TREE_KT ktFromKVT[] =
 };
 };
 
+static uint64_t zDim(TREE_KT type,const IndexKeyV& v)
+{
+	union {double d; uint64_t u;} w;
+	switch (type) {
+	default: return v.u;
+	case KT_INT: return uint64_t(v.i)^0x8000000000000000ULL;
+	case KT_FLOAT: w.d=v.f; break;
+	case KT_DOUBLE: w.d=v.d; break;
+	}
+	return w.d==0.?0x8000000000000000ULL:(w.u&0x8000000000000000ULL)!=0?~w.u:w.u|0x8000000000000000ULL;
+}
+
+static void zEncode(byte *buf,const uint64_t *zv,unsigned nDims)
+{
+	buf[0]=0x80|KVT_BIN; buf[1]=byte(nDims*sizeof(uint64_t)); buf+=2; memset(buf,0,nDims*sizeof(uint64_t));
+	for (unsigned i=0,k=0; i<64; i++) for (unsigned d=0; d<nDims; d++,k++) if ((zv[d]<<i&0x8000000000000000ULL)!=0) buf[k>>3]|=0x80>>(k&7);
+}
+
+static void zLoad(byte *z,unsigned k,unsigned nDims,unsigned nBits,bool f1)
+{
+	for (bool f=f1; k<nBits; k+=nDims,f=!f1) if (f) z[k>>3]|=0x80>>(k&7); else z[k>>3]&=~(0x80>>(k&7));
+}
+
+bool AfyKernel::isZOrderable(const IndexSeg *sg,unsigned nSegs)
+{
+	if (nSegs<2 || nSegs>ZORDER_MAX_DIMS) return false;
+	for (unsigned i=0; i<nSegs; i++) switch (sg[i].type) {
+	default: return false;
+	case VT_INT: case VT_UINT: case VT_INT64: case VT_UINT64: case VT_FLOAT: case VT_DOUBLE: case VT_DATETIME: case VT_INTERVAL:
+		if ((sg[i].flags&(ORD_DESC|ORD_NCASE))!=0 || sg[i].lPrefix!=0) return false; break;
+	}
+	return true;
+}
+
+bool AfyKernel::zBigMin(const byte *z,const byte *zmin,const byte *zmax,ushort lz,unsigned nDims,byte *res)
+{
+	byte mn[ZORDER_MAX_DIMS*sizeof(uint64_t)],mx[ZORDER_MAX_DIMS*sizeof(uint64_t)]; bool fRes=false;
+	if (lz>sizeof(mn) || nDims==0) return false; memcpy(mn,zmin,lz); memcpy(mx,zmax,lz);
+	for (unsigned k=0,nBits=lz*8; k<nBits; k++) {
+		const byte m=0x80>>(k&7);
+		switch (((z[k>>3]&m)!=0?4:0)|((mn[k>>3]&m)!=0?2:0)|((mx[k>>3]&m)!=0?1:0)) {
+		case 0: case 7: break;
+		case 1: memcpy(res,mn,lz); zLoad(res,k,nDims,nBits,true); fRes=true; zLoad(mx,k,nDims,nBits,false); break;
+		case 3: memcpy(res,mn,lz); return true;
+		case 5: zLoad(mn,k,nDims,nBits,true); break;
+		default: return fRes;
+		}
+	}
+	memcpy(res,z,lz); return true;
+}
+
 RC SearchKey::toKey(const Value **ppv,unsigned nv,const IndexSeg *kds,int idx,Session *ses,MemAlloc *ma)
 {
 	RC rc=RC_OK; byte *buf=NULL,*p; const bool fVar=nv>1 || kds[0].type==VT_ANY && kds[0].lPrefix==0 && (kds[0].flags&ORD_NCASE)==0;
-	bool fDel=false; unsigned xbuf=512,lkey=0; if (ma==NULL) ma=ses;
+	const bool fZ=nv>1 && nv<=ZORDER_MAX_DIMS && (kds[0].flags&SEG_ZORDER)!=0; uint64_t zv[ZORDER_MAX_DIMS];
+	bool fDel=false; unsigned xbuf=512,lkey=fZ?2+nv*sizeof(uint64_t):0; if (ma==NULL) ma=ses;
 	for (unsigned ii=0; ii<nv; ii++) {
 		const IndexSeg& ks=kds[ii]; const Value *pv=ppv[ii]; Value w; byte kbuf[XPINREFSIZE];
 		type=KT_ALL; loc=PLC_EMB;
@@ -803,6 +1140,7 @@ RC SearchKey::toKey(const Value **ppv,unsigned nv,const IndexSeg *kds,int idx,Se
 			case KT_REF:
 				pd=kbuf; l=v.ptr.l; l0++; kt|=KVT_REF; break;
 			}
+			if (fZ) zv[ii]=type==KT_ALL?(kt&0x10)!=0?~0ULL:0ULL:zDim(type,v);
 			if (lkey+l0+l>xbuf || buf==NULL && (buf=(byte*)alloca(xbuf))==NULL) {
 				size_t old=xbuf; xbuf=max((unsigned)(lkey+l0+l),xbuf);
 				if (buf!=NULL && !fDel) {
@@ -819,6 +1157,7 @@ RC SearchKey::toKey(const Value **ppv,unsigned nv,const IndexSeg *kds,int idx,Se
 	if (rc!=RC_OK) {
 		if (fDel) ma->free(buf); if (type>=KT_BIN && loc==PLC_ALLC) ma->free((void*)v.ptr.p); type=KT_ALL; loc=PLC_EMB;
 	} else if (buf!=NULL) {
+		if (fZ) zEncode(buf,zv,nv);
 		if (fDel) v.ptr.p=xbuf>=lkey*2?(byte*)ma->realloc(buf,lkey,xbuf):buf;
 		else if ((p=(byte*)ma->malloc(lkey))==NULL) {type=KT_ALL; loc=PLC_EMB; return RC_NOMEM;}
 		else {v.ptr.p=p; memcpy(p,buf,lkey);}
@@ -896,15 +1235,35 @@ static int cmpSeg(const byte *&s1,ushort& l1,const byte *&s2,ushort& l2,byte mbe
 
 int AfyKernel::cmpMSeg(const byte *s1,ushort l1,const byte *s2,ushort l2)
 {
+	if (l1==l2 && memcmp(s1,s2,l1)==0) return 0;			// identical encoding, no need to parse segments
 	try {
 		do {int cmp=cmpSeg(s1,l1,s2,l2); if (cmp!=0) return cmp;} while (l1*l2!=0);
-		if ((l1|l2)==0) return 0;
+		return (l1|l2)==0?0:l1==0?-1:1;						// a segment prefix (truncated separator) sorts before the full key
 	} catch (int) {
 		// report
 	}
 	return -2;
 }
 
+ushort AfyKernel::truncMSeg(const byte *s1,ushort l1,byte *s2,ushort l2)
+{
+	const byte *p2=s2; const ushort lk=l2;
+	try {
+		while (l1*l2!=0) {
+			const byte *q=s1,*p=p2; int cmp=cmpSeg(s1,l1,p2,l2); if (cmp==0) continue; if (cmp>0) break;
+			if ((*q&0x80)==0 && (*p&0x80)==0) {
+				// both are short strings: keep only the first distinguishing byte
+				ushort i=0; while (i<*q && i<*p && q[i+1]==p[i+1]) i++;
+				if (++i<*p) {s2[p-s2]=byte(i); return ushort(p-s2+1+i);}
+			}
+			return ushort(p2-s2);
+		}
+	} catch (int) {
+		// report
+	}
+	return lk;
+}
+
 bool AfyKernel::isHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2)
 {
 	try {
@@ -919,6 +1278,10 @@ bool AfyKernel::cmpBound(const byte *s1,ushort l1,const byte *s2,ushort l2,const
 {
 	try {
 		unsigned i=0;
+		if (sg!=NULL && (sg->flags&SEG_ZORDER)!=0) {
+			int cmp=cmpSeg(s1,l1,s2,l2); if (cmp!=0) return fStart==(cmp<0);
+			if (l1*l2==0) return true;
+		}
 		do {
 			int cmp=cmpSeg(s1,l1,s2,l2,sg==0||(sg[i].flags&SCAN_PREFIX)==0?0:1); 
 			if (fStart) {if (cmp<0) break; if (cmp>0 || cmp==0 && sg!=NULL && (sg[i].flags&SCAN_EXCLUDE_START)!=0) return false;} 
@@ -935,6 +1298,7 @@ bool AfyKernel::checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2
 {
 	try {
 		unsigned i=0;
+		if (sg!=NULL && (sg->flags&SEG_ZORDER)!=0) {cmpSeg(s1,l1,s2,l2); if (l1*l2==0) return true;}
 		do {
 			int cmp=cmpSeg(s1,l1,s2,l2,sg==0||(sg[i].flags&SCAN_PREFIX)==0?0:fStart?1:2);
 			if (cmp>0 || cmp==0 && sg!=NULL && (sg[i].flags&(fStart?SCAN_EXCLUDE_START:SCAN_EXCLUDE_END))!=0) return false;
@@ -960,6 +1324,7 @@ RC SearchKey::getValues(Value *vals,unsigned nv,const IndexSeg *kd,unsigned nFie
 	RC rc=RC_OK; RefVID r,*pr; void *p; if (ma==NULL) ma=ses;
 	if (type==KT_VAR) {
 		const byte *s=(byte*)getPtr2(); ushort l=v.ptr.l;
+		if ((kd->flags&SEG_ZORDER)!=0) {if (l<2 || *s!=(0x80|KVT_BIN) || l<s[1]+2) return RC_CORRUPTED; l-=s[1]+2; s+=s[1]+2;}
 		for (unsigned i=0; i<nFields; i++,kd++) {
 			if (l==0) return RC_CORRUPTED; Value *pv;
 			if (fFilter) pv=(Value*)VBIN::find(kd->propID,vals,nv); else if (i>=nv) break; else pv=&vals[i];
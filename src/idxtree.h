@@ -57,6 +57,9 @@ extern	bool	isHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2);
 extern	bool	cmpBound(const byte *p1,ushort l1,const byte *p2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart);
 extern	bool	checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart);
 extern	ushort	calcMSegPrefix(const byte *s1,ushort l1,const byte *s2,ushort l2);
+extern	ushort	truncMSeg(const byte *s1,ushort l1,byte *s2,ushort l2);
+extern	bool	isZOrderable(const IndexSeg *sg,unsigned nSegs);
+extern	bool	zBigMin(const byte *z,const byte *zmin,const byte *zmax,ushort lz,unsigned nDims,byte *res);
 
 /**
  * union for different key types
@@ -149,6 +152,12 @@ struct IndexFormat
 #define	SCAN_EXCLUDE_START	0x1000
 #define	SCAN_EXCLUDE_END	0x0800
 
+/**
+ * spatial (Z-order) family index: set in flags of the first IndexSeg, keys are prefixed with a bit-interleaved code of all segments
+ */
+#define	SEG_ZORDER			0x0400
+#define	ZORDER_MAX_DIMS		4
+
 /**
  * index scan callback interface
  */
@@ -213,6 +222,102 @@ struct CheckTreeReport
 #define	TF_WITHDEL		0x0001			/**< index allows deletions */
 #define	TF_SPLITINTX	0x0002			/**< split operations don't require separate transactions */
 #define	TF_NOPOST		0x0004			/**< no tree repair operations to be posted */
+#define	TF_KEYFILTER	0x0008			/**< negative exact lookups are answered by a Bloom filter of keys */
+#define	TF_KEYSTATS		0x0010			/**< key statistics are collected for query planning */
+#define	TF_DEFRAG		0x0020			/**< under-filled leaf pages are merged in background after delete churn */
+
+/**
+ * Bloom filter parameters
+ */
+#define	KEYFILTER_BITS_PER_KEY	12			/**< filter bits per distinct key, ~0.4% false positives with 6 hashes */
+#define	KEYFILTER_NHASH			6			/**< number of probes per key */
+#define	KEYFILTER_MIN_KEYS		0x4000		/**< initial filter capacity */
+#define	KEYFILTER_MAX_BITS		0x10000000	/**< filter size limit (32Mb) */
+#define	KEYFILTER_PROBES		64			/**< number of exact lookups before the filter is built */
+
+enum KeyFilterState
+{
+	KFS_BUILDING, KFS_READY, KFS_STALE
+};
+
+/**
+ * Bloom filter of index keys
+ * keys are added by every leaf insert while the filter is installed in a tree, deleted keys are never removed
+ * a filter which holds more keys than its capacity is rebuilt from the tree with larger size
+ */
+class KeyFilter
+{
+	KeyFilter			*const	prev;			/**< replaced filter, can still be referenced by concurrent lookups */
+	const	unsigned			mask;			/**< number of bits - 1 */
+	const	unsigned			capacity;		/**< number of keys for the target false positive rate */
+	volatile long				nKeys;			/**< approximate number of distinct keys added */
+	volatile long				state;			/**< KeyFilterState */
+	volatile long				bits[1];
+	KeyFilter(KeyFilter *pr,unsigned msk) : prev(pr),mask(msk),capacity(unsigned((msk+1ULL)/KEYFILTER_BITS_PER_KEY)),nKeys(0),state(KFS_BUILDING) {}
+	static	bool	hash(const SearchKey& key,uint64_t& h);
+public:
+	static	KeyFilter	*create(StoreCtx *ctx,unsigned nKeys,KeyFilter *prev);
+	static	void		free(StoreCtx *ctx,KeyFilter *kf);
+	static	bool		isSupported(TREE_KT kt) {return kt<=KT_BIN;}
+	void				add(const SearchKey& key);
+	bool				test(const SearchKey& key) const;
+	bool				isReady() const {return state==KFS_READY;}
+	bool				isFull() const {return unsigned(nKeys)>capacity;}
+	void				invalidate() {state=KFS_STALE;}
+	void				restructured() {cas(&state,(long)KFS_BUILDING,(long)KFS_STALE);}		// keys moved left can be missed by a concurrent build
+	unsigned			getNKeys() const {return unsigned(nKeys);}
+	friend	class		Tree;
+};
+
+/**
+ * key statistics parameters
+ */
+#define	KEYSTATS_BUCKETS		16			/**< number of equi-depth histogram buckets */
+#define	KEYSTATS_STALE			4			/**< statistics are recollected after nValues/KEYSTATS_STALE modifications */
+#define	KEYSTATS_MIN_MODS		256			/**< ... but not before this number of modifications */
+
+/**
+ * index key statistics for query planning
+ * number of values, number of distinct keys and equi-depth histogram: bounds[i] is the first key of i-th bucket, the last bound is the highest key
+ * each bucket holds ~nValues/KEYSTATS_BUCKETS values, a frequent key can be repeated in several bounds
+ * collected by a background scan of the index, replaced statistics are freed with the tree
+ */
+class KeyStats
+{
+	KeyStats			*const	prev;			/**< replaced statistics, can still be referenced by concurrent planners */
+	uint64_t					nValues;		/**< total number of values */
+	uint64_t					nKeys;			/**< number of distinct keys */
+	unsigned					nBounds;		/**< number of bucket bounds */
+	SearchKey					bounds[KEYSTATS_BUCKETS+1];
+	KeyStats(KeyStats *pr) : prev(pr),nValues(0),nKeys(0),nBounds(0) {}
+	RC					addBound(StoreCtx *ctx,const SearchKey& key);
+public:
+	static	void		free(StoreCtx *ctx,KeyStats *ks);
+	uint64_t			getNValues() const {return nValues;}
+	uint64_t			getNKeys() const {return nKeys;}
+	uint64_t			estimate(const SearchKey *start,const SearchKey *finish) const;
+	friend	class		Tree;
+};
+
+/**
+ * online defragmentation parameters
+ */
+#define	DEFRAG_MIN_DELETES		0x1000		/**< minimal number of deletions before a defragmentation pass is posted */
+#define	DEFRAG_DELETES_PER_LEAF	32			/**< ... or this number per leaf page visited by the previous pass */
+#define	DEFRAG_FILL				75			/**< adjacent leaves are merged if their content fits in this percentage of a page */
+#define	DEFRAG_IO_BUDGET		128			/**< number of page accesses between pauses */
+#define	DEFRAG_PAUSE			20			/**< pause in milliseconds */
+
+/**
+ * defragmentation pass results
+ */
+struct DefragReport
+{
+	unsigned	nLeaves;		/**< number of leaf pages visited */
+	unsigned	nFreed;			/**< number of pages freed by merges */
+	unsigned	depth;			/**< tree depth before the pass */
+	unsigned	newDepth;		/**< tree depth after the pass */
+};
 
 /**
  * multi-key insert interface
@@ -268,13 +373,26 @@ public:
 	RC					truncate(const SearchKey& key,uint64_t val,bool fCount=false);
 	RC					remove(const SearchKey& key,const void *value=NULL,ushort lValue=0,unsigned multi=0);
 	TreeScan			*scan(Session *ses,const SearchKey *start,const SearchKey *finish=NULL,unsigned flgs=0,const IndexSeg *sg=NULL,unsigned nSegs=0,IKeyCallback *kc=NULL);
+	bool				mayContain(const SearchKey& key);
+	RC					buildFilter();
+	const	KeyStats	*getStats();
+	RC					collectStats();
+	RC					defragment(DefragReport& rep,unsigned budget=DEFRAG_IO_BUDGET);
 	static	RC			drop(PageID,StoreCtx*,TreeFreeData* =NULL);
 	static	unsigned	checkTree(StoreCtx*,PageID root,CheckTreeReport& res,CheckTreeReport *sec=NULL);
 	StoreCtx			*getStoreCtx() const {return ctx;}
 protected:
 	StoreCtx			*const ctx;
 	uint16_t			mode;
-	Tree(StoreCtx *ct,uint16_t md=TF_WITHDEL) : ctx(ct),mode(md) {}
+	KeyFilter *volatile	filter;
+	volatile long		nFilterProbes;
+	KeyStats *volatile	stats;
+	volatile long		nStatMods;			/**< approximate number of modifications since statistics were collected */
+	volatile long		fStatsRQ;			/**< statistics collection is posted */
+	volatile long		nDelMods;			/**< approximate number of deletions since the last defragmentation pass */
+	volatile long		fDefragRQ;			/**< defragmentation pass is posted */
+	unsigned			nDefragLeaves;		/**< number of leaf pages visited by the last pass */
+	Tree(StoreCtx *ct,uint16_t md=TF_WITHDEL) : ctx(ct),mode(md),filter(NULL),nFilterProbes(0),stats(NULL),nStatMods(0),fStatsRQ(0),nDelMods(0),fDefragRQ(0),nDefragLeaves(0) {}
 	enum	TreeOp		{TO_READ,TO_INSERT,TO_UPDATE,TO_DELETE,TO_EDIT};		/**< used in recovery */
 	PBlock				*getPage(PageID pid,unsigned stamp,TREE_NODETYPE type);
 	friend	class		TreePageMgr;
@@ -282,6 +400,9 @@ protected:
 	friend	class		TreeRQ;
 	friend	class		TreeInsertRQ;
 	friend	class		TreeDeleteRQ;
+	friend	class		KeyFilterRQ;
+	friend	class		KeyStatsRQ;
+	friend	class		DefragRQ;
 	friend	struct		TreeCtx;
 	friend	struct		ECB;
 };
@@ -319,6 +440,7 @@ public:
 	virtual	unsigned getStamp(TREE_NODETYPE) const;
 	virtual	void	getStamps(unsigned stamps[TREE_NODETYPE_ALL]) const;
 	virtual	void	advanceStamp(TREE_NODETYPE);
+	RC				load(IMultiKey& mk,PageID *first=NULL);
 };
 
 /**
@@ -371,6 +493,8 @@ public:
 	SharedCounter		traverse;
 	SharedCounter		pageRead;
 	SharedCounter		sibRead;
+	SharedCounter		optRetry;
+	SharedCounter		filterNeg;
 public:
 	TreeMgr(StoreCtx *ct,unsigned timeout);
 	virtual ~TreeMgr();
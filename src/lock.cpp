@@ -36,10 +36,23 @@ const unsigned LockMgr::lockConflictMatrix[LOCK_ALL] = {
 	1<<LOCK_IS|1<<LOCK_IX|1<<LOCK_SHARED|1<<LOCK_SIX|1<<LOCK_UPDATE|1<<LOCK_EXCLUSIVE	//	EXCLUSIVE
 };
 
-LockMgr::LockMgr(StoreCtx *ct) : ctx(ct),nFreeBlocks(0),pageVTab(VB_HASH_SIZE,(MemAlloc*)ct),topmost(NULL),oldSes(NULL),oldTimestamp(0)
+LockMgr::LockMgr(StoreCtx *ct) : ctx(ct),nFreeBlocks(0),pageVTab(VB_HASH_SIZE,(MemAlloc*)ct),topmost(NULL),oldSes(NULL),oldTimestamp(0),
+	vcMax(0),nFreedTV(0)
 {
-	InitializeSListHead(&freeHeaders); InitializeSListHead(&freeGranted);
-	if ((ct->mode&STARTUP_RT)==0) {RC rc=ct->tqMgr->add(new(ct) DLD(ct)); if (rc!=RC_OK) throw rc;}
+	InitializeSListHead(&freeHeaders); InitializeSListHead(&freeGranted); memset(vcHist,0,sizeof(vcHist));
+	if ((ct->mode&STARTUP_RT)==0) {
+		RC rc=ct->tqMgr->add(new(ct) DLD(ct)); if (rc!=RC_OK) throw rc;
+		if ((rc=ct->tqMgr->add(new(ct) VGC(ct)))!=RC_OK) throw rc;
+	}
+}
+
+LockMgr::~LockMgr()
+{
+	if ((ctx->mode&STARTUP_PRINT_STATS)!=0 && (nFreedTV!=0 || vcMax!=0)) {
+		report(MSG_INFO,"\tVersion GC stats: %lu, longest chain: %u\n",(unsigned long)nFreedTV,vcMax);
+		for (unsigned i=0; i<VGC_N_HIST_BUCKETS; i++) if (vcHist[i]!=0)
+			report(MSG_INFO,"\t\t%u%s: %u\n",i,i+1<VGC_N_HIST_BUCKETS?"":"+",vcHist[i]);
+	}
 }
 
 template<class T> inline T* LockMgr::alloc(SLIST_HEADER& sHdr)
@@ -64,15 +77,21 @@ RC LockMgr::lock(LockType lt,PINx& pe,unsigned flags)
 	Session *ses=pe.getSes(); if (ses==NULL) return RC_NOSESSION;
 	if (!ses->inWriteTx() || (ses->getStore()->mode&STARTUP_RT)!=0) return RC_OK;
 	if (pe.tv==NULL && (rc=getTVers(pe,lt==LOCK_SHARED?TVO_READ:TVO_UPD))!=RC_OK) return rc==RC_NOTFOUND?RC_OK:rc;
-	bool fLocked=false; GrantedLock *gl=NULL,*og=NULL; if (lt>=LOCK_UPDATE) ses->lockClass(); assert(pe.tv!=NULL);
-	LockHdr *lh=pe.tv->hdr;
-	if (lh==NULL) {
-		RWLockP tlck(&pe.tv->lock,RW_X_LOCK);
+	GrantedLock *gl=NULL,*og=NULL; if (lt>=LOCK_UPDATE) ses->lockClass(); assert(pe.tv!=NULL);
+	LockHdr *lh;
+	{
+		// the header is created on first lock request (see getTVers()) and freed in LockHdr::release() under tv->lock
+		RWLockP tlck(&pe.tv->lock,RW_S_LOCK);
 		if ((lh=pe.tv->hdr)!=NULL) ++lh->fixCount;
-		else if ((pe.tv->hdr=lh=new(alloc<LockHdr>(freeHeaders)) LockHdr(pe.tv))==NULL) return RC_NOMEM;
-	} else {
-		++lh->fixCount; lh->sem.lock(ses->lockReq.sem);
-		fLocked=true; unsigned mask=lockConflictMatrix[lt];
+		else {
+			tlck.set(NULL); tlck.set(&pe.tv->lock,RW_X_LOCK);
+			if ((lh=pe.tv->hdr)!=NULL) ++lh->fixCount;
+			else if ((pe.tv->hdr=lh=new(alloc<LockHdr>(freeHeaders)) LockHdr(pe.tv))==NULL) return RC_NOMEM;
+		}
+	}
+	lh->sem.lock(ses->lockReq.sem);
+	{
+		unsigned mask=lockConflictMatrix[lt];
 		for (og=(GrantedLock*)lh->grantedLocks.next; ;og=(GrantedLock*)og->next)
 			if (og==&lh->grantedLocks) {og=NULL; break;} else if (og->ses==ses) break;
 		unsigned grantedCnts[LOCK_ALL]; memset(grantedCnts,0,sizeof(grantedCnts));
@@ -110,7 +129,7 @@ RC LockMgr::lock(LockType lt,PINx& pe,unsigned flags)
 		gl->txNext=ses->heldLocks; ses->heldLocks=gl; gl->subTxID=ses->tx.subTxID;
 		lh->grantedCnts[lt]++; lh->grantedMask|=1<<lt; lh->grantedLocks.insertFirst(gl); 
 	}
-	if (fLocked) lh->sem.unlock(ses->lockReq.sem);
+	lh->sem.unlock(ses->lockReq.sem);
 	return rc;
 }
 
@@ -212,12 +231,14 @@ RC LockMgr::getTVers(PINx& pe,TVOp tvo)
 			else {++pv->fixCnt; pageVTab.insertNoLock(pv); if (!pe.pb.isNull()) pe.pb->setVBlock(pv);}
 		}
 		RWLockP lck(&pv->lock,RW_S_LOCK);
-		pe.tv=(TVers*)BIN<TVers,PageIdx,TVers::TVersCmp>::find(pe.getAddr().idx,(const TVers**)pv->vArray,pv->nTV);
-		if (pe.tv==NULL && (tvo!=TVO_READ || ses->inWriteTx())) {
+		// the descriptor is fixed while pv->lock is held: version GC drops only unfixed descriptors under the exclusive lock
+		if ((pe.tv=(TVers*)BIN<TVers,PageIdx,TVers::TVersCmp>::find(pe.getAddr().idx,(const TVers**)pv->vArray,pv->nTV))!=NULL) pe.tv->fix();
+		else if (tvo!=TVO_READ || ses->inWriteTx()) {
 			lck.set(NULL); lck.set(&pv->lock,RW_X_LOCK); const TVers **ins=NULL;
-			if ((pe.tv=(TVers*)BIN<TVers,PageIdx,TVers::TVersCmp>::find(pe.getAddr().idx,(const TVers**)pv->vArray,pv->nTV,&ins))==NULL) {
-				LockHdr *lh=tvo!=TVO_INS?new(alloc<LockHdr>(freeHeaders)) LockHdr(pe.tv):(LockHdr*)0;
-				if ((pe.tv=new(ctx) TVers(pe.getAddr().idx,lh,NULL,tvo==TVO_INS?TV_INS:TV_UPD,tvo!=TVO_INS))==NULL) return RC_NOMEM;
+			if ((pe.tv=(TVers*)BIN<TVers,PageIdx,TVers::TVersCmp>::find(pe.getAddr().idx,(const TVers**)pv->vArray,pv->nTV,&ins))!=NULL) pe.tv->fix();
+			else {
+				if ((pe.tv=new(ctx) TVers(pe.getAddr().idx,NULL,NULL,tvo==TVO_INS?TV_INS:TV_UPD,tvo!=TVO_INS))==NULL) return RC_NOMEM;
+				pe.tv->fix();
 				if (pv->vArray==NULL || pv->nTV>=pv->xTV) {
 					ptrdiff_t sht=ins-(const TVers**)pv->vArray;
 					if ((pv->vArray=(TVers**)ctx->realloc(pv->vArray,(pv->xTV+=(pv->xTV==0?10:pv->xTV/2))*sizeof(TVers*)))==NULL) 
@@ -243,6 +264,16 @@ void DLD::destroyTimeRQ()
 	ctx->free(this);
 }
 
+void VGC::processTimeRQ()
+{
+	ctx->lockMgr->collectVersions();
+}
+
+void VGC::destroyTimeRQ()
+{
+	ctx->free(this);
+}
+
 void LockMgr::process()
 {
 	MutexP lck(&waitQLock); Session *ses=waitQ.getLast(); if (ses==NULL || ses->lockReq.lh==NULL) return;
@@ -290,3 +321,37 @@ void LockMgr::process()
 			}
 	}
 }
+
+//-------------------------------------------------------------------------------------------------
+
+void LockMgr::collectVersions()
+{
+	memset(vcHist,0,sizeof(vcHist));
+	for (unsigned i=0,nBuckets=pageVTab.getHashSize(); i<nBuckets; i++) {
+		DynArray<PageV*> pages((MemAlloc*)ctx); pageVTab.lockBucket(i,RW_S_LOCK);
+		for (HChain<PageV>::it it(pageVTab.start(i)); ++it; ) {PageV *pv=it.get(); if (pv->vArray!=NULL && (pages+=pv)==RC_OK) ++pv->fixCnt;}
+		pageVTab.unlockBucket(i);
+		for (unsigned j=0; j<(unsigned)pages; j++) {
+			PageV *pv=pages[j];
+			if (pv->lock.trylock(RW_X_LOCK)) {pruneVersions(pv); pv->lock.unlock();}
+			pv->release();
+		}
+	}
+}
+
+void LockMgr::pruneVersions(PageV *pv)
+{
+	unsigned nTV=0;
+	for (unsigned i=0; i<pv->nTV; i++) {
+		TVers *tv=pv->vArray[i]; unsigned lChain=0;
+		// pv->lock is held exclusively: an unfixed descriptor cannot be found by getTVers() until it's dropped from vArray
+		if (tv->fixCnt==0 && tv->lock.trylock(RW_X_LOCK)) {
+			const bool fDrop=tv->fixCnt==0 && tv->hdr==NULL && tv->fCommited && tv->stack==NULL; tv->lock.unlock();
+			if (fDrop) {ctx->free(tv); ++nFreedTV; continue;}
+		}
+		for (const DataSS *ds=tv->stack; ds!=NULL; ds=ds->nextSS) lChain++;
+		vcHist[lChain<VGC_N_HIST_BUCKETS?lChain:VGC_N_HIST_BUCKETS-1]++; if (lChain>vcMax) vcMax=lChain;
+		pv->vArray[nTV++]=tv;
+	}
+	if ((pv->nTV=nTV)==0) {ctx->free(pv->vArray); pv->vArray=NULL; pv->xTV=0;}
+}
@@ -36,6 +36,8 @@ namespace AfyKernel
 #define	FREE_BLOCK_SIZE			0x1000				/**< block containing free LockHdr structures */
 #define	MAX_FREE_BLOCKS			0x0100				/**< maximum number of blocks for LockHdr structures */
 #define	VB_HASH_SIZE			0x0100				/**< transient versioning descriptor hash table size */
+#define	VGC_INTERVAL			1000000ULL			/**< transient version garbage collection interval (microseconds) */
+#define	VGC_N_HIST_BUCKETS		16					/**< version chain length histogram size */
 
 class TVers;
 
@@ -112,6 +114,16 @@ struct DLD : public TimeRQ
 	void	destroyTimeRQ();
 };
 
+/**
+ * transient version garbage collector - timer queue element
+ */
+struct VGC : public TimeRQ
+{
+	VGC(StoreCtx *ct) : TimeRQ(254,VGC_INTERVAL,ct) {}
+	void	processTimeRQ();
+	void	destroyTimeRQ();
+};
+
 /**
  * transient versioning resource states
  */
@@ -146,9 +158,12 @@ class TVers
 	DataSS	*volatile	stack;
 	TVState	volatile	state;
 	bool	volatile	fCommited;
+	long	volatile	fixCnt;				/**< number of PINx referring to this descriptor; taken under PageV::lock */
 public:
-	TVers(PageIdx i,LockHdr *h,DataSS *st,TVState s=TV_UPD,bool fC=false) : idx(i),hdr(h),stack(st),state(s),fCommited(fC) {}
+	TVers(PageIdx i,LockHdr *h,DataSS *st,TVState s=TV_UPD,bool fC=false) : idx(i),hdr(h),stack(st),state(s),fCommited(fC),fixCnt(0) {}
 	~TVers();
+	void	fix() {InterlockedIncrement(&fixCnt);}
+	void	unfix() {assert(fixCnt>0); InterlockedDecrement(&fixCnt);}
 	class TVersCmp {public: __forceinline static int cmp(const TVers *tv,PageIdx i) {return cmp3(tv->idx,i);}};
 	friend	struct		LockHdr;
 	friend	class		LockMgr;
@@ -197,13 +212,19 @@ class LockMgr
 	Session* volatile	oldSes;
 	TIMESTAMP volatile	oldTimestamp;
 
+	unsigned			vcHist[VGC_N_HIST_BUCKETS];			/**< version chain length histogram of the last GC pass */
+	unsigned			vcMax;								/**< longest version chain seen */
+	uint64_t			nFreedTV;							/**< number of TVers released */
+
 	static	const unsigned	lockConflictMatrix[LOCK_ALL];
 	template<class T> inline T* alloc(SLIST_HEADER&);
 	void	checkDeadlock(Session *ses,SemData& sem);
+	void	pruneVersions(PageV *pv);
 	friend	struct	LockHdr;
 	friend	struct	PageV;
 public:
 	LockMgr(class StoreCtx *ct);
+	~LockMgr();
 	void	*operator new(size_t s,StoreCtx *ctx) {void *p=ctx->malloc(s); if (p==NULL) throw RC_NOMEM; return p;}
 	RC		lock(LockType,PINx& pe,unsigned flags=0);
 	RC		getTVers(PINx& pe,TVOp tvo=TVO_READ);
@@ -212,6 +233,7 @@ public:
 	void	releaseLocks(Session *ses,unsigned subTxID=0,bool fAbort=false);
 	void	releaseSession(Session *ses);
 	void	process();
+	void	collectVersions();
 };
 
 };
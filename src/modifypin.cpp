@@ -221,6 +221,12 @@ RC QueryPrc::modifyPIN(const EvalCtx& ectx,const PID& id,const Value *v,unsigned
 	TIMESTAMP ts=0ULL; bool fReIndex=false;
 	if ((mode&MODE_REFRESH)==0 && (pinDescr&HOH_REPLICATED)==0 && isRemote(id)) return RC_NOACCESS;
 	PageAddr oldAddr=pcb->addr,origAddr=PageAddr::noAddr; if (pin!=NULL) pin->addr=pcb->addr;
+
+	if (nv==1 && eids==NULL && (pinMeta&~PMT_NAMED)==0 && (pinDescr&(HOH_DELETED|HOH_REPLICATED))==0 && !isRemote(id) && !ses->isReplication()) {
+		if ((rc=modifyInPlace(ectx,*pcb,v[0],pin))==RC_OK) {if (pcb==&cb) cb.pb.release(ses); if (pNFailed!=NULL) *pNFailed=~0u; tx.ok(); return RC_OK;}
+		if (rc!=RC_FALSE) {pcb->pb.release(ses); if (pin!=NULL) pin->addr=oldAddr; return rc;}
+		rc=RC_OK;
+	}
 	
 	unsigned np=nv; if (np>20) for (unsigned i=np=1; i<nv; i++) if (v[i].property!=v[i-1].property) np++;
 	byte mdb[START_BUF_SIZE]; ModCtx mctx(sizeof(mdb),mdb,np,ses); PBlockP pageSSV;
@@ -1098,6 +1104,98 @@ finish:
 	return rc;
 }
 
+static inline bool isFixedScalar(ValueType ty) {return uint8_t(ty-VT_INT)<=uint8_t(VT_INTERVAL-VT_INT);}
+
+/**
+ * fast path for a single modification of a fixed-size scalar property which doesn't affect any data event
+ * patches the value in place and logs it as HPOP_EDIT of the same length; returns RC_FALSE if not applicable
+ */
+RC QueryPrc::modifyInPlace(const EvalCtx& ectx,PINx& cb,const Value& v,PIN *pin)
+{
+	const PropertyID propID=v.property; const ExprOp op=(ExprOp)v.op; Session *const ses=ectx.ses; const HeapPageMgr::HeapV *hprop; RC rc;
+	if (propID<=MAX_BUILTIN_URIID || propID>STORE_MAX_URIID || v.eid!=STORE_COLLECTION_ID || op!=OP_SET && (op<OP_FIRST_EXPR || op>OP_LAST_MODOP)) return RC_FALSE;
+	if (!isFixedScalar((ValueType)v.type) || (v.flags&VF_SSV)!=0 || (hprop=cb.hpin->findProperty(propID))==NULL || !isFixedScalar(hprop->type.getType())) return RC_FALSE;
+	if (cb.hpin->findProperty(PROP_SPEC_UPDATED)!=NULL || cb.hpin->findProperty(PROP_SPEC_UPDATEDBY)!=NULL || cb.hpin->findProperty(PROP_SPEC_STAMP)!=NULL) return RC_FALSE;
+	if (ctx->classMgr->dependsOn(&cb,propID,ses)) return RC_FALSE;
+
+	Value w; HType ht; ushort sht=0,offs=0; uint64_t nbuf[2];
+	if (op==OP_SET) w=v;
+	else if ((rc=cb.loadVH(w,hprop,0,ses))!=RC_OK) return rc;
+	else if ((rc=Expr::calc(op,w,&v,2,op==OP_RSHIFT&&(v.meta&META_PROP_UNSIGNED)!=0?CND_UNS:0,ses))!=RC_OK) return rc;
+	else {if (!isFixedScalar((ValueType)w.type)) {freeV(w); return RC_FALSE;} w.meta=hprop->type.flags;}
+	if ((w.meta|hprop->type.flags&(META_PROP_PART|META_PROP_SSTORAGE|META_PROP_FTINDEX|META_PROP_LOCAL))!=hprop->type.flags) return RC_FALSE;
+	if (persistValue(w,sht,ht,offs,(byte*)nbuf,NULL,cb.addr)!=RC_OK || ht!=hprop->type) return RC_FALSE;
+
+	const byte *const frame=cb.pb->getPageBuf(),*pOld,*pNew; ushort l;
+	if (ht.isCompact()) {pOld=(const byte*)&hprop->offset; pNew=(const byte*)&offs; l=sizeof(PageOff);}
+	else if (HeapPageMgr::dataLength(hprop->type,frame+hprop->offset,frame)!=sht) return RC_FALSE;
+	else {pOld=frame+hprop->offset; pNew=(const byte*)nbuf; l=sht;}
+	if (memcmp(pOld,pNew,l)!=0) {
+		byte rec[sizeof(HeapPageMgr::HeapModEdit)+sizeof(nbuf)*2]; HeapPageMgr::HeapModEdit *hed=(HeapPageMgr::HeapModEdit*)rec;
+		hed->dscr=0; hed->shift=ushort(pOld-(const byte*)(&cb.hpin->hdr+1)); hed->oldPtr.len=hed->newPtr.len=l;
+		hed->oldPtr.offset=sizeof(HeapPageMgr::HeapModEdit); hed->newPtr.offset=sizeof(HeapPageMgr::HeapModEdit)+l;
+		memcpy(rec+hed->oldPtr.offset,pOld,l); memcpy(rec+hed->newPtr.offset,pNew,l);
+		if ((rc=ctx->txMgr->update(cb.pb,ctx->heapMgr,(unsigned)cb.addr.idx<<HPOP_SHIFT|HPOP_EDIT,rec,sizeof(HeapPageMgr::HeapModEdit)+l*2))!=RC_OK) return rc;
+		if (cb.fill()==NULL) return RC_CORRUPTED; cb.resetProps();
+	}
+
+	const EvalCtx *ec=&ectx; PIN *pp=pin,*prev=NULL; w.property=propID; w.op=OP_SET; setHT(w);
+	for (;;) {
+		if (pp!=NULL) {
+			Value *pv=(Value*)VBIN::find(propID,pp->properties,pp->nProperties);
+			if (pv!=NULL && isFixedScalar((ValueType)pv->type)) {const ElementID eid=pv->eid; const uint8_t meta=pv->meta; *pv=w; pv->eid=eid; pv->meta=meta;}
+			else if ((pv!=NULL || pp->fPartial==0) && (rc=reload(pp,&cb))!=RC_OK) return rc;
+			prev=pp; pp=NULL;
+		}
+		for (; ec!=NULL && pp==NULL; ec=ec->stack) if (ec->env!=NULL && ec->nEnv!=0 && ec->env[0]!=NULL && ec->env[0]!=pin && ec->env[0]!=&cb
+			&& ec->env[0]->id==cb.id && ec->env[0]!=prev && (ec->env[0]->fPartial==0 || ec->env[0]->properties!=NULL)) pp=ec->env[0];
+		if (pp==NULL) return RC_OK;
+	}
+}
+
+/**
+ * moves the image of a migrated PIN back to its home slot, replacing the forward there
+ * called by heap compaction; RC_FALSE means the PIN cannot be relocated now
+ */
+RC QueryPrc::relocatePIN(Session *ses,const PageAddr& home)
+{
+	PID id; id.pid=home; id.ident=STORE_OWNER; PINx hx(ses,id),cb(ses,id); PBlockP hpb; RC rc;
+	TxSP tx(ses); if ((rc=tx.start(TXI_DEFAULT,TX_ATOMIC))!=RC_OK) return rc;
+	if ((rc=ctx->lockMgr->lock(LOCK_EXCLUSIVE,hx))!=RC_OK || (rc=cb.getBody(TVO_UPD,GB_DELETED))!=RC_OK) return rc;
+	const HeapPageMgr::HeapPIN *hpin=cb.hpin; PageAddr orig,to; const PageAddr copy=cb.addr;
+	if (!hpin->isMigrated() || hpin->meta!=0 || (hpin->hdr.descr&(HOH_DELETED|HOH_REPLICATED))!=0) return RC_FALSE;
+	memcpy(&orig,hpin->getOrigLoc(),PageAddrSize); if (orig!=home) return RC_FALSE;
+	if (hpb.getPage(home.pageID,ctx->heapMgr,PGCTL_XLOCK|QMGR_TRY,ses)==NULL) return RC_FALSE;
+	const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage*)hpb->getPageBuf(),*cp=(const HeapPageMgr::HeapPage*)cb.pb->getPageBuf();
+	const HeapPageMgr::HeapObjHeader *fwd=hp->getObject(hp->getOffset(home.idx));
+	if (fwd==NULL || fwd->getType()!=HO_FORWARD || (fwd->descr&HOH_DELETED)!=0) return RC_FALSE;
+	memcpy(&to,fwd+1,PageAddrSize); if (to!=copy) return RC_FALSE;		// forwards through an intermediate copy are left as is
+
+	// the home page must keep the update reserve after the forward is replaced
+	const bool fCompact=(hpin->hdr.descr&HOH_COMPACTREF)!=0; const size_t expLen=fCompact?hpin->expLength((const byte*)cp):hpin->hdr.getLength();
+	const size_t xSize=HeapPageMgr::contentSize(ctx->bufMgr->getPageSize())-sizeof(PageOff),reserve=ceil(size_t(xSize*ctx->theCB->pctFree),HP_ALIGN);
+	if (ceil(expLen-PageAddrSize,HP_ALIGN)+reserve>hp->totalFree()+fwd->getLength()) return RC_FALSE;
+
+	byte *buf=NULL,*body=NULL,fwdbuf[sizeof(HeapPageMgr::HeapObjHeader)+PageAddrSize]; size_t lr=0,lbody=0; memcpy(fwdbuf,fwd,sizeof(fwdbuf));
+	if ((rc=hpin->serialize(buf,lr,cp,ses,expLen,fCompact))==RC_OK && (rc=hpin->serialize(body,lbody,cp,ses))==RC_OK) {
+		// the original location is stripped from the image: it is stored in its home slot again
+		HeapPageMgr::HeapPIN *img=(HeapPageMgr::HeapPIN*)buf; byte *po=(byte*)img->getOrigLoc();
+		memmove(po,po+PageAddrSize,lr-PageAddrSize-(po-buf)); img->hdr.length-=PageAddrSize; img->fmtExtra=HDF_COMPACT; lr-=PageAddrSize;
+		HeapPageMgr::HeapV *hprop=img->getPropTab();
+		for (unsigned i=img->nProps; i!=0; ++hprop,--i) if (!hprop->type.isCompact()) hprop->offset-=PageAddrSize;
+		if ((rc=ctx->txMgr->update(hpb,ctx->heapMgr,(unsigned)home.idx<<HPOP_SHIFT|HPOP_PURGE,fwdbuf,sizeof(fwdbuf)))==RC_OK &&
+			(rc=ctx->txMgr->update(hpb,ctx->heapMgr,(unsigned)home.idx<<HPOP_SHIFT|HPOP_INSERT,buf,lr))==RC_OK &&
+			(rc=ctx->txMgr->update(cb.pb,ctx->heapMgr,(unsigned)copy.idx<<HPOP_SHIFT|HPOP_PURGE,body,lbody))==RC_OK) {
+			const size_t threshold=ceil(size_t(xSize*(1.-ctx->theCB->pctFree)),HP_ALIGN);
+			ctx->heapMgr->reuse(cb.pb,ses,threshold,true); cb.pb.release(ses); ctx->heapMgr->reuse(hpb,ses,reserve,true);
+			hpb.moveTo(cb.pb); cb=home; cb.fill(); cb.resetProps(); DetectedEvents clr(ses,ctx);
+			if ((rc=ctx->classMgr->detect(&cb,clr,ses))==RC_OK && clr.ndevs!=0) rc=ctx->classMgr->updateIndex(ses,&cb,clr,CI_UPDATE,NULL,&copy);
+		}
+	}
+	ses->free(buf); ses->free(body); if (rc==RC_OK) tx.ok();
+	return rc;
+}
+
 size_t QueryPrc::splitLength(const Value *pv)
 {
 	size_t len=0;
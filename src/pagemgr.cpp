@@ -93,6 +93,60 @@ bool PageMgr::beforeFlush(byte *frame,size_t len,PageID pid)
 	return false;
 }
 
+void PageMgr::afterWrite(PBlock *pb,size_t len,RC)
+{
+	if (ctx->getEncKey()!=NULL) afterIO(pb,len,false);
+}
+
+#define	LZ_HASH_BITS	12
+#define	LZ_MIN_MATCH	4
+
+static byte *lzLength(byte *p,const byte *end,size_t l)
+{
+	for (; l>=255; l-=255) {if (p>=end) return NULL; *p++=255;}
+	if (p>=end) return NULL;
+	*p++=byte(l); return p;
+}
+
+size_t AfyKernel::lzPack(const byte *src,size_t lsrc,byte *dst,size_t ldst)
+{
+	uint16_t htab[1<<LZ_HASH_BITS]; memset(htab,0xFF,sizeof(htab)); assert(lsrc<0xFFFF);
+	const byte *p=src,*lit=src,*const end=src+lsrc; byte *q=dst,*const qend=dst+ldst; size_t ll,ml;
+	if (lsrc>LZ_MIN_MATCH) for (const byte *const mlim=end-LZ_MIN_MATCH; p<=mlim; ) {
+		uint32_t v; memcpy(&v,p,sizeof(v)); const unsigned h=v*2654435761u>>(32-LZ_HASH_BITS);
+		const unsigned c=htab[h]; htab[h]=uint16_t(p-src);
+		if (c==0xFFFF || memcmp(src+c,p,LZ_MIN_MATCH)!=0) {p++; continue;}
+		const byte *m=src+c,*e=p+LZ_MIN_MATCH; while (e<end && *e==m[e-p]) e++;
+		ll=p-lit; ml=e-p-LZ_MIN_MATCH; if (q>=qend) return 0;
+		*q++=byte((ll<15?ll:15)<<4|(ml<15?ml:15)); if (ll>=15 && (q=lzLength(q,qend,ll-15))==NULL) return 0;
+		if (size_t(qend-q)<ll+2) return 0;
+		memcpy(q,lit,ll); q+=ll; q[0]=byte(p-m); q[1]=byte((p-m)>>8); q+=2;
+		if (ml>=15 && (q=lzLength(q,qend,ml-15))==NULL) return 0;
+		p=lit=e;
+	}
+	ll=end-lit; if (q>=qend) return 0; *q++=byte((ll<15?ll:15)<<4);
+	if (ll>=15 && (q=lzLength(q,qend,ll-15))==NULL || size_t(qend-q)<ll) return 0;
+	memcpy(q,lit,ll); return q+ll-dst;
+}
+
+bool AfyKernel::lzUnpack(const byte *src,size_t lsrc,byte *dst,size_t ldst)
+{
+	const byte *p=src,*const end=src+lsrc; byte *q=dst,*const qend=dst+ldst;
+	while (p<end) {
+		const unsigned tok=*p++; size_t l=tok>>4;
+		if (l==15) for (byte b=255; b==255; l+=b) {if (p>=end) return false; b=*p++;}
+		if (size_t(end-p)<l || size_t(qend-q)<l) return false;
+		memcpy(q,p,l); q+=l; p+=l;
+		if (p>=end) break;
+		if (end-p<2) return false;
+		const size_t off=p[0]|p[1]<<8; p+=2; if (off==0 || off>size_t(q-dst)) return false;
+		if ((l=tok&15)==15) for (byte b=255; b==255; l+=b) {if (p>=end) return false; b=*p++;}
+		if (size_t(qend-q)<(l+=LZ_MIN_MATCH)) return false;
+		for (const byte *m=q-off; l!=0; --l) *q++=*m++;
+	}
+	return q==qend;
+}
+
 LSN PageMgr::getLSN(const byte *,size_t) const
 {
 	return LSN(0);
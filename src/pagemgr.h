@@ -68,6 +68,16 @@ struct PageHeader
 
 #define	FOOTERSIZE	HMACSIZE	/**< space reserved at the end of page */
 
+#define	PGC_COMPRESSED	0x80000000	/**< PageHeader::nPages flag for compressed pages, low bits contain length of compressed data */
+#define	PGC_BLOCK		0x1000		/**< file system block size used to release unused parts of compressed pages */
+
+/**
+ * LZ-style page compression
+ * lzPack returns length of compressed data or 0 if it doesn't fit in ldst bytes
+ */
+extern	size_t	lzPack(const byte *src,size_t lsrc,byte *dst,size_t ldst);
+extern	bool	lzUnpack(const byte *src,size_t lsrc,byte *dst,size_t ldst);
+
 /**
  * PageMgr interface
  * provides default implementations for all methods
@@ -81,6 +91,7 @@ public:
 	virtual	void	initPage(byte *page,size_t lPage,PageID pid);
 	virtual	bool	afterIO(class PBlock *,size_t lPage,bool fLoad);
 	virtual	bool	beforeFlush(byte *page,size_t lPage,PageID pid);
+	virtual	void	afterWrite(class PBlock *,size_t lPage,RC rc);
 	virtual	RC		update(class PBlock *,size_t len,unsigned info,const byte *rec,size_t lrec,unsigned flags,class PBlock *newp=NULL);
 	virtual	PageID	multiPage(unsigned info,const byte *rec,size_t lrec,bool& fMerge);
 	virtual	RC		undo(unsigned info,const byte *rec,size_t lrec,PageID=INVALID_PAGEID);
@@ -364,6 +364,7 @@ const static struct
 	{{S_L("LEAVE")},			META_PROP_LEAVE,			PROP_SPEC_ACTION},
 	{{S_L("CREATE_PERM")},		META_PROP_CREATE,			PROP_SPEC_ADDRESS},
 	{{S_L("INDEXED")},			META_PROP_INDEXED,			PROP_SPEC_PREDICATE},
+	{{S_L("SPATIAL")},			META_PROP_SPATIAL,			PROP_SPEC_PREDICATE},
 	{{S_L("SYNC")},				META_PROP_SYNC,				PROP_SPEC_ANY},
 	{{S_L("KEEPALIVE")},		META_PROP_KEEPALIVE,		PROP_SPEC_ADDRESS},
 	{{S_L("ASYNC")},			META_PROP_ASYNC,			PROP_SPEC_ANY},
@@ -3509,6 +3510,7 @@ void SInCtx::parseCreate(Stmt *&stmt)
 		}
 		if ((lx=lex())==LX_IDENT) {mapURI(true); v.setPropID(PROP_SPEC_OBJID); v.setOp(OP_SET); vals+=v;} 
 		else if (sty==CRT_COMM) nextLex=lx; else throw SY_MISIDN;
+		if (sty==CRT_CLASS) {uint8_t meta=0; parseMeta(PROP_SPEC_PREDICATE,meta); flags|=meta;}
 		switch (sty) {
 		default: break;
 		case CRT_CLASS: case CRT_EVENT: md|=MODE_DEVENT; break;
@@ -4044,6 +4046,10 @@ void SInCtx::parseManage(IAffinity *&ctx,const StartupParameters *sp)
 						if (v.type!=VT_BOOL) throw SY_MISLGC;if (v.b) cparams.mode|=STORE_CREATE_ENCRYPTED;
 					} else if (vv.length==sizeof("PAGEINTEGRITY")-1 && cmpncase(vv.str,"PAGEINTEGRITY",vv.length)) {
 						if (v.type!=VT_BOOL) throw SY_MISLGC;if (v.b) cparams.mode|=STORE_CREATE_PAGE_INTEGRITY;
+					} else if (vv.length==sizeof("COMPRESSED")-1 && cmpncase(vv.str,"COMPRESSED",vv.length)) {
+						if (v.type!=VT_BOOL) throw SY_MISLGC;if (v.b) cparams.mode|=STORE_CREATE_PAGE_COMPRESSION;
+					} else if (vv.length==sizeof("DEDUP")-1 && cmpncase(vv.str,"DEDUP",vv.length)) {
+						if (v.type!=VT_BOOL) throw SY_MISLGC;if (v.b) cparams.mode|=STORE_CREATE_DEDUP;
 					} else if (vv.length==sizeof("MAXSIZE")-1 && cmpncase(vv.str,"MAXSIZE",vv.length)) {
 						if (v.type==VT_INT || v.type==VT_UINT) cparams.maxSize=v.ui;
 						else if (v.type==VT_INT64 || v.type==VT_UINT64) cparams.maxSize=v.ui64;
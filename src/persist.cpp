@@ -33,6 +33,8 @@ Written by Mark Venguerov 2004-2014
 #include "maps.h"
 #include "event.h"
 #include "fio.h"
+#include "crypt.h"
+#include "request.h"
 
 using namespace AfyKernel;
 
@@ -56,6 +58,11 @@ using namespace AfyKernel;
 #define	COMMIT_COMPOUNDS	0x0020
 #define	COMMIT_INVOKED		0x0010
 
+#define	FTPARSE_MIN_PINS	32			/**< minimum number of full-text indexed PINs in a batch to tokenize them in worker threads */
+#define	FTPARSE_CHUNK		16			/**< number of PINs tokenized by one worker request */
+#define	FTPARSE_MAX_WORKERS	8			/**< maximum number of workers tokenizing PINs of one batch */
+#define	FTPARSE_WAIT		10			/**< wait for a worker in progress, ms */
+
 namespace AfyKernel
 {
 	struct AllocPage
@@ -71,8 +78,143 @@ namespace AfyKernel
 		unsigned	last;
 		AllocPage(PageID p,size_t spc,ushort nsl,ushort f) : next(NULL),next2(NULL),pid(p),spaceLeft(spc),lPins(0),idx(nsl),flags(f),first(~0u),last(~0u) {}
 	};
+
+	/**
+	 * full-text tokenization worker - splits string properties of a range of inserted PINs into word lists
+	 * strings are referenced from the PINs of the batch, they're not modified while the batch is being persisted
+	 */
+	class FTParseRQ : public Request
+	{
+		struct FTProp {
+			PropertyID	pid;
+			uint32_t	len;
+			const char	*str;
+		};
+		StoreCtx		*const	ctx;
+		Mutex&			lock;
+		WaitEvent&		done;
+		FTProp			*props;
+		unsigned		*first;
+		unsigned		nPins;
+		bool			fDone;
+		RC				rc;
+		void			parse();
+	public:
+		volatile long	refs;
+		StackAlloc		sa;
+		FTList			**ftls;
+		FTParseRQ(StoreCtx *ct,Mutex& lk,WaitEvent& dn) : ctx(ct),lock(lk),done(dn),props(NULL),first(NULL),nPins(0),fDone(false),rc(RC_OK),refs(1),sa(ct),ftls(NULL) {}
+		RC		init(PIN *const *pins,const unsigned *idx,unsigned n);
+		RC		wait();
+		void	cancel();
+		void	process() {parse(); MutexP lck(&lock); fDone=true; done.signal();}
+		void	destroy() {if (InterlockedDecrement(&refs)==0) {StoreCtx *ct=ctx; this->~FTParseRQ(); ct->free(this);}}
+	};
+
+	/**
+	 * tokenization of full-text indexed PINs of a batch in worker threads
+	 * overlaps with heap page writes and index updates done by the inserting session; FT index itself is updated by the session in PIN order
+	 */
+	class FTPipeline
+	{
+		StoreCtx		*const	ctx;
+		Mutex			lock;
+		WaitEvent		done;
+		unsigned		*idx;
+		unsigned		nIdx;
+		FTParseRQ		**rqs;
+		unsigned		nRqs;
+		unsigned		nPosted;
+		unsigned		cur;
+		unsigned		window;
+		static	bool	isParseable(const PIN *pin);
+		void			post(unsigned n) {for (FTParseRQ *rq; nPosted<n; nPosted++) {rq=rqs[nPosted]; InterlockedIncrement(&rq->refs); if (!RequestQueue::postRequest(rq,ctx)) InterlockedDecrement(&rq->refs);}}
+	public:
+		FTPipeline(StoreCtx *ct) : ctx(ct),idx(NULL),nIdx(0),rqs(NULL),nRqs(0),nPosted(0),cur(0),window(0) {}
+		~FTPipeline() {for (unsigned k=0; k<nRqs; k++) if (rqs[k]!=NULL) {rqs[k]->cancel(); rqs[k]->destroy();}}
+		RC		start(PIN *const *pins,unsigned nPins,MemAlloc *ma);
+		RC		get(unsigned i,FTList *&ftl);
+	};
 };
 
+bool FTPipeline::isParseable(const PIN *pin)
+{
+	if ((pin->mode&(PIN_DELETED|PIN_HIDDEN|PIN_TRANSIENT|COMMIT_FTINDEX))!=COMMIT_FTINDEX) return false;
+	for (unsigned k=0; k<pin->nProperties; k++) if ((pin->properties[k].meta&META_PROP_FTINDEX)!=0 && pin->properties[k].type!=VT_STRING) return false;
+	return true;
+}
+
+RC FTParseRQ::init(PIN *const *pins,const unsigned *idx,unsigned n)
+{
+	unsigned nProps=0;
+	for (unsigned i=0; i<n; i++) {const PIN *pin=pins[idx[i]]; for (unsigned k=0; k<pin->nProperties; k++) if ((pin->properties[k].meta&META_PROP_FTINDEX)!=0) nProps++;}
+	if ((first=(unsigned*)sa.malloc((n+1)*sizeof(unsigned)))==NULL || nProps!=0 && (props=(FTProp*)sa.malloc(nProps*sizeof(FTProp)))==NULL) return RC_NOMEM;
+	for (nProps=0; nPins<n; nPins++) {
+		const PIN *pin=pins[idx[nPins]]; first[nPins]=nProps;
+		for (unsigned k=0; k<pin->nProperties; k++) {
+			const Value& pv=pin->properties[k];
+			if ((pv.meta&META_PROP_FTINDEX)!=0) {FTProp &fp=props[nProps++]; fp.pid=pv.property; fp.len=pv.length; fp.str=pv.str;}
+		}
+	}
+	first[nPins]=nProps; return RC_OK;
+}
+
+void FTParseRQ::parse()
+{
+	ChangeInfo inf={PIN::noPID,PIN::noPID,NULL,NULL,STORE_INVALID_URIID,STORE_COLLECTION_ID}; Value v;
+	if ((ftls=new(&sa) FTList*[nPins])==NULL) {rc=RC_NOMEM; return;}
+	for (unsigned i=0; i<nPins; i++) {
+		if ((ftls[i]=new(&sa) FTList(sa))==NULL) {rc=RC_NOMEM; return;}
+		for (unsigned j=first[i]; j<first[i+1]; j++) {
+			v.set(props[j].str,props[j].len); v.property=inf.propID=props[j].pid; inf.newV=&v;
+			if ((rc=ctx->ftMgr->index(inf,ftls[i],IX_NFT,FTMODE_STOPWORDS,&sa))!=RC_OK) return;
+		}
+	}
+}
+
+RC FTParseRQ::wait()
+{
+	for (lock.lock(); !fDone; done.wait(lock,FTPARSE_WAIT)) if (markSkip()) {
+		// not picked up by a worker yet: tokenize in this thread
+		lock.unlock(); parse(); fDone=true; return rc;
+	}
+	lock.unlock(); return rc;
+}
+
+void FTParseRQ::cancel()
+{
+	for (lock.lock(); !fDone && !markSkip(); ) done.wait(lock,FTPARSE_WAIT);
+	lock.unlock();
+}
+
+RC FTPipeline::start(PIN *const *pins,unsigned nPins,MemAlloc *ma)
+{
+	const unsigned nWorkers=min(unsigned(max(getNProcessors(),1)-1),unsigned(FTPARSE_MAX_WORKERS)); if (nWorkers==0) return RC_OK;
+	if ((idx=(unsigned*)ma->malloc(nPins*sizeof(unsigned)))==NULL) return RC_NOMEM;
+	for (unsigned i=0; i<nPins; i++) if (pins[i]!=NULL && isParseable(pins[i])) idx[nIdx++]=i;
+	if (nIdx<FTPARSE_MIN_PINS) {nIdx=0; return RC_OK;}
+	const unsigned n=(nIdx+FTPARSE_CHUNK-1)/FTPARSE_CHUNK;
+	if ((rqs=(FTParseRQ**)ma->malloc(n*sizeof(FTParseRQ*)))==NULL) {nIdx=0; return RC_NOMEM;}
+	for (RC rc; nRqs<n; nRqs++) {
+		void *p=ctx->malloc(sizeof(FTParseRQ)); if (p==NULL) {nIdx=nRqs*FTPARSE_CHUNK; break;}
+		if ((rc=(rqs[nRqs]=new(p) FTParseRQ(ctx,lock,done))->init(pins,idx+nRqs*FTPARSE_CHUNK,min(nIdx-nRqs*FTPARSE_CHUNK,unsigned(FTPARSE_CHUNK))))!=RC_OK)
+			{rqs[nRqs]->destroy(); nIdx=nRqs*FTPARSE_CHUNK; break;}
+	}
+	// two requests per worker keep workers busy while the session consumes results
+	post(window=min(nWorkers*2,nRqs));
+	return RC_OK;
+}
+
+RC FTPipeline::get(unsigned i,FTList *&ftl)
+{
+	ftl=NULL; while (cur<nIdx && idx[cur]<i) cur++;
+	if (cur>=nIdx || idx[cur]!=i) return RC_OK;
+	const unsigned k=cur/FTPARSE_CHUNK; RC rc=RC_OK;
+	post(min(k+1+window,nRqs));
+	if ((rc=rqs[k]->wait())==RC_OK) ftl=rqs[k]->ftls[cur%FTPARSE_CHUNK];
+	cur++; return rc;
+}
+
 RC QueryPrc::persistPINs(const EvalCtx& ectx,PIN *const *pins,unsigned nPins,unsigned mode,const AllocCtrl *actrl,size_t *pSize,const IntoClass *into,unsigned nInto)
 {
 	if (pins==NULL || nPins==0) return RC_OK; if (ectx.ses==NULL) return RC_NOSESSION;
@@ -85,7 +227,8 @@ RC QueryPrc::persistPINs(const EvalCtx& ectx,PIN *const *pins,unsigned nPins,uns
 	const bool fNewPgOnly=ectx.ses->nTotalIns+nPins>INSERT_THRSH; const Value *pv; TIMESTAMP ts=0;
 	bool fForced=false,fUncommPINs=false; ElementID prefix=ctx->getPrefix(); PINMap pinMap((MemAlloc*)ectx.ses);
 	byte cbuf[START_BUF_SIZE]; StackAlloc mem(ectx.ses,START_BUF_SIZE,cbuf,true); size_t threshold=xSize-reserve,xbuf=0;
-	AllocPage *pages=NULL,*allocPages=NULL,*forcedPages=NULL; unsigned nNewPages=0; PIN **metaPINs=NULL; unsigned nInserted=0; unsigned *allocTab=NULL;
+	AllocPage *pages=NULL,*allocPages=NULL,*forcedPages=NULL; unsigned nNewPages=0; PIN **metaPINs=NULL; unsigned nInserted=0,nFT=0; unsigned *allocTab=NULL;
+	FTPipeline ftp(ctx);
 	for (i=0; i<nPins; i++) if ((pin=pins[i])!=NULL) {
 		pin->mode&=~COMMIT_MASK; if (pin->addr.defined()) continue;
 		if (((pin->mode|=mode&(PIN_NO_REPLICATION|PIN_HIDDEN))&PIN_NO_REPLICATION)!=0) pin->mode&=~PIN_REPLICATED;
@@ -194,7 +337,7 @@ RC QueryPrc::persistPINs(const EvalCtx& ectx,PIN *const *pins,unsigned nPins,uns
 			}
 			if (rc!=RC_OK) goto finish; if ((pin->mode&PIN_TRANSIENT)!=0) continue;
 		}
-		l=pin->length; cnt++; totalSize+=l+sizeof(PageOff); fUncommPINs=true;
+		l=pin->length; cnt++; totalSize+=l+sizeof(PageOff); fUncommPINs=true; if ((pin->mode&COMMIT_FTINDEX)!=0) nFT++;
 		if (pin->length>xSize || (pin->meta&PMT_DATAEVENT)==0 && (double)lBig/nBig>lOther*SKEW_FACTOR) {
 			CandidateSSVs cs((MemAlloc*)ectx.ses);
 			if ((rc=findCandidateSSVs(cs,pin->properties,pin->nProperties,pin->length>xSize,ectx.ses,actrl))!=RC_OK) goto finish;
@@ -216,6 +359,7 @@ RC QueryPrc::persistPINs(const EvalCtx& ectx,PIN *const *pins,unsigned nPins,uns
 	if (!fUncommPINs || (rc=tx.start(TXI_DEFAULT,TX_IATOMIC))!=RC_OK) goto finish;
 	if (nIndexed!=0 && ectx.ses->classLocked!=RW_NO_LOCK && ectx.ses->classLocked!=RW_X_LOCK) {rc=RC_DEADLOCK; goto finish;}	//???
 	xbuf=lmax+PageAddrSize; ectx.ses->lockClass(nIndexed>0?RW_X_LOCK:RW_S_LOCK);
+	if (nFT>=FTPARSE_MIN_PINS && (rc=ftp.start(pins,nPins,&mem))!=RC_OK) goto finish;
 	if ((allocTab=(unsigned*)mem.malloc(nPins*sizeof(unsigned)))==NULL || nMetaPINs!=0 && (metaPINs=(PIN**)mem.malloc(nMetaPINs*sizeof(PIN*)))==NULL)
 		{rc=RC_NOMEM; goto finish;}
 		
@@ -253,7 +397,7 @@ RC QueryPrc::persistPINs(const EvalCtx& ectx,PIN *const *pins,unsigned nPins,uns
 	}
 	if (pages!=NULL && pages->next==NULL) ectx.ses->setAtomic();
 	if (!fNewPgOnly && nNewPages>0) for (AllocPage **ppg=&pages,*pg; (pg=*ppg)!=0; ppg=&pg->next) if ((pg->flags&PGF_NEW)!=0) {
-		pb=ctx->heapMgr->getPartialPage(xSize-pg->spaceLeft); assert(pg->pid==INVALID_PAGEID);
+		pb=ctx->heapMgr->getPartialPage(xSize-pg->spaceLeft,ectx.ses); assert(pg->pid==INVALID_PAGEID);
 		if (!pb.isNull()) {
 			pb.set(QMGR_UFORCE); if (pg!=pages) {*ppg=pg->next; pg->next=pages; pages=pg;}
 			const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage *)pb->getPageBuf();
@@ -380,19 +524,24 @@ RC QueryPrc::persistPINs(const EvalCtx& ectx,PIN *const *pins,unsigned nPins,uns
 finish:
 	if (!pb.isNull()) {if (rc==RC_OK) {if (fForced) ectx.ses->forcedPage=pb->getPageID(); else ctx->heapMgr->reuse(pb,ectx.ses,reserve);} pb.release(ectx.ses);}
 
-	DetectedEvents clr(&mem,ctx);
+	DetectedEvents clr(&mem,ctx); IndexBatch ib(ectx.ses);
 	for (i=0; i<nPins; i++) if ((pin=pins[i])!=NULL) {
 		bool fProc = rc==RC_OK && (pin->mode&COMMIT_ALLOCATED)!=0; mem.mark(mrk);
 		if (fProc) {
 			if ((pin->mode&(PIN_TRANSIENT|PIN_DELETED))==0) {
 				if ((rc=ctx->classMgr->detect(pin,clr,ectx.ses))==RC_OK && into!=NULL) rc=clr.checkConstraints(pin,into,nInto);
-				if (rc==RC_OK && clr.ndevs>0 && (rc=ctx->classMgr->updateIndex(ectx.ses,pin,clr,CI_INSERT))==RC_OK)
-					if (clr.nActions!=0 && (pin->mode&COMMIT_INVOKED)==0 && (rc=clr.publish(ectx.ses,pin,CI_INSERT,&ectx))!=RC_OK) break;
+				if (rc==RC_OK && clr.ndevs>0) {
+					// actions may query indices: they must see all PINs inserted so far
+					const bool fPublish=clr.nActions!=0 && (pin->mode&COMMIT_INVOKED)==0;
+					if (fPublish && !ib.isEmpty()) rc=ib.flush();
+					if (rc==RC_OK && (rc=ctx->classMgr->updateIndex(ectx.ses,pin,clr,CI_INSERT,NULL,NULL,nPins>1&&!fPublish?&ib:(IndexBatch*)0))==RC_OK)
+						if (fPublish && (rc=clr.publish(ectx.ses,pin,CI_INSERT,&ectx))!=RC_OK) break;
+				}
 				if (rc==RC_OK && (pin->mode&(PIN_DELETED|PIN_HIDDEN|COMMIT_FTINDEX))==COMMIT_FTINDEX) {
-					const Value *doc=pin->findProperty(PROP_SPEC_DOCUMENT); StackAlloc sa(ectx.ses); FTList ftl(sa);
+					const Value *doc=pin->findProperty(PROP_SPEC_DOCUMENT); StackAlloc sa(ectx.ses); FTList ftl(sa),*pftl=NULL;
 					ChangeInfo inf={pin->id,doc==NULL?PIN::noPID:doc->type==VT_REF?doc->pin->getPID():
 							doc->type==VT_REFID?doc->id:PIN::noPID,NULL,NULL,STORE_INVALID_URIID,STORE_COLLECTION_ID};
-					for (unsigned k=0; k<pin->nProperties; ++k) {
+					if ((rc=ftp.get(i,pftl))==RC_OK && pftl==NULL) for (unsigned k=0; k<pin->nProperties; ++k) {
 						const Value& pv=pin->properties[k];
 						if ((pv.meta&META_PROP_FTINDEX)!=0) {	// VF_STRING???
 							inf.propID=pv.property; inf.newV=&pv;
@@ -400,7 +549,7 @@ finish:
 							if (rc!=RC_OK) break;
 						}
 					}
-					if (rc==RC_OK) rc=ctx->ftMgr->process(ftl,inf.id,inf.docID);
+					if (rc==RC_OK) rc=ctx->ftMgr->process(pftl!=NULL?*pftl:ftl,inf.id,inf.docID);
 				}
 			}
 			if (rc==RC_OK && (pin->mode&(PIN_DELETED|PIN_HIDDEN))==0) {
@@ -428,6 +577,7 @@ finish:
 		}
 		pin->mode&=~COMMIT_MASK; clr.ndevs=clr.nIndices=clr.notif=0; mem.truncate(TR_REL_ALL,&mrk); if (rc!=RC_OK) pin->addr=PageAddr::noAddr; else pin->mode|=PIN_PERSISTENT;
 	}
+	if (rc==RC_OK && !ib.isEmpty()) rc=ib.flush();
 	if (rc==RC_OK && metaPINs!=NULL && nMetaPINs>0 && (rc=ctx->classMgr->buildIndex(metaPINs,nMetaPINs,ectx.ses))==RC_OK) for (unsigned i=0; i<nMetaPINs; i++) try {
 		PIN *pin=metaPINs[i];
 		if ((pin->meta&PMT_LOADER)!=0) {
@@ -897,7 +1047,13 @@ RC QueryPrc::persistData(IStream *stream,const byte *str,size_t lstr,PageAddr& a
 	byte *buf; RC rc=RC_OK; Session *ses=Session::getSession();
 	if (ses==NULL) return RC_NOSESSION; if (!ses->inWriteTx()) return RC_READTX;
 	size_t xSize=HeapPageMgr::contentSize(ctx->bufMgr->getPageSize())-sizeof(PageOff);
-	size_t l=ceil(lstr,HP_ALIGN)+sizeof(HeapPageMgr::HeapObjHeader); bool fNew=true;
+	size_t l=ceil(lstr,HP_ALIGN)+sizeof(HeapPageMgr::HeapObjHeader); bool fNew=true; SHA256 sha; byte digest[SHA_DIGEST_BYTES];
+	const bool fDedup=(ctx->theCB->flags&STFLG_DEDUP)!=0 && lastAddr==NULL && lastPB==NULL && (stream!=NULL || lstr>=DEDUP_THRESHOLD);
+	if (fDedup && stream==NULL) {
+		sha.add(str,lstr); memcpy(digest,sha.result(),SHA_DIGEST_BYTES); PageAddr dup;
+		if ((rc=ctx->bigMgr->findDup(digest,dup,ses))==RC_OK) {addr=dup; len64=lstr; return l<=xSize?RC_OK:RC_TRUE;}
+		if (rc!=RC_NOTFOUND) return rc; rc=RC_OK;
+	}
 	if (lastAddr==NULL && l<=xSize) {
 		PBlockP pb(ctx->ssvMgr->getNewPage(l+sizeof(PageOff),ses,fNew),QMGR_UFORCE); if (pb.isNull()) return RC_FULL;
 		const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage *)pb->getPageBuf();
@@ -913,7 +1069,7 @@ RC QueryPrc::persistData(IStream *stream,const byte *str,size_t lstr,PageAddr& a
 			} catch (RC rc2) {rc=rc2;} catch (...) {rc=RC_INVPARAM;}
 			ses->free(buf);
 		}
-		if (rc==RC_OK) ctx->ssvMgr->reuse(pb,ses,fNew);
+		if (rc==RC_OK) {ctx->ssvMgr->reuse(pb,ses,fNew); if (fDedup && stream==NULL) rc=ctx->bigMgr->addDup(digest,addr,ses);}
 		return rc;
 	}
 	PBlockP pb(ctx->fsMgr->getNewPage(ctx->ssvMgr),QMGR_UFORCE);
@@ -932,7 +1088,7 @@ RC QueryPrc::persistData(IStream *stream,const byte *str,size_t lstr,PageAddr& a
 			} catch (RC rc2) {rc=rc2; break;} catch (...) {rc=RC_INVPARAM; break;} 
 			if (left>0 && stream!=NULL) try {size_t l=stream->read(p,left); left-=l; len64+=l;}
 			catch (RC rc2) {rc=rc2; break;} catch (...) {rc=RC_INVPARAM; break;}
-			hl->hdr.length=ushort(xSize-left); size_t lpiece=ceil(hl->hdr.length,HP_ALIGN);
+			hl->hdr.length=ushort(xSize-left); if (fDedup && stream!=NULL) sha.add((byte*)(hl+1),xSize-sizeof(HeapPageMgr::HeapLOB)-left); size_t lpiece=ceil(hl->hdr.length,HP_ALIGN);
 			PageIdx idx=hp->freeSlots!=0?hp->freeSlots>>1:hp->nSlots;
 			if (left!=0) {next=NULL; memcpy(hl->next,lastAddr!=NULL?lastAddr:&PageAddr::noAddr,PageAddrSize);}
 			else if ((next=ctx->ssvMgr->getNewPage(lpiece,ses,fNew))==NULL) {rc=RC_FULL; break;}
@@ -947,13 +1103,22 @@ RC QueryPrc::persistData(IStream *stream,const byte *str,size_t lstr,PageAddr& a
 		if (rc==RC_TRUE) {if (lastPB!=NULL) pb.moveTo(*lastPB); else ctx->ssvMgr->reuse(pb,ses,fNew);}
 		ses->free(buf);
 	}
+	if (rc==RC_TRUE && fDedup) {
+		RC rc2; PageAddr dup; pb.release(ses);
+		if (stream==NULL) rc2=ctx->bigMgr->addDup(digest,addr,ses);
+		else if (len64<DEDUP_THRESHOLD) rc2=RC_OK;
+		else if (memcpy(digest,sha.result(),SHA_DIGEST_BYTES),(rc2=ctx->bigMgr->findDup(digest,dup,ses))==RC_NOTFOUND) rc2=ctx->bigMgr->addDup(digest,addr,ses);
+		else if (rc2==RC_OK && (rc2=deleteData(addr,ses,NULL,false))==RC_OK) addr=dup;
+		if (rc2!=RC_OK) rc=rc2;
+	}
 	return rc;
 }
 
-RC QueryPrc::deleteData(const PageAddr& start,Session *ses,PBlockP *pbp)
+RC QueryPrc::deleteData(const PageAddr& start,Session *ses,PBlockP *pbp,bool fDedup)
 {
 	if (ses==NULL && (ses=Session::getSession())==NULL) return RC_NOSESSION;
 	PBlockP pb; PageAddr addr=start; RC rc=RC_OK;
+	if (fDedup && (ctx->theCB->flags&STFLG_DEDUP)!=0 && (rc=ctx->bigMgr->releaseDup(start,ses,pbp))!=RC_OK) return rc==RC_FALSE?RC_OK:rc;
 	do {
 		if (pbp!=NULL && !pbp->isNull()) {
 			if ((*pbp)->getPageID()!=addr.pageID) pbp->release(ses); else pbp->moveTo(pb);
@@ -25,6 +25,14 @@ Written by Mark Venguerov 2004-2014
 #include "session.h"
 #include "fsmgr.h"
 #include "lock.h"
+#include "queryprc.h"
+#include "request.h"
+#include "startup.h"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__arm__)
+#include "emmintrin.h"
+#define	MM_HV_SEARCH
+#endif
 
 using namespace Afy;
 using namespace AfyKernel;
@@ -33,7 +41,7 @@ const HType HType::compactRef={0,HDF_COMPACT<<6|VT_REFID};
 
 #define	PINOP_ERROR(a)	{assert(rc==RC_OK); rc=(a); nop=hpi->nops-nop-1; flags^=TXMGR_UNDO; continue;}
 
-HeapPageMgr::HeapPageMgr(StoreCtx *ctx,PGID pgid) : TxPage(ctx),freeSpace(ctx)
+HeapPageMgr::HeapPageMgr(StoreCtx *ctx,PGID pgid) : TxPage(ctx),freeSpace(ctx),fPunch(true)
 {
 	ctx->registerPageMgr(pgid,this);
 }
@@ -55,7 +63,9 @@ RC HeapPageMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_
 		report(MSG_ERROR,"Invalid HPOP %d in HeapPageMgr::update, page %08X\n",op0,hp->hdr.pageID);
 		return RC_CORRUPTED;
 	}
-	const static HPOP undoOP[HPOP_ALL]={HPOP_PURGE,HPOP_EDIT,HPOP_DELETE,HPOP_INSERT,HPOP_PINOP,HPOP_MIGRATE};
+	if (op0==HPOP_COMPACT) {if ((flags&TXMGR_UNDO)==0) hp->compact(); return RC_OK;}
+	if ((flags&(TXMGR_RECV|TXMGR_UNDO))==0 && hp->hdr.pgid==PGID_HEAP && op0!=HPOP_INSERT && op0!=HPOP_DELETE) ((PINPageMgr*)this)->churn();
+	const static HPOP undoOP[HPOP_ALL]={HPOP_PURGE,HPOP_EDIT,HPOP_DELETE,HPOP_INSERT,HPOP_PINOP,HPOP_MIGRATE,HPOP_COMPACT};
 	ushort op=(flags&TXMGR_UNDO)!=0?(ushort)undoOP[op0]:op0; const PageIdx *idxs=NULL; unsigned nObjs=1;
 	size_t lr=ceil(lrec,HP_ALIGN); PageOff off; HeapObjHeader *hdr;
 	switch (op) {
@@ -134,8 +144,10 @@ RC HeapPageMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_
 				if ((flags&TXMGR_UNDO)!=0) hdr->descr&=~HOH_DELETED; else hdr->descr|=HOH_DELETED;
 			} else {
 				if ((hdr->descr&HOH_MULTIPART)!=0 || off+hdr->getLength()!=hp->freeSpace) hp->scatteredFreeSpace+=hdr->getLength(); else hp->freeSpace=off;
-				if (op0!=HPOP_INSERT && (hdr->descr&HOH_TEMP_ID)==0 && hp->hdr.pgid!=PGID_SSV) (*hp)[ii]=0;
-				else if (ii+1==hp->nSlots) hp->nSlots--;
+				// the slot of a migrated image is not a PIN identity and is re-used; it is not truncated, so stale address hints stay in range
+				const bool fCopy=op0==HPOP_PURGE && hdr->getType()==HO_PIN && ((HeapPIN*)hdr)->isMigrated();
+				if (op0!=HPOP_INSERT && (hdr->descr&HOH_TEMP_ID)==0 && hp->hdr.pgid!=PGID_SSV && !fCopy) (*hp)[ii]=0;
+				else if (ii+1==hp->nSlots && !fCopy) hp->nSlots--;
 				else if (hp->freeSlots==0) {hp->freeSlots=ii<<1|1; (*hp)[ii]=0xFFFF;}
 				else if (ii>((unsigned)hp->freeSlots>>1)) {(*hp)[ii]=hp->freeSlots; hp->freeSlots=ii<<1|1;}
 				else for (PageIdx j=hp->freeSlots>>1,k;;j=k>>1)
@@ -165,12 +177,12 @@ RC HeapPageMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_
 		(*hp)[idx]=hp->freeSpace; hdr=(HeapObjHeader*)(frame+hp->freeSpace); hdr->descr=HO_FORWARD; hdr->length=sizeof(HeapObjHeader)+PageAddrSize;
 		hp->freeSpace+=sizeof(HeapObjHeader)+PageAddrSize; memcpy(hdr+1,rec+lrec-PageAddrSize,PageAddrSize); return RC_OK;
 	case HPOP_EDIT:
-		assert(lrec>=sizeof(HeapModEdit));
-		if (ht!=HO_SSVALUE && ht!=HO_BLOB && ht!=HO_FORWARD) {
+		assert(lrec>=sizeof(HeapModEdit)); hed=(const HeapModEdit*)rec;
+		if (ht!=HO_SSVALUE && ht!=HO_BLOB && ht!=HO_FORWARD && (ht!=HO_PIN || hed->newPtr.len!=hed->oldPtr.len)) {
 			report(MSG_ERROR,"Invalid object type %d in EDIT, slot: %d, page: %08X\n",ht,idx,hp->hdr.pageID);
 			return RC_CORRUPTED;
 		}
-		hed=(const HeapModEdit*)rec; newPtr=&hed->newPtr; oldPtr=&hed->oldPtr;
+		newPtr=&hed->newPtr; oldPtr=&hed->oldPtr;
 		if ((flags&TXMGR_UNDO)!=0) {const PagePtr *tmp=newPtr; newPtr=oldPtr; oldPtr=tmp;}
 		l=hdr->length-sizeof(HeapObjHeader); nl=newPtr->len; ol=oldPtr->len; delta=nl-ol;
 		if (hed->shift+ol>l || -delta>l) {
@@ -664,14 +676,76 @@ void HeapPageMgr::initPage(byte *frame,size_t len,PageID pid)
 
 bool PINPageMgr::afterIO(PBlock *pb,size_t lPage,bool fLoad)
 {
-	if (!TxPage::afterIO(pb,lPage,fLoad) || !((HeapPage*)pb->getPageBuf())->checkPage(false)) return false;
+	if (!HeapPageMgr::afterIO(pb,lPage,fLoad) || !((HeapPage*)pb->getPageBuf())->checkPage(false)) return false;
 	if (fLoad) pb->setVBlock(ctx->lockMgr->getVBlock(pb->getPageID()));
 	return true;
 }
 
+bool HeapPageMgr::afterIO(PBlock *pb,size_t lPage,bool fLoad)
+{
+	if (!TxPage::afterIO(pb,lPage,fLoad)) return false;
+	if ((((HeapPage*)pb->getPageBuf())->hdr.nPages&PGC_COMPRESSED)==0 || unpack(pb->getPageBuf(),lPage)) return true;
+	report(MSG_ERROR,"Cannot read page %08X: invalid compressed data\n",pb->getPageID());
+	return false;
+}
+
 bool HeapPageMgr::beforeFlush(byte *frame,size_t len,PageID pid)
 {
-	return ((HeapPage*)frame)->checkPage(true)?TxPage::beforeFlush(frame,len,pid):false;
+	if (!((HeapPage*)frame)->checkPage(true)) return false;
+	const size_t lc=(ctx->theCB->flags&STFLG_COMPRESSED)!=0?pack(frame,len):0;
+	if (!TxPage::beforeFlush(frame,len,pid)) {if (lc!=0) unpack(frame,len); return false;}
+	if (lc!=0 && ctx->getEncKey()!=NULL) {
+		// encrypted zeros must not be written to the part of the page to be released; it's ignored on read
+		const size_t from=ceil(sizeof(HeapPage)+lc,PGC_BLOCK); memset(frame+from,0,len-FOOTERSIZE-from);
+		if ((ctx->theCB->flags&STFLG_PAGEHMAC)!=0) {
+			HMAC hmac(ctx->getHMACKey(),HMAC_KEY_SIZE); hmac.add(frame,len-FOOTERSIZE);
+			memcpy(frame+len-FOOTERSIZE,hmac.result(),FOOTERSIZE);
+		}
+	}
+	return true;
+}
+
+void HeapPageMgr::afterWrite(PBlock *pb,size_t len,RC rc)
+{
+	byte *frame=pb->getPageBuf(); HeapPage *hp=(HeapPage*)frame;
+	if (ctx->getEncKey()!=NULL) TxPage::afterIO(pb,len,false);
+	if ((hp->hdr.nPages&PGC_COMPRESSED)!=0) {
+		if (rc==RC_OK && fPunch) {
+			const size_t from=ceil(sizeof(HeapPage)+(hp->hdr.nPages&~PGC_COMPRESSED),PGC_BLOCK),to=floor(len-FOOTERSIZE,PGC_BLOCK);
+			if (from<to) {
+				if (ctx->fileMgr->punchHole(FileIDFromPageID(pb->getPageID()),PageIDToOffset(pb->getPageID(),len)+from,to-from)==RC_OK) lPunched+=long(to-from);
+				else fPunch=false;
+			}
+		}
+		if (!unpack(frame,len)) report(MSG_ERROR,"Page %08X corrupt after write: cannot restore compressed data\n",pb->getPageID());
+	}
+}
+
+size_t HeapPageMgr::pack(byte *frame,size_t len)
+{
+	HeapPage *hp=(HeapPage*)frame; ++nFlushed; assert((hp->hdr.nPages&PGC_COMPRESSED)==0);
+	const size_t lslots=hp->nSlots*sizeof(PageOff),ldata=hp->freeSpace-sizeof(HeapPage),xlen=floor(len-FOOTERSIZE,PGC_BLOCK);
+	if (xlen<sizeof(HeapPage)+PGC_BLOCK+3) return 0;	// nothing to release
+	const size_t lmax=xlen-PGC_BLOCK-sizeof(HeapPage); byte *buf=(byte*)ctx->malloc(lmax); if (buf==NULL) return 0;
+	TIMESTAMP start,end; getTimestamp(start);
+	const size_t lA=lzPack(frame+sizeof(HeapPage),ldata,buf+2,lmax-2),lS=lA!=0?lzPack(frame+len-FOOTERSIZE-lslots,lslots,buf+2+lA,lmax-2-lA):0,lc=lS!=0?lA+lS+2:0;
+	if (lc!=0) {
+		buf[0]=byte(lA); buf[1]=byte(lA>>8);
+		memcpy(frame+sizeof(HeapPage),buf,lc); memset(frame+sizeof(HeapPage)+lc,0,len-FOOTERSIZE-sizeof(HeapPage)-lc);
+		hp->hdr.nPages=PGC_COMPRESSED|uint32_t(lc); ++nPacked;
+	}
+	ctx->free(buf); getTimestamp(end); tPack+=long(end-start); return lc;
+}
+
+bool HeapPageMgr::unpack(byte *frame,size_t len)
+{
+	HeapPage *hp=(HeapPage*)frame; const size_t lc=hp->hdr.nPages&~PGC_COMPRESSED,lslots=hp->nSlots*sizeof(PageOff);
+	if (lc<2 || sizeof(HeapPage)+lc>len-FOOTERSIZE || hp->freeSpace<sizeof(HeapPage) || hp->freeSpace+lslots>len-FOOTERSIZE) return false;
+	byte *buf=(byte*)ctx->malloc(lc); if (buf==NULL) return false;
+	TIMESTAMP start,end; getTimestamp(start); memcpy(buf,frame+sizeof(HeapPage),lc); const size_t lA=buf[0]|buf[1]<<8;
+	const bool fOK=lA+2<=lc && lzUnpack(buf+2,lA,frame+sizeof(HeapPage),hp->freeSpace-sizeof(HeapPage)) && lzUnpack(buf+2+lA,lc-2-lA,frame+len-FOOTERSIZE-lslots,lslots);
+	if (fOK) {memset(frame+hp->freeSpace,0,len-FOOTERSIZE-lslots-hp->freeSpace); hp->hdr.nPages=0;}
+	ctx->free(buf); getTimestamp(end); tUnpack+=long(end-start); return fOK;
 }
 
 PGID PINPageMgr::getPGID() const
@@ -783,6 +857,32 @@ bool HeapPageMgr::HeapPage::checkIdx(PageIdx idx) const
 	return true;
 }
 
+/**
+ * property or element lookup without insertion point
+ * small sorted tables and unordered collections are compared 4 entries at a time, larger sorted tables use branchless binary search
+ */
+const HeapPageMgr::HeapV *HeapPageMgr::HeapV::find(uint32_t id,const HeapV *arr,unsigned n,bool fOrd)
+{
+	if (arr==NULL || n==0) return NULL;
+#ifdef MM_HV_SEARCH
+	if (n<=HV_SEARCH_VEC || !fOrd) {
+		// id[0] holds the high half, so the first 32-bit lane of a HeapV is the ID rotated by 16 bits; odd lanes (offset, type) are masked out
+		const __m128i k=_mm_set1_epi32(int(id>>16|id<<16)); unsigned i=0;
+		for (; i+4<=n; i+=4) {
+			unsigned m=((unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(arr+i)),k)))&5)
+				|((unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(arr+i+2)),k)))&5)<<4;
+			if (m!=0) return &arr[i+(pop((m&-m)-1)>>1)];
+		}
+		for (; i<n; i++) if (arr[i].getID()==id) return &arr[i];
+		return NULL;
+	}
+#else
+	if (!fOrd) {for (unsigned i=n; i--!=0; ) if (arr[i].getID()==id) return &arr[i]; return NULL;}
+#endif
+	for (unsigned half; n>1; n-=half) {half=n>>1; arr=arr[half].getID()<=id?arr+half:arr;}
+	return arr->getID()==id?arr:NULL;
+}
+
 RC HeapPageMgr::HeapPIN::serialize(byte *&buf,size_t& lbuf,const HeapPageMgr::HeapPage *hp,MemAlloc *ma,size_t len,bool fExpand) const
 {
 	const bool fMultipart=fExpand||(hdr.descr&HOH_MULTIPART)!=0;
@@ -900,7 +1000,7 @@ PBlock *PINPageMgr::getNewPage(size_t size,size_t reserve,Session *ses)
 	if (ses->reuse.pinPages!=NULL && ses->reuse.nPINPages>0 && ses->reuse.pinPages[ses->reuse.nPINPages-1].space>=size+reserve)
 		return ctx->bufMgr->getPage(ses->reuse.pinPages[--ses->reuse.nPINPages].pid,ctx->heapMgr,PGCTL_XLOCK|PGCTL_RLATCH,NULL,ses);
 	PBlock *pb=NULL;
-	if ((freeSpace.getPage(size,pb,this)!=RC_OK || pb==NULL) &&							// reserve?
+	if ((freeSpace.getPage(size,pb,this,ses)!=RC_OK || pb==NULL) &&							// reserve?
 		(pb=ctx->fsMgr->getNewPage(this))!=NULL && (ses->addToHeap(pb->getPageID(),false))!=RC_OK) {pb->release(QMGR_UFORCE,ses); pb=NULL;}
 	return pb;
 }
@@ -912,7 +1012,7 @@ PBlock *SSVPageMgr::getNewPage(size_t size,Session *ses,bool& fNew)
 		{fNew=true; return ctx->bufMgr->getPage(ses->reuse.ssvPages[--ses->reuse.nSSVPages].pid,ctx->ssvMgr,PGCTL_XLOCK,NULL,ses);}
 	StoreCtx *ctx=ses->getStore();
 	size_t xSize=contentSize(ctx->bufMgr->getPageSize()); if (size>xSize) return NULL;
-	if (size<xSize) {PBlock *pb=NULL; if (freeSpace.getPage(size,pb,this)==RC_OK && pb!=NULL) return pb;}
+	if (size<xSize) {PBlock *pb=NULL; if (freeSpace.getPage(size,pb,this,NULL)==RC_OK && pb!=NULL) return pb;}
 	fNew=true; return ctx->fsMgr->getNewPage(this);
 }
 
@@ -1001,7 +1101,7 @@ void PINPageMgr::reuse(PBlock *pb,Session *ses,size_t reserve,bool fMod)
 {
 	PageID pid=pb->getPageID(); assert(ses!=NULL);
 	const HeapPage *hp=(const HeapPage*)pb->getPageBuf(); ushort spaceLeft=ushort(hp->totalFree()); 
-	if (!ses->tx.testHeap(pid)) freeSpace.set(ses->getStore(),pid,spaceLeft,spaceLeft>reserve);
+	if (!ses->tx.testHeap(pid)) {freeSpace.set(ses->getStore(),pid,spaceLeft,spaceLeft>reserve); if (!fMod && spaceLeft>reserve) ses->xHeapPage=pid;}
 	else if (spaceLeft>reserve) {
 		if (fMod && ses->reuse.nPINPages>0) {
 			for (TxReuse::ReusePage *pg=&ses->reuse.pinPages[ses->reuse.nPINPages]; --pg>=ses->reuse.pinPages;) if (pg->pid==pid) {
@@ -1024,6 +1124,97 @@ void PINPageMgr::reuse(PBlock *pb,Session *ses,size_t reserve,bool fMod)
 	}
 }
 
+namespace AfyKernel
+{
+class HeapCompactRQ : public Request
+{
+	StoreCtx	*const	ctx;
+	HeapCompactRQ(StoreCtx *ct) : ctx(ct) {}
+public:
+	void		process() {
+		PINPageMgr *mgr=ctx->heapMgr; HeapCompactReport rep; RC rc=mgr->compact(rep,Session::getSession());
+		if (rc!=RC_OK) report(MSG_WARNING,"Cannot compact heap pages (%d)\n",rc);
+		else if (rep.nCompacted+rep.nRelocated+rep.nReleased!=0)
+			report(MSG_INFO,"Heap compacted: %u of %u pages compacted, %u PINs relocated, %u pages released\n",rep.nCompacted,rep.nPages,rep.nRelocated,rep.nReleased);
+		mgr->fCompactRQ=0;
+	}
+	void		destroy() {StoreCtx *ct=ctx; this->~HeapCompactRQ(); ct->free(this);}
+	static	void	post(PINPageMgr& mgr) {
+		StoreCtx *ctx=mgr.ctx; void *p; HeapCompactRQ *rq;
+		if ((ctx->mode&STARTUP_RT)!=0 || (p=ctx->malloc(sizeof(HeapCompactRQ)))==NULL) mgr.fCompactRQ=0;
+		else if (!RequestQueue::postRequest(rq=new(p) HeapCompactRQ(ctx),ctx)) {rq->destroy(); mgr.fCompactRQ=0;}
+	}
+};
+};
+
+void PINPageMgr::churn()
+{
+	if (++nChurn>max((long)HCOMPACT_MIN_CHURN,long(lastPass.nPages)*HCOMPACT_CHURN_PER_PAGE) && cas(&fCompactRQ,0L,1L)) HeapCompactRQ::post(*this);
+}
+
+RC PINPageMgr::compact(HeapCompactReport& rep,Session *ses,unsigned budget)
+{
+	if (ses==NULL) return RC_NOSESSION; memset(&rep,0,sizeof(HeapCompactReport)); nChurn=0;
+	const size_t lPage=ctx->bufMgr->getPageSize(),xScattered=contentSize(lPage)*HCOMPACT_SCATTERED/100;
+	const bool fRelease=ctx->memory==NULL && (ctx->mode&STARTUP_NO_RECOVERY)==0;
+	PageID *pids=(PageID*)ses->malloc(HeapDirMgr::contentSize(lPage)); if (pids==NULL) return RC_NOMEM;
+	PBlockP pb; unsigned nIO=0; RC rc=RC_OK;
+	for (PageID dirPID=ctx->theCB->getRoot(MA_HEAPDIRFIRST),next; dirPID!=INVALID_PAGEID && !ctx->inShutdown(); dirPID=next) {
+		// directory entries are copied: no directory latch is held while heap pages are processed
+		if (pb.getPage(dirPID,ctx->hdirMgr,QMGR_SCAN,ses)==NULL) {rc=RC_CORRUPTED; break;}
+		const HeapDirMgr::HeapDirPage *hd=(const HeapDirMgr::HeapDirPage*)pb->getPageBuf(); const unsigned nPages=hd->nSlots;
+		next=hd->next; memcpy(pids,hd+1,nPages*sizeof(PageID)); pb.release(ses); nIO++;
+		for (unsigned i=0; i<nPages && !ctx->inShutdown(); i++) if (pids[i]!=INVALID_PAGEID) {
+			if (nIO>=budget) {threadSleep(HCOMPACT_PAUSE); nIO=0;}
+			// pages latched by other sessions are skipped until the next pass
+			if (pb.getPage(pids[i],this,PGCTL_XLOCK|QMGR_TRY|QMGR_SCAN,ses)==NULL) continue;
+			const HeapPage *hp=(const HeapPage*)pb->getPageBuf(); PageAddr fwd[HCOMPACT_RELOCATE]; unsigned nFwd=0,nFree=0; bool fMulti=false;
+			nIO++; rep.nPages++; rep.lScattered+=hp->scatteredFreeSpace;
+			for (PageIdx idx=0; idx<hp->nSlots; idx++) {
+				const PageOff off=(*hp)[idx]; const HeapObjHeader *hobj=hp->getObject(off);
+				if (hobj==NULL) {if ((off&1)!=0) nFree++;}
+				else if ((hobj->descr&HOH_MULTIPART)!=0) {rep.nMultipart++; fMulti=true;}
+				else if (hobj->getType()==HO_FORWARD && (hobj->descr&HOH_DELETED)==0)
+					{rep.nForwarded++; if (nFwd<HCOMPACT_RELOCATE) {fwd[nFwd].pageID=pids[i]; fwd[nFwd++].idx=idx;}}
+			}
+			// a page holding only re-usable slots is released once no active transaction can roll back into it and its image is on disk
+			if (fRelease && nFree==hp->nSlots && !pb->isDirty() && getLSN((const byte*)hp,lPage)<ctx->txMgr->getOldestLSN()) {
+				pb.release(ses); if (dropPage(dirPID,i,pids[i],ses)==RC_OK) rep.nReleased++; nIO+=2; continue;
+			}
+			if (hp->scatteredFreeSpace!=0 && (hp->scatteredFreeSpace>xScattered || fMulti)) {
+				const uint16_t lsc=hp->scatteredFreeSpace;
+				if (ctx->txMgr->update(pb,this,HPOP_COMPACT,(byte*)&lsc,sizeof(lsc))==RC_OK) {rep.nCompacted++; rep.lReclaimed+=lsc;}
+			}
+			pb.release(ses);
+			for (unsigned j=0; j<nFwd && !ctx->inShutdown(); j++, nIO+=2) if (ctx->queryMgr->relocatePIN(ses,fwd[j])==RC_OK) rep.nRelocated++;
+		}
+	}
+	pb.release(ses); ses->free(pids); lastPass=rep; ++nPasses;
+	nCompacted+=rep.nCompacted; nRelocated+=rep.nRelocated; nReleased+=rep.nReleased; lReclaimed+=long(rep.lReclaimed);
+	return rc;
+}
+
+RC PINPageMgr::dropPage(PageID dirPID,unsigned dirIdx,PageID pid,Session *ses)
+{
+	MiniTx mtx(ses); PBlockP dpb,pb; RC rc;
+	if (dpb.getPage(dirPID,ctx->hdirMgr,PGCTL_XLOCK,ses)==NULL) return RC_NOTFOUND;
+	const HeapDirMgr::HeapDirPage *hd=(const HeapDirMgr::HeapDirPage*)dpb->getPageBuf();
+	if (dirIdx>=hd->nSlots || ((const PageID*)(hd+1))[dirIdx]!=pid || pb.getPage(pid,this,PGCTL_XLOCK|QMGR_TRY,ses)==NULL) return RC_FALSE;
+	const HeapPage *hp=(const HeapPage*)pb->getPageBuf();
+	for (PageIdx idx=0; idx<hp->nSlots; idx++) if (((*hp)[idx]&1)==0) return RC_FALSE;
+	if (pb->isDirty() || getLSN((const byte*)hp,ctx->bufMgr->getPageSize())>=ctx->txMgr->getOldestLSN()) return RC_FALSE;
+	HeapDirMgr::HeapDirDrop dd={dirIdx,pid}; freeSpace.set(ctx,pid,0,false);
+	if ((rc=ctx->txMgr->update(dpb,ctx->hdirMgr,HDU_DROP,(byte*)&dd,sizeof(dd)))!=RC_OK) return rc;
+	pb.set(PGCTL_DISCARD); pb.release(ses); ctx->logMgr->insert(ses,LR_DISCARD,PGID_HEAP,pid); ctx->fsMgr->freePage(pid);
+	mtx.ok(); return RC_OK;
+}
+
+void PINPageMgr::reportCompaction() const
+{
+	if (nPasses!=0) report(MSG_INFO,"\tHeap compaction: %ld passes, %ld pages compacted (%ld bytes), %ld PINs relocated, %ld pages released; last pass: %u pages, %lu bytes scattered, %u multi-part, %u forwarded\n",
+		(long)nPasses,(long)nCompacted,(long)lReclaimed,(long)nRelocated,(long)nReleased,lastPass.nPages,(unsigned long)lastPass.lScattered,lastPass.nMultipart,lastPass.nForwarded);
+}
+
 void SSVPageMgr::reuse(PBlockP &pb,Session *ses,bool fNew,bool fInsert)
 {
 	PageID pid=pb->getPageID(); assert(ses!=NULL); StoreCtx *ctx=ses->getStore();
@@ -1058,80 +1249,109 @@ void HeapPageMgr::discardPage(PageID pid,Session *ses)
 	assert(ses!=NULL); freeSpace.set(ctx,pid,0,false);
 }
 
-RC HeapPageMgr::HeapSpace::set(StoreCtx *ctx,PageID pid,size_t size,bool fAdd)
+#define	SHARD_TAB_SIZE	(SPACE_TAB_SIZE/SPACE_SHARDS)
+
+RC HeapPageMgr::HeapSpace::Shard::set(StoreCtx *ctx,PageID pid,size_t size,bool fAdd)
 {
-	MutexP lck(&lock); HeapPageSpace *hps=spaceTab.find(pid); unsigned idx;
+	MutexP lck(&lock); const size_t xSpace=contentSize(ctx->bufMgr->getPageSize()); HeapPageSpace *hps=spaceTab.find(pid);
 	if (hps!=NULL) {
 		if (hps->space==size && fAdd) return RC_OK;
-		if (pageTab!=NULL && (idx=find(hps))<nPages && pageTab[idx]==hps && idx<--nPages) 
-			memmove(&pageTab[idx],&pageTab[idx+1],(nPages-idx)*sizeof(HeapPageSpace*));
+		unlink(hps,xSpace); if (!fAdd) {spaceTab.remove(hps,true); return RC_OK;}
+		hps->space=size;
+	} else if (!fAdd) return RC_OK;
+	else {
+		if (nPages>=SHARD_TAB_SIZE) {
+			// full: evict a page from the lowest size class unless the new one is not larger
+			unsigned lb=pop((bmap&(0u-bmap))-1); HeapPageSpace *old=buckets[lb].getLast(); assert(bmap!=0 && old!=NULL);
+			if (size<=old->space) return RC_OK; unlink(old,xSpace); spaceTab.remove(old,true);
+		}
+		if ((hps=new(ctx) HeapPageSpace(pid,size))==NULL) return RC_NOMEM;
+		spaceTab.insert(hps);
 	}
-	if (!fAdd || nPages>=SPACE_TAB_SIZE && size<=pageTab[nPages-1]->space) 
-		{if (hps!=NULL) spaceTab.remove(hps,true); return RC_OK;}
-	if (hps!=NULL) hps->space=size;
-	else if ((hps=new(ctx) HeapPageSpace(pid,size))==NULL) return RC_NOMEM;
-	else {spaceTab.insert(hps); if (nPages>=SPACE_TAB_SIZE) spaceTab.remove(pageTab[--nPages],true);}
-	if (pageTab!=NULL) idx=find(hps);
-	else if ((pageTab=new(ctx) HeapPageSpace*[SPACE_TAB_SIZE])==NULL) return RC_NOMEM;
-	else idx=0;
-	assert(idx<=nPages && nPages<SPACE_TAB_SIZE);
-	if (idx<nPages) memmove(&pageTab[idx+1],&pageTab[idx],(nPages-idx)*sizeof(HeapPageSpace*));
-	pageTab[idx]=hps; nPages++;
-	return RC_OK;
+	link(hps,xSpace); return RC_OK;
 }
 
-RC HeapPageMgr::HeapSpace::getPage(size_t size,PBlock*& pb,HeapPageMgr *mgr)
+bool HeapPageMgr::HeapSpace::Shard::tryPage(HeapPageSpace *hps,size_t size,PBlock*& pb,HeapPageMgr *mgr,size_t xSpace)
 {
-	MutexP lck(&lock);
-	if (nPages==0 || pageTab==NULL || pageTab[0]->space<size) pb=NULL;
-	else {
-		unsigned midx=0;
-		if (pageTab[nPages-1]->space>=size) midx=nPages;
-		else for (unsigned n=nPages; n>0; ) {unsigned k=n>>1; if (pageTab[midx+k]->space<size) n=k; else {midx+=k+1; n-=k+1;}}
-		for (int i=0; midx>0 && i<SPACE_PAGE_TRIES; i++) {
-			unsigned idx=rand()%midx; HeapPageSpace *hps=pageTab[idx];
-			pb=mgr->ctx->bufMgr->getPage(hps->pageID,mgr,PGCTL_ULOCK|QMGR_TRY|QMGR_UFORCE,pb);
-			if (pb!=NULL) {
-				const HeapPage *hp=(const HeapPage*)pb->getPageBuf();
-				if (idx<--nPages) memmove(&pageTab[idx],&pageTab[idx+1],(nPages-idx)*sizeof(HeapPageSpace*));
-				if ((hps->space=hp->totalFree())>=size) {spaceTab.remove(hps,true); return RC_OK;}
-				idx=find(hps); assert(idx<=nPages && nPages<SPACE_TAB_SIZE);
-				if (idx<nPages) memmove(&pageTab[idx+1],&pageTab[idx],(nPages-idx)*sizeof(HeapPageSpace*));
-				pageTab[idx]=hps; nPages++; midx--;
-			}
-		}
-		if (pb!=NULL) {pb->release(QMGR_UFORCE); pb=NULL;}
+	if ((pb=mgr->ctx->bufMgr->getPage(hps->pageID,mgr,PGCTL_ULOCK|QMGR_TRY|QMGR_UFORCE,pb))==NULL) return false;
+	unlink(hps,xSpace); if ((hps->space=((const HeapPage*)pb->getPageBuf())->totalFree())>=size) {spaceTab.remove(hps,true); return true;}
+	link(hps,xSpace); return false;
+}
+
+bool HeapPageMgr::HeapSpace::Shard::getPage(size_t size,PBlock*& pb,HeapPageMgr *mgr,PageID hint)
+{
+	MutexP lck(&lock); if (bmap==0) return false;
+	const size_t xSpace=contentSize(mgr->ctx->bufMgr->getPageSize()); HeapPageSpace *hps; bool fOK=false;
+	if (hint!=INVALID_PAGEID) {
+		// the page this session inserted into last, no other inserter is expected to hold it
+		if ((hps=spaceTab.find(hint))!=NULL && hps->space>=size) fOK=tryPage(hps,size,pb,mgr,xSpace);
+	} else {
+		// pages in the size class of 'size' are checked one by one, any page in a higher class fits; the lowest such class is taken first
+		unsigned b=bucket(size,xSpace),nTries=0;
+		for (HChain<HeapPageSpace>::it_r it(&buckets[b]); !fOK && nTries<SPACE_PAGE_TRIES && ++it; )
+			if ((hps=it.get())->space>=size) {nTries++; fOK=tryPage(hps,size,pb,mgr,xSpace);}
+		for (uint32_t m=b+1<SPACE_BUCKETS?bmap&~0u<<(b+1):0; !fOK && m!=0 && nTries<SPACE_PAGE_TRIES; m&=m-1)
+			for (HChain<HeapPageSpace>::it_r it(&buckets[pop((m&(0u-m))-1)]); !fOK && nTries<SPACE_PAGE_TRIES && ++it; )
+				{nTries++; fOK=tryPage(it.get(),size,pb,mgr,xSpace);}
 	}
+	if (!fOK && pb!=NULL) {pb->release(QMGR_UFORCE); pb=NULL;}
+	return fOK;
+}
+
+RC HeapPageMgr::HeapSpace::getPage(size_t size,PBlock*& pb,HeapPageMgr *mgr,Session *ses)
+{
+	// concurrent inserters start from different shards and first retry the page they inserted into last
+	PageID hint=ses!=NULL?ses->xHeapPage:INVALID_PAGEID; Shard *sh; pb=NULL;
+	if (hint!=INVALID_PAGEID && (sh=shards[hint%SPACE_SHARDS])!=NULL && sh->getPage(size,pb,mgr,hint)) return RC_OK;
+	unsigned home=unsigned(uint64_t((uintptr_t)ses)*0x9E3779B97F4A7C15ULL>>32)%SPACE_SHARDS;
+	for (unsigned i=0; i<SPACE_SHARDS; i++) if ((sh=shards[(home+i)%SPACE_SHARDS])!=NULL && sh->getPage(size,pb,mgr,INVALID_PAGEID)) return RC_OK;
 	return RC_FALSE;
 }
 
-void HeapPageMgr::initPartial()
+void HeapPageMgr::initPartial(HeapPageMgr *mgr1,HeapPageMgr *mgr2)
 {
-	if (ctx->theCB->nPartials>SPACE_TAB_SIZE) return;
-	MutexP lck(&freeSpace.lock); PGID pgid=getPGID();
-	for (unsigned i=0; i<ctx->theCB->nPartials; i++) {
-		const PartialInfo &pi=ctx->theCB->partials[i];
-		if (pi.pageType==pgid) {
-			HeapSpace::HeapPageSpace *hps=new(ctx) HeapSpace::HeapPageSpace(pi.pageID,pi.spaceLeft); if (hps==NULL) break;
-			if (freeSpace.nPages>=SPACE_TAB_SIZE) continue;
-			if (freeSpace.pageTab==NULL && (freeSpace.pageTab=new(ctx) HeapSpace::HeapPageSpace*[SPACE_TAB_SIZE])==NULL) break;
-			freeSpace.spaceTab.insert(hps); unsigned idx=freeSpace.find(hps);
-			assert(idx<=freeSpace.nPages && freeSpace.nPages<SPACE_TAB_SIZE);
-			if (idx<freeSpace.nPages) memmove(&freeSpace.pageTab[idx+1],&freeSpace.pageTab[idx],(freeSpace.nPages-idx)*sizeof(HeapSpace::HeapPageSpace*));
-			freeSpace.pageTab[idx]=hps; freeSpace.nPages++;
-		}
+	StoreCtx *ctx=mgr1->ctx; PartialInfo *pis=NULL; unsigned nPis=0; bool fMap=false;
+	if (ctx->theCB->getRoot(MA_FREESPACE)!=INVALID_PAGEID && ctx->fsMgr->loadFreeSpace(pis,nPis,ctx)==RC_OK) fMap=true;
+	else if (ctx->theCB->nPartials<=SPACE_TAB_SIZE) {pis=ctx->theCB->partials; nPis=ctx->theCB->nPartials;}
+	for (unsigned i=0; i<nPis; i++) {
+		const PartialInfo &pi=pis[i]; HeapPageMgr *mgr=pi.pageType==mgr1->getPGID()?mgr1:pi.pageType==mgr2->getPGID()?mgr2:(HeapPageMgr*)0;
+		if (mgr!=NULL && pi.pageID!=INVALID_PAGEID && mgr->freeSpace.set(ctx,pi.pageID,pi.spaceLeft)!=RC_OK) break;
 	}
+	if (fMap && pis!=NULL) ctx->free(pis);
+}
+
+static int __cdecl cmpPartial(const void *p1,const void *p2)
+{
+	return cmp3(((const PartialInfo*)p2)->spaceLeft,((const PartialInfo*)p1)->spaceLeft);
 }
 
 void HeapPageMgr::savePartial(HeapPageMgr *mgr1,HeapPageMgr *mgr2)
 {
-	MutexP lck(&mgr1->freeSpace.lock); uint32_t cnt=0; uint16_t pt;
-	for (unsigned i=0,j=0; cnt<uint32_t(sizeof(mgr1->ctx->theCB->partials)/sizeof(mgr1->ctx->theCB->partials[0])) && (i<mgr1->freeSpace.nPages||j<mgr2->freeSpace.nPages); cnt++) {
-		const HeapSpace::HeapPageSpace *hps=i<mgr1->freeSpace.nPages && (j>=mgr2->freeSpace.nPages||mgr1->freeSpace.pageTab[i]->space>=mgr2->freeSpace.pageTab[j]->space)?
-			(pt=mgr1->getPGID(),mgr1->freeSpace.pageTab[i++]):(pt=mgr2->getPGID(),mgr2->freeSpace.pageTab[j++]);
-		PartialInfo &pi=mgr1->ctx->theCB->partials[cnt]; pi.pageID=hps->pageID; pi.spaceLeft=(uint16_t)hps->space; pi.pageType=pt;
+	StoreCtx *ctx=mgr1->ctx; unsigned cnt=0,xPartials=unsigned(sizeof(ctx->theCB->partials)/sizeof(ctx->theCB->partials[0]));
+	PartialInfo *pis=(PartialInfo*)ctx->malloc(SPACE_TAB_SIZE*2*sizeof(PartialInfo)); if (pis==NULL) {ctx->theCB->nPartials=0; return;}
+	for (HeapPageMgr *mgr=mgr1; mgr!=NULL; mgr=mgr==mgr1?mgr2:(HeapPageMgr*)0) {
+		const uint16_t pt=(uint16_t)mgr->getPGID();
+		for (unsigned i=0; i<SPACE_SHARDS; i++) if (mgr->freeSpace.shards[i]!=NULL) {
+			HeapSpace::Shard *sh=mgr->freeSpace.shards[i]; MutexP lck(&sh->lock);
+			for (unsigned b=SPACE_BUCKETS; b--!=0; ) for (HChain<HeapSpace::HeapPageSpace>::it it(&sh->buckets[b]); cnt<SPACE_TAB_SIZE*2 && ++it; )
+				{PartialInfo &pi=pis[cnt++]; pi.pageID=it.get()->pageID; pi.spaceLeft=(uint16_t)it.get()->space; pi.pageType=pt;}
+		}
+	}
+	if (cnt>1) qsort(pis,cnt,sizeof(PartialInfo),cmpPartial);
+	if (ctx->theCB->state==SST_SHUTDOWN_IN_PROGRESS) {
+		Session *ses=Session::createSession(ctx);
+		if (ses!=NULL) {RC rc=ctx->fsMgr->saveFreeSpace(pis,cnt); if (rc!=RC_OK) report(MSG_WARNING,"Cannot save free space map (%d)\n",rc); Session::terminateSession();}
+	}
+	if (cnt>xPartials) cnt=xPartials; memcpy(ctx->theCB->partials,pis,cnt*sizeof(PartialInfo)); ctx->theCB->nPartials=cnt; ctx->free(pis);
+}
+
+void HeapPageMgr::reportCompression(HeapPageMgr *mgr1,HeapPageMgr *mgr2)
+{
+	for (HeapPageMgr *mgr=mgr1; mgr!=NULL; mgr=mgr==mgr1?mgr2:(HeapPageMgr*)0) if (mgr->nFlushed!=0) {
+		const double lWritten=double(mgr->nFlushed)*mgr->ctx->theCB->lPage;
+		report(MSG_INFO,"\t%s page compression: %ld of %ld pages compressed, on-disk ratio %.2f, compress %ldus, decompress %ldus\n",mgr->getPGID()==PGID_SSV?"SSV":"Heap",
+			(long)mgr->nPacked,(long)mgr->nFlushed,lWritten/(lWritten-double(mgr->lPunched)),(long)mgr->tPack,(long)mgr->tUnpack);
 	}
-	mgr1->ctx->theCB->nPartials=cnt;
 }
 
 //---------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1183,6 +1403,13 @@ RC HeapDirMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_t
 			hp->nSlots+=hd->nHeapPages;
 		}
 		break;
+	case HDU_DROP:
+		// released heap pages leave a tombstone in the directory: slot positions of other pages don't change
+		{const HeapDirDrop *dd=(const HeapDirDrop*)rec; PageID *ids=(PageID*)(hp+1);
+		if (lrec!=sizeof(HeapDirDrop) || dd->idx>=hp->nSlots) return RC_CORRUPTED;
+		if ((flags&TXMGR_UNDO)!=0) {if (ids[dd->idx]!=INVALID_PAGEID) return RC_CORRUPTED; ids[dd->idx]=dd->pageID;}
+		else if (ids[dd->idx]!=dd->pageID) return RC_CORRUPTED; else ids[dd->idx]=INVALID_PAGEID;}
+		break;
 	}
 	return RC_OK;
 }
@@ -1220,12 +1447,14 @@ RC HeapDirMgr::getReserved(uint32_t& nPages,PageID& nextDirPage,byte *&buf,size_
 		if (nextDirPage==INVALID_PAGEID) return RC_EOF;
 		if ((pb=ctx->bufMgr->getPage(nextDirPage,this,0,pb))==NULL) return RC_EOF;	//???
 		HeapDirPage *hd=(HeapDirPage*)pb->getPageBuf(); nextDirPage=hd->next; 
-		if ((nPages=hd->nSlots)!=0) {
+		if (hd->nSlots!=0) {
 			if (lbuf<hd->nSlots*sizeof(PageID)) {
 				if ((buf=(byte*)ma->realloc(buf,hd->nSlots*sizeof(PageID),lbuf))==NULL) {pb->release(); return RC_NOMEM;}
 				lbuf=hd->nSlots*sizeof(PageID);
 			}
-			memcpy(buf,hd+1,hd->nSlots*sizeof(PageID)); pb->release(); return RC_OK;
+			const PageID *ids=(const PageID*)(hd+1); nPages=0;
+			for (unsigned i=0; i<hd->nSlots; i++) if (ids[i]!=INVALID_PAGEID) ((PageID*)buf)[nPages++]=ids[i];
+			if (nPages!=0) {pb->release(); return RC_OK;}
 		}
 	}
 }
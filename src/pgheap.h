@@ -33,13 +33,27 @@ Written by Mark Venguerov 2004-2014
 #define SPACE_HASH_SIZE		512
 #define	SPACE_TAB_SIZE		4096
 #define	SPACE_PAGE_TRIES	8
+#define	SPACE_SHARDS		16
+#define	SPACE_BUCKETS		32
 #define	SPACE_OVERSHOOT		0x0100
 
 #define	HP_ALIGN			2
 
+#define	HV_SEARCH_VEC		16			/**< sorted property tables up to this size are searched with vector comparison */
+
 #define	HPOP_MASK			0x000F
 #define	HPOP_SHIFT			4
 
+/**
+ * background heap compaction parameters
+ */
+#define	HCOMPACT_MIN_CHURN		0x1000		/**< minimal number of heap page updates before a compaction pass is posted */
+#define	HCOMPACT_CHURN_PER_PAGE	8			/**< ... or this number per heap page visited by the previous pass */
+#define	HCOMPACT_SCATTERED		25			/**< pages with more scattered free space than this percentage of a page are compacted */
+#define	HCOMPACT_RELOCATE		16			/**< maximum number of forwarded PINs moved back to their home pages per visited page */
+#define	HCOMPACT_IO_BUDGET		128			/**< number of page accesses between pauses */
+#define	HCOMPACT_PAUSE			20			/**< pause in milliseconds */
+
 #define HOH_TYPEMASK		0x0003
 
 #define	HOH_COMPOUND		0x0010		// PIN has compound properties (i.e. VT_COLLECTION, VT_MAP, VT_STRUCT)
@@ -71,7 +85,7 @@ namespace AfyKernel
 {
 
 enum HeapObjType	{HO_PIN,HO_BLOB,HO_SSVALUE,HO_FORWARD,HO_ALL};
-enum HPOP			{HPOP_INSERT,HPOP_EDIT,HPOP_DELETE,HPOP_PURGE,HPOP_PINOP,HPOP_MIGRATE,HPOP_ALL};
+enum HPOP			{HPOP_INSERT,HPOP_EDIT,HPOP_DELETE,HPOP_PURGE,HPOP_PINOP,HPOP_MIGRATE,HPOP_COMPACT,HPOP_ALL};
 enum HeapDataFmt	{HDF_COMPACT,HDF_SHORT,HDF_NORMAL,HDF_LONG};
 
 struct HType
@@ -136,6 +150,7 @@ protected:
 	friend	class	FullScan;
 	friend	class	Session;
 	friend	class	TransOp;
+	friend	class	DataEventMgr;
 #pragma pack(2)
 	struct HeapObjHeader {
 		uint16_t		descr;
@@ -151,6 +166,7 @@ protected:
 		void			setID(uint32_t ii) {id[0]=ushort(ii>>16); id[1]=ushort(ii);}
 		PropertyID		getPropID() const {return PropertyID((uint32_t)id[0]<<16|id[1]);}
 		class HVCmp {public: __forceinline static int cmp(const HeapV& hv,PropertyID pid) {return cmp3((uint32_t)hv.id[0]<<16|hv.id[1],pid);}};
+		static	const	HeapV	*find(uint32_t id,const HeapV *arr,unsigned n,bool fOrd=true);
 	};
 	struct HeapKey {
 		uint16_t		key[2];
@@ -162,12 +178,10 @@ protected:
 		uint16_t		fUnord	:1;
 		HeapV			start[1];
 		ushort			length(bool fA) const {return (ushort)(sizeof(HeapVV)+(cnt-1)*sizeof(HeapV)+(fA?sizeof(HeapKey):0));}
-		const	HeapV	*find(uint32_t id,HeapV **ins=NULL) const {return BIN<HeapV,PropertyID,HeapV::HVCmp>::find(id,start,cnt,ins);}
+		const	HeapV	*find(uint32_t id,HeapV **ins=NULL) const {return ins==NULL?HeapV::find(id,start,cnt):BIN<HeapV,PropertyID,HeapV::HVCmp>::find(id,start,cnt,ins);}
 		const	HeapV	*findElt(uint32_t id) const {
 			if (id==STORE_FIRST_ELEMENT) return start; else if (id==STORE_LAST_ELEMENT) return &start[cnt-1];
-			if (fUnord==0) return BIN<HeapV,PropertyID,HeapV::HVCmp>::find(id,start,cnt);
-			for (int i=cnt; --i>=0; ) if (start[i].getID()==id) return &start[i];
-			return NULL;
+			return HeapV::find(id,start,cnt,fUnord==0);
 		}
 		HeapKey	*getHKey() const {return (HeapKey*)((HeapV*)(this+1)+cnt-1);}
 	};
@@ -256,7 +270,7 @@ protected:
 		uint16_t		meta		:14;
 		ushort			headerLength() const {return sizeof(HeapPIN)+nProps*sizeof(HeapV)+refLength[fmtExtra];}
 		HeapV			*getPropTab() const {return (HeapV*)(this+1);}
-		const HeapV		*findProperty(uint32_t propID,HeapV **ins=NULL) const {return BIN<HeapV,PropertyID,HeapV::HVCmp>::find(propID,(HeapV*)(this+1),nProps,ins);}
+		const HeapV		*findProperty(uint32_t propID,HeapV **ins=NULL) const {return ins==NULL?HeapV::find(propID,(HeapV*)(this+1),nProps):BIN<HeapV,PropertyID,HeapV::HVCmp>::find(propID,(HeapV*)(this+1),nProps,ins);}
 		RC				serialize(byte *&buf,size_t& lrec,const HeapPage *hp,MemAlloc *ma,size_t len=0,bool fExpand=false) const;
 		PageAddr		*getOrigLoc() const {return (PageAddr*)((byte*)(this+1)+nProps*sizeof(HeapV));}
 		void			setOrigLoc(const PageAddr& addr) {assert(fmtExtra<=HDF_SHORT); memcpy((byte*)(this+1)+nProps*sizeof(HeapV),&addr,PageAddrSize); fmtExtra=HDF_SHORT;}
@@ -300,32 +314,41 @@ protected:
 	class HeapSpace {
 		struct HeapPageSpace {
 			HChain<HeapPageSpace>	list;
+			HChain<HeapPageSpace>	blist;
 			PageID					pageID;
 			size_t					space;
-			HeapPageSpace(PageID pid,size_t l) : list(this),pageID(pid),space(l) {} 
+			HeapPageSpace(PageID pid,size_t l) : list(this),blist(this),pageID(pid),space(l) {} 
 			PageID	getKey() const {return pageID;}
 			void	*operator new(size_t s,StoreCtx *ctx) throw() {return ctx->malloc(s);}
 			void	operator delete(void *p) {free(p,STORE_HEAP);}
 		};
-		HashTab<HeapPageSpace,PageID,&HeapPageSpace::list>	spaceTab;
-		HeapPageSpace										**pageTab;
-		unsigned											nPages;
-		Mutex												lock;
+		struct Shard {
+			HashTab<HeapPageSpace,PageID,&HeapPageSpace::list>	spaceTab;
+			HChain<HeapPageSpace>								buckets[SPACE_BUCKETS];		/**< pages by size class, buckets[i] holds pages with i/SPACE_BUCKETS of page content free */
+			uint32_t											bmap;						/**< bit i is set when buckets[i] is not empty */
+			unsigned											nPages;
+			Mutex												lock;
+			Shard(MemAlloc *ma) : spaceTab(SPACE_HASH_SIZE/SPACE_SHARDS,ma),bmap(0),nPages(0) {}
+			RC			set(StoreCtx *ctx,PageID,size_t,bool fAdd);
+			bool		getPage(size_t size,class PBlock*& pb,HeapPageMgr *mgr,PageID hint);
+			bool		tryPage(HeapPageSpace *hps,size_t size,class PBlock*& pb,HeapPageMgr *mgr,size_t xSpace);
+			void		link(HeapPageSpace *hps,size_t xSpace) {unsigned b=bucket(hps->space,xSpace); buckets[b].insertFirst(&hps->blist); bmap|=1u<<b; nPages++;}
+			void		unlink(HeapPageSpace *hps,size_t xSpace) {unsigned b=bucket(hps->space,xSpace); hps->blist.remove(); if (!buckets[b].isInList()) bmap&=~(1u<<b); nPages--;}
+		};
+		static	unsigned	bucket(size_t space,size_t xSpace) {size_t b=space*SPACE_BUCKETS/(xSpace+1); return b<SPACE_BUCKETS?unsigned(b):SPACE_BUCKETS-1;}
+		Shard	*shards[SPACE_SHARDS];		/**< partially filled pages are sharded by page ID, each shard has its own lock */
 	public:
-		HeapSpace(MemAlloc *ma) : spaceTab(SPACE_HASH_SIZE,ma),pageTab(NULL),nPages(0) {}
-		RC			set(StoreCtx *ctx,PageID,size_t,bool fAdd=true);
-		RC			getPage(size_t size,class PBlock*& pb,HeapPageMgr *mgr);
-		unsigned	find(const HeapPageSpace *hps) const {
-			assert(hps!=NULL); unsigned i=0;
-			if (pageTab!=NULL) for (unsigned n=nPages; n>0; ) {
-				unsigned k=n>>1; const HeapPageSpace *qq=pageTab[i+k]; if (qq==hps) return i+k;
-				if (qq->space<hps->space || qq->space==hps->space && qq>hps) n=k; else {i+=k+1; n-=k+1;}
-			}
-			return i;
-		}
+		HeapSpace(MemAlloc *ma) {for (unsigned i=0; i<SPACE_SHARDS; i++) shards[i]=new(ma) Shard(ma);}
+		RC			set(StoreCtx *ctx,PageID pid,size_t size,bool fAdd=true) {Shard *sh=shards[pid%SPACE_SHARDS]; return sh!=NULL?sh->set(ctx,pid,size,fAdd):RC_NOMEM;}
+		RC			getPage(size_t size,class PBlock*& pb,HeapPageMgr *mgr,Session *ses);
 		friend	class	HeapPageMgr;
 	} freeSpace;
 
+	SharedCounter	nFlushed,nPacked,lPunched,tPack,tUnpack;	/**< page compression statistics, times in microseconds */
+	bool			fPunch;										/**< file manager can release unused blocks of compressed pages */
+	size_t	pack(byte *frame,size_t len);
+	bool	unpack(byte *frame,size_t len);
+
 public:
 	static	size_t		contentSize(size_t lPage) {return lPage - sizeof(HeapPage) - FOOTERSIZE;}
 	static	ushort		dataLength(HType vt,const byte *pData,const byte *frame=NULL,unsigned *idxMask=NULL);
@@ -334,25 +357,52 @@ public:
 	HeapPageMgr(StoreCtx*,PGID);
 	virtual	~HeapPageMgr();
 	void	initPage(byte *page,size_t lPage,PageID pid);
+	bool	afterIO(class PBlock *,size_t lPage,bool fLoad);
 	bool	beforeFlush(byte *frame,size_t len,PageID pid);
+	void	afterWrite(class PBlock *,size_t lPage,RC rc);
 	RC		update(class PBlock *,size_t,unsigned info,const byte *rec,size_t lrec,unsigned flags,class PBlock *newp=NULL);
 
-	class	PBlock *getPartialPage(size_t size) {class PBlock *pb=NULL; freeSpace.getPage(size,pb,this); return pb;}
+	class	PBlock *getPartialPage(size_t size,Session *ses) {class PBlock *pb=NULL; freeSpace.getPage(size,pb,this,ses); return pb;}
 	void	reuse(PageID pid,size_t space,StoreCtx *ctx) {freeSpace.set(ctx,pid,space);}
 	void	discardPage(PageID,Session *ses);
-	void	initPartial();
+	static	void	initPartial(HeapPageMgr *mgr1,HeapPageMgr *mgr2);
 	static	void	savePartial(HeapPageMgr *mgr1,HeapPageMgr *mgr2);
+	static	void	reportCompression(HeapPageMgr *mgr1,HeapPageMgr *mgr2);
+};
+
+/**
+ * heap compaction pass results
+ */
+struct HeapCompactReport
+{
+	unsigned	nPages;			/**< number of heap pages visited */
+	unsigned	nCompacted;		/**< number of pages compacted */
+	unsigned	nRelocated;		/**< number of forwarded PINs moved back to their home pages */
+	unsigned	nReleased;		/**< number of empty pages returned to the free space manager */
+	unsigned	nMultipart;		/**< number of multi-part PIN images found */
+	unsigned	nForwarded;		/**< number of forwarded PINs found */
+	uint64_t	lScattered;		/**< scattered free space found, in bytes */
+	uint64_t	lReclaimed;		/**< scattered free space merged by compaction, in bytes */
 };
 
 class PINPageMgr : public HeapPageMgr
 {
+	SharedCounter		nChurn;											/**< heap page updates since the last compaction pass */
+	volatile long		fCompactRQ;										/**< compaction pass is posted */
+	HeapCompactReport	lastPass;										/**< fragmentation found by the last compaction pass */
+	SharedCounter		nPasses,nCompacted,nRelocated,nReleased,lReclaimed;	/**< compaction statistics since startup */
+	RC		dropPage(PageID dirPID,unsigned dirIdx,PageID pid,Session *ses);
 public:
-	PINPageMgr(StoreCtx *ctx) : HeapPageMgr(ctx,PGID_HEAP) {}
+	PINPageMgr(StoreCtx *ctx) : HeapPageMgr(ctx,PGID_HEAP),fCompactRQ(0) {memset(&lastPass,0,sizeof(lastPass));}
 	bool	afterIO(class PBlock *,size_t lPage,bool fLoad);
 	PGID	getPGID() const;
 	class	PBlock *getNewPage(size_t size,size_t reserve,Session *ses);
 	RC		addPagesToMap(const PageSet&,Session *ses,bool fClasses=false);
 	void	reuse(class PBlock *,Session *ses,size_t reserve,bool fMod=false);
+	void	churn();
+	RC		compact(HeapCompactReport& rep,Session *ses,unsigned budget=HCOMPACT_IO_BUDGET);
+	void	reportCompaction() const;
+	friend	class	HeapCompactRQ;
 };
 
 class SSVPageMgr : public HeapPageMgr
@@ -364,7 +414,7 @@ public:
 	void	reuse(class PBlockP& ,Session *ses,bool fNew,bool fInsert=false);
 };
 
-enum {HDU_HPAGES, HDU_NEXT};
+enum {HDU_HPAGES, HDU_NEXT, HDU_DROP};
 
 class HeapDirMgr : public TxPage
 {
@@ -377,6 +427,10 @@ class HeapDirMgr : public TxPage
 		uint32_t		nHeapPages;
 		PageID			heapPages[1];
 	};
+	struct HeapDirDrop {
+		uint32_t		idx;
+		PageID			pageID;
+	};
 	RWLock	dirLock;
 	PageID	maxPage;
 	PageIdx	maxIdx;
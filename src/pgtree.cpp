@@ -26,6 +26,18 @@ Written by Mark Venguerov 2004-2014
 #include "logmgr.h"
 #include "fsmgr.h"
 
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__arm__)
+#include "immintrin.h"
+#define	MM_KEY_SEARCH
+#ifdef _MSC_VER
+#define	SSE42_TARGET
+#define	AVX2_TARGET
+#else
+#define	SSE42_TARGET	__attribute__((target("sse4.2")))
+#define	AVX2_TARGET		__attribute__((target("avx2")))
+#endif
+#endif
+
 using namespace AfyKernel;
 
 TreePageMgr::TreePageMgr(StoreCtx *ctx) : TxPage(ctx),xSize(ctx->bufMgr->getPageSize()-sizeof(TreePage)-FOOTERSIZE)
@@ -41,6 +53,8 @@ RC TreePageMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_
 	if (tp->info.level>TREE_MAX_DEPTH || tp->info.nEntries!=tp->info.nSearchKeys+(tp->info.sibling!=INVALID_PAGEID?1:0))
 		return RC_CORRUPTED;
 	assert(newp==NULL || op==TRO_SPLIT || op==TRO_MERGE || op==TRO_SPAWN || op==TRO_ABSORB);
+	// invalidates optimistic readers (see TreeCtx::optDescent()) before anything is changed, on every path through this function
+	tp->info.vers++; if (newp!=NULL) ((TreePage*)newp->getPageBuf())->info.vers++;
 	static const unsigned infoSize[TRO_ALL] = {
 		sizeof(TreePageModify),sizeof(TreePageModify),sizeof(TreePageModify),sizeof(TreePageEdit),
 		sizeof(TreePageInit),sizeof(TreePageSplit),sizeof(TreePageSplit),
@@ -353,9 +367,7 @@ RC TreePageMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_
 				report(MSG_ERROR,"TreePageMgr::update undo DROP: invalid length %lu, page %08X\n",lrec,tp->hdr.pageID);
 				return RC_CORRUPTED;
 			}
-			memcpy(&tp->info,rec,sizeof(TreePageInfo));
-			ll=tp->info.nEntries*tp->info.calcEltSize(); memcpy(tp+1,rec+sizeof(TreePageInfo),ll);
-			memcpy((byte*)tp+tp->info.freeSpace,rec+sizeof(TreePageInfo)+ll,lrec-sizeof(TreePageInfo)-ll);
+			if ((rc=tp->setImage(rec,lrec))!=RC_OK) return rc;
 		}
 		break;
 	case TRO_MERGE:
@@ -783,6 +795,10 @@ RC TreePageMgr::update(PBlock *pb,size_t len,unsigned info,const byte *rec,size_
 				memcpy(tp+1,rec,tpmi->lData); tp->info.freeSpaceLength-=tpmi->lData; tp->info.freeSpace-=tpmi->lData-tpmi->nKeys*L_SHT;
 			}
 			break;
+		case MO_IMAGE:
+			if ((rc=tp->setImage(rec,lrec-sizeof(TreePageMulti)))!=RC_OK) return rc;
+			if (tp->info.fmt.dscr!=tpmi->fmt.dscr || tp->info.sibling!=tpmi->sibling || tp->info.nEntries!=tpmi->nKeys) return RC_CORRUPTED;
+			break;
 		}
 		break;
 	case TRO_COUNTER:
@@ -1233,6 +1249,12 @@ RC TreePageMgr::split(TreeCtx& tctx,const SearchKey *key,unsigned& idx,uint16_t
 				if (fDKey) *sk=*key; else {fDKey=true; tp->getKey(splitIdx,*sk);} sk->v.ptr.l=lTrunc; key=sk;
 			}
 		}
+		if (tp->info.fmt.keyType()==KT_VAR) {
+			SearchKey *sk=(SearchKey*)alloca(sizeof(SearchKey)+lkey); if (sk==NULL) return RC_NOMEM;
+			const byte *pl; uint16_t ll; if (fDKey) *sk=*key; else tp->getKey(splitIdx,*sk);
+			if (splitIdx==idx && !fInsR && key!=NULL) {pl=key->getPtr2(); ll=key->v.ptr.l;} else pl=tp->getVarKey(splitIdx-1,ll);
+			sk->v.ptr.l=truncMSeg(pl,ll,(byte*)(sk+1),lkey); fDKey=true; key=sk;				// shortest segment prefix sorting after the left page
+		}
 	}
 	if (!fDKey) {
 		SearchKey *sk=(SearchKey*)alloca(sizeof(SearchKey)+tp->getKeyExtra(splitIdx));
@@ -1753,7 +1775,7 @@ RC TreePageMgr::insert(TreeCtx& tctx,const SearchKey& key0,const void *value,uin
 				if ((multi2>>16)!=0xFFFF && (multi2&0xFFFF)==1) {if (fVM) val=getK(val,uint16_t(multi2>>16),lVal); multi2=0;}
 				unsigned idx2=idx; uint16_t prefSize2=prefixSize; size_t lE=lExtra; fPush=true;
 				if (lVal<0x8000 && (idx2>=tp->info.nEntries || !tp->findKey(*pkey,idx2) && (!tp->hasSibling()||tp->testKey(*pkey,uint16_t(~0u))<0))) {
-					if (tp->info.nEntries==0) {prefSize2=tp->calcPrefixSize(*pkey,0,false,key); lE=0;}
+					if (tp->info.nEntries==0) {prefSize2=tp->calcPrefixSize(*pkey,0,false,key); lE=prefSize2<prefixSize?tp->info.growEltSize(prefixSize,prefSize2):0;}
 					else if (prefSize2!=0 && (idx2==0 || idx2==tp->info.nEntries) && (prefSize2=tp->calcPrefixSize(*pkey,idx2==0?tp->info.nEntries-1:0))<prefixSize)
 						lE=tp->info.extraEltSize(prefSize2)*(tp->info.nEntries+2);
 					size_t lInsert2=tp->info.calcEltSize(prefSize2),lKey2=lInsert2+(tp->info.fmt.isFixedLenKey()?0:pkey->extra()-prefSize2); lInsert2+=lInsert+tp->info.calcVarSize(*pkey,lVal,prefSize2);
@@ -1770,7 +1792,7 @@ RC TreePageMgr::insert(TreeCtx& tctx,const SearchKey& key0,const void *value,uin
 							if ((multi2>>16)!=0xFFFF && (multi2&0xFFFF)==1) {if (fVM) val=getK(val,uint16_t(multi2>>16),lVal); multi2=0;}
 							if (!(lVal<0x8000 && (idx2>=tp->info.nEntries || !tp->findKey(*pkey,idx2) && (!tp->hasSibling()||tp->testKey(*pkey,uint16_t(~0u))<0)))) break;
 							uint16_t prefSize3=tp->info.nEntries==0?tp->calcPrefixSize(*pkey,0,false,key):prefSize2!=0 && (idx2==0 || idx2==tp->info.nEntries)?tp->calcPrefixSize(*pkey,idx2==0?tp->info.nEntries-1:0):prefSize2;
-							if (prefSize3<prefSize2) lE=tp->info.nEntries!=0?tp->info.extraEltSize(prefSize3)*(tp->info.nEntries+nk+1):(prefSize2-prefSize3)*(nk+1);
+							if (prefSize3<prefSize2) lE=tp->info.nEntries!=0?tp->info.extraEltSize(prefSize3)*(tp->info.nEntries+nk+1):lE+tp->info.growEltSize(prefSize2,prefSize3)*nk;
 							size_t lIns=tp->info.calcEltSize(prefSize3); lKey2=lIns+(tp->info.fmt.isFixedLenKey()?0:pkey->extra()-prefSize3); lInsert2+=lIns+tp->info.calcVarSize(*pkey,lVal,prefSize3);
 							if (lInsert2+lE>spaceLeft || tp->info.nEntries!=0 && idx2==tp->info.nEntries && lInsert2+lKey2+lE>=spaceLeft) break;
 							size_t nlrec=lrec+sizeof(TreePageAppendElt)+pkey->extLength()+lVal; prefSize2=prefSize3;
@@ -1789,6 +1811,7 @@ RC TreePageMgr::insert(TreeCtx& tctx,const SearchKey& key0,const void *value,uin
 							tpa->newPrefixSize=prefSize2; tpa->nKeys=nk; if (rc==RC_OK) tctx.moreKeys->push_back();
 							if (tf!=NULL) {byte *p=(byte*)tpa+lrec; tf->getParams(p-lFact,*tctx.tree); p[-2]=byte(lFact); p[-1]=tf->getID();}
 							rc=ctx->txMgr->update(tctx.pb,this,idx<<TRO_SHIFT|TRO_APPEND,(byte*)tpa,lrec,tf!=NULL?LRC_LUNDO:0);
+							if (rc==RC_OK && tctx.tree->filter!=NULL) addToFilter(tctx.tree->filter,tpa);
 						}
 						if (ses!=NULL) ses->free(tpa); return rc;
 					}
@@ -1849,7 +1872,18 @@ RC TreePageMgr::insert(TreeCtx& tctx,const SearchKey& key0,const void *value,uin
 		if (tctx.mainKey==NULL) {p[-2]=byte(lFact); p[-1]=tf->getID();}
 		else {tctx.mainKey->serialize(p-lFact); p[-4]=byte(lFact>>8); p[-3]=byte(lFact); p[-2]=tf->getID(); p[-1]=0xFF;}
 	}
-	return ctx->txMgr->update(tctx.pb,this,idx<<TRO_SHIFT|op,(byte*)tpm,lrec+lValue+lFact,tf!=NULL?LRC_LUNDO:0);
+	rc=ctx->txMgr->update(tctx.pb,this,idx<<TRO_SHIFT|op,(byte*)tpm,lrec+lValue+lFact,tf!=NULL?LRC_LUNDO:0);
+	if (rc==RC_OK && op==TRO_INSERT && tctx.mainKey==NULL && tctx.tree->filter!=NULL && tp->isLeaf()) tctx.tree->filter->add(*key);	// page is still X-latched
+	return rc;
+}
+
+void TreePageMgr::addToFilter(KeyFilter *kf,const TreePageAppend *tpa)
+{
+	const TreePageAppendElt *tae=(const TreePageAppendElt*)(tpa+1);
+	for (unsigned i=0; i<tpa->nKeys; i++,tae=(const TreePageAppendElt*)((byte*)(tae+1)+tae->lkey+tae->ldata)) {
+		const byte *p=(const byte*)(tae+1); const TREE_KT ty=(TREE_KT)*p; const ushort l=SearchKey::keyLenP(p);
+		if (ty<KT_BIN) {SearchKey key; key.type=ty; memcpy(&key.v,p,l); kf->add(key);} else if (ty==KT_BIN) kf->add(SearchKey(p,l));
+	}
 }
 
 RC TreePageMgr::update(TreeCtx& tctx,const SearchKey& key,const void *oldValue,uint16_t lOldValue,const void *newValue,uint16_t lNewValue)
@@ -2041,6 +2075,7 @@ RC TreePageMgr::merge(PBlock *left,PBlock *right,PBlock *par,Tree& tr,const Sear
 	TreePageModify *tpm=(TreePageModify*)alloca(max(lrec,size_t(sizeof(TreePageModify)+lKey+sizeof(PageID))));
 	if (tpm==NULL) return RC_NOMEM;
 	MiniTx mtx(NULL,(tr.mode&TF_SPLITINTX)!=0?MTX_SKIP:0); RC rc=RC_OK;
+	if (ltp->isLeaf() && tr.filter!=NULL) tr.filter->restructured();
 	if (idx!=~0u) {
 #ifdef _DEBUG
 		unsigned idx2; assert(ptp->findKey(key,idx2) && idx==idx2);
@@ -2085,18 +2120,26 @@ RC TreePageMgr::drop(PBlock* &pb,TreeFreeData *dd)
 				}
 			}
 	}
-	size_t lrec=xSize-tp->info.freeSpaceLength+sizeof(TreePageInfo);
-	byte *rec=(byte*)alloca(lrec); if (rec==NULL) return RC_NOMEM;
-	memcpy(rec,&tp->info,sizeof(TreePageInfo));
-	if (tp->info.nEntries>0) {
-		unsigned ll=tp->info.nEntries*tp->info.calcEltSize(); memcpy(rec+sizeof(TreePageInfo),tp+1,ll);
-		memcpy(rec+sizeof(TreePageInfo)+ll,(byte*)tp+tp->info.freeSpace,lrec-sizeof(TreePageInfo)-ll);
-	}
-	PageID pid=pb->getPageID(); Session *ses=Session::getSession();
+	size_t lrec=tp->imageLength(); byte *rec=(byte*)alloca(lrec); if (rec==NULL) return RC_NOMEM;
+	tp->getImage(rec); PageID pid=pb->getPageID(); Session *ses=Session::getSession();
 	ctx->logMgr->insert(ses,LR_DISCARD,TRO_DROP<<PGID_SHIFT|PGID_INDEX,pid,NULL,rec,lrec);
 	pb->release(PGCTL_DISCARD|QMGR_UFORCE,ses); pb=NULL; return ctx->fsMgr->freePage(pid);
 }
 
+size_t TreePageMgr::makeImage(const TreePage *tp,byte *rec)
+{
+	TreePageMulti *tpmi=(TreePageMulti*)rec; tpmi->fmt=tp->info.fmt; tpmi->sibling=tp->info.sibling;
+	tpmi->lData=0; tpmi->nKeys=tp->info.nEntries; tpmi->fLastR=0; tp->getImage((byte*)(tpmi+1));
+	return sizeof(TreePageMulti)+tp->imageLength();
+}
+
+void TreePageMgr::logImage(PBlock *pb,Session *ses)
+{
+	const TreePage *tp=(const TreePage*)pb->getPageBuf();
+	byte *rec=(byte*)alloca(sizeof(TreePageMulti)+tp->imageLength()); size_t lrec=makeImage(tp,rec);
+	ctx->logMgr->insert(ses,LR_CREATE,(MO_IMAGE<<TRO_SHIFT|TRO_MULTI)<<PGID_SHIFT|getPGID(),pb->getPageID(),NULL,rec,lrec,LRC_LUNDO,pb);
+}
+
 void TreePageMgr::initPage(byte *frame,size_t len,PageID pid)
 {
 	static const IndexFormat defaultFormat(KT_ALL,0,0);
@@ -2111,7 +2154,7 @@ void TreePageMgr::initPage(byte *frame,size_t len,PageID pid)
 	tp->info.leftMost		= INVALID_PAGEID;
 	tp->info.stamp			= 0;
 	tp->info.nSearchKeys	= 0;
-	tp->info.filler			= 0;
+	tp->info.vers			= 0;
 	tp->info.initFree(len);
 }
 
@@ -2320,8 +2363,78 @@ bool TreePageMgr::TreePage::testBound(const SearchKey& key,uint16_t idx,const In
 	return fStart?c<0||c==0&&(sg==NULL||(sg->flags&SCAN_EXCLUDE_START)==0):c>0||c==0&&(sg==NULL||(sg->flags&SCAN_EXCLUDE_END)==0);
 }
 
+#ifdef MM_KEY_SEARCH
+
+/**
+ * vector comparison kernels for sorted arrays of fixed-length numeric keys
+ * lt() sets lanes which are less than the search key, countLT() returns number of such elements in arr[0..n)
+ */
+template<typename T> struct KeyVec;
+
+#define	KEYVEC_INT(T,ST,CT,BIAS)																									\
+template<> struct KeyVec<T> {																										\
+	SSE42_TARGET static __m128i splat(T k) {return _mm_set1_##ST(T((BIAS)^k));}																	\
+	SSE42_TARGET static __m128i lt(__m128i e,__m128i k) {return _mm_cmpgt_##CT(k,_mm_xor_si128(e,_mm_set1_##ST(T(BIAS))));}						\
+	AVX2_TARGET static __m256i splat256(T k) {return _mm256_set1_##ST(T((BIAS)^k));}												\
+	AVX2_TARGET static __m256i lt256(__m256i e,__m256i k) {return _mm256_cmpgt_##CT(k,_mm256_xor_si256(e,_mm256_set1_##ST(T(BIAS))));}	\
+};
+
+KEYVEC_INT(uint64_t,epi64x,epi64,0x8000000000000000ULL)
+KEYVEC_INT(int64_t,epi64x,epi64,0)
+KEYVEC_INT(uint32_t,epi32,epi32,0x80000000)
+KEYVEC_INT(int32_t,epi32,epi32,0)
+KEYVEC_INT(uint16_t,epi16,epi16,0x8000)
+KEYVEC_INT(int16_t,epi16,epi16,0)
+
+template<> struct KeyVec<double> {
+	SSE42_TARGET static __m128i splat(double k) {return _mm_castpd_si128(_mm_set1_pd(k));}
+	SSE42_TARGET static __m128i lt(__m128i e,__m128i k) {return _mm_castpd_si128(_mm_cmplt_pd(_mm_castsi128_pd(e),_mm_castsi128_pd(k)));}
+	AVX2_TARGET static __m256i splat256(double k) {return _mm256_castpd_si256(_mm256_set1_pd(k));}
+	AVX2_TARGET static __m256i lt256(__m256i e,__m256i k) {return _mm256_castpd_si256(_mm256_cmp_pd(_mm256_castsi256_pd(e),_mm256_castsi256_pd(k),_CMP_LT_OQ));}
+};
+
+template<> struct KeyVec<float> {
+	SSE42_TARGET static __m128i splat(float k) {return _mm_castps_si128(_mm_set1_ps(k));}
+	SSE42_TARGET static __m128i lt(__m128i e,__m128i k) {return _mm_castps_si128(_mm_cmplt_ps(_mm_castsi128_ps(e),_mm_castsi128_ps(k)));}
+	AVX2_TARGET static __m256i splat256(float k) {return _mm256_castps_si256(_mm256_set1_ps(k));}
+	AVX2_TARGET static __m256i lt256(__m256i e,__m256i k) {return _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(e),_mm256_castsi256_ps(k),_CMP_LT_OQ));}
+};
+
+template<typename T> SSE42_TARGET static unsigned countLT_SSE(const T *arr,unsigned n,T key)
+{
+	const __m128i k=KeyVec<T>::splat(key); unsigned cnt=0,i=0;
+	for (const unsigned nv=16/sizeof(T); i+nv<=n; i+=nv)
+		cnt+=pop((unsigned)_mm_movemask_epi8(KeyVec<T>::lt(_mm_loadu_si128((const __m128i*)(arr+i)),k)));
+	cnt/=sizeof(T); while (i<n && arr[i]<key) {i++; cnt++;}
+	return cnt;
+}
+
+template<typename T> AVX2_TARGET static unsigned countLT_AVX2(const T *arr,unsigned n,T key)
+{
+	const __m256i k=KeyVec<T>::splat256(key); unsigned cnt=0,i=0;
+	for (const unsigned nv=32/sizeof(T); i+nv<=n; i+=nv)
+		cnt+=pop((unsigned)_mm256_movemask_epi8(KeyVec<T>::lt256(_mm256_loadu_si256((const __m256i*)(arr+i)),k)));
+	cnt/=sizeof(T); while (i<n && arr[i]<key) {i++; cnt++;}
+	return cnt;
+}
+
+#endif
+
 template<typename T> bool TreePageMgr::TreePage::findNumKey(T sKey,unsigned nEnt,unsigned& pos) const {
 	const T *keys=(const T *)(this+1);
+#ifdef MM_KEY_SEARCH
+	if (nEnt>=KEY_SEARCH_THR/sizeof(T) && (ProcFlags::pf.flg&(PRCF_AVX2|PRCF_SSE42))!=0) {
+		// branchless binary search down to a small window, then vector comparison of the window
+		const T *base=keys;
+		for (unsigned n=nEnt,half; ;n-=half) {
+			if (n<=KEY_SEARCH_WINDOW/sizeof(T)) {
+				pos=unsigned(base-keys)+((ProcFlags::pf.flg&PRCF_AVX2)!=0?countLT_AVX2(base,n,sKey):countLT_SSE(base,n,sKey));
+				return pos<nEnt && keys[pos]==sKey;
+			}
+			half=n>>1; base=base[half]<sKey?base+half:base;
+		}
+	}
+#endif
 	for (unsigned n=nEnt,base=0; n>0 ;) {
 		unsigned k=n>>1; T key=keys[pos=base+k];
 		if (key==sKey) return true; if (key>sKey) n=k; else {base+=k+1; n-=k+1; pos++;}
@@ -2329,6 +2442,56 @@ template<typename T> bool TreePageMgr::TreePage::findNumKey(T sKey,unsigned nEnt
 	return false;
 }
 
+template<typename T> PageID TreePageMgr::TreePage::findChildOpt(T sKey,unsigned nKeys,bool fSib,PageID left,unsigned fs) const {
+	unsigned pos; if (fSib && !(sKey<((const T*)(this+1))[nKeys])) return INVALID_PAGEID;		// the sibling key has the same prefix
+	if (!findNumKey(sKey,nKeys,pos) && pos--==0) return left;
+	return pos<nKeys?((const PageID*)((const byte*)this+fs))[nKeys-pos-1]:INVALID_PAGEID;
+}
+
+int TreePageMgr::TreePage::cmpBinOpt(const byte *pkey,unsigned lk,unsigned idx,unsigned lKeys,size_t lPage,bool& fOK) const {
+	const volatile PagePtr& vp=((const VarKey*)(this+1))[idx].ptr; const unsigned off=vp.offset,len=vp.len;
+	if (off<lKeys || off+len>lPage-FOOTERSIZE) {fOK=false; return 0;}
+	int res=(lk|len)==0?0:memcmp(pkey,(const byte*)this+off,min(lk,len)); return res!=0?res:cmp3(lk,len);
+}
+
+/**
+ * getChild() for a page which is pinned but not latched (see TreeCtx::optDescent()); header fields are read once and checked against the page length
+ * before any entry is read, var-length key pointers are checked before the key is compared; searched are numeric keys (with prefix - only KT_UINT)
+ * and KT_BIN keys without prefix, INVALID_PAGEID means 'use latched descent'
+ */
+PageID TreePageMgr::TreePage::getChildOpt(const SearchKey& key,size_t lPage,unsigned& level) const
+{
+	const volatile TreePageInfo& vi=info; const IndexFormat fmt=info.fmt; const uint64_t prefix=vi.prefix;
+	const unsigned nKeys=vi.nSearchKeys,nEnt=vi.nEntries,fs=vi.freeSpace,lk=fmt.keyLength(),lPref=vi.lPrefix; const PageID sib=vi.sibling,left=vi.leftMost; level=vi.level;
+	if (level==0 || level>TREE_MAX_DEPTH || nKeys==0 || fmt.keyType()!=key.type || fmt.isSeq() || !fmt.isFixedLenData() || fmt.dataLength()!=sizeof(PageID)) return INVALID_PAGEID;
+	if (!fmt.isFixedLenKey()) {
+		if (key.type!=KT_BIN || lPref!=0 || nEnt!=nKeys+(sib!=INVALID_PAGEID?1:0) || sizeof(TreePage)+nEnt*sizeof(VarKey)>fs || fs>lPage-FOOTERSIZE) return INVALID_PAGEID;
+		const byte *pkey=(const byte*)key.getPtr2(); const unsigned lkey=key.v.ptr.l,lKeys=sizeof(TreePage)+nEnt*sizeof(VarKey); bool fOK=true; int cmp=0;
+		if (sib!=INVALID_PAGEID && (cmp=cmpBinOpt(pkey,lkey,nKeys,lKeys,lPage,fOK))>=0 || !fOK) return INVALID_PAGEID;
+		unsigned pos=0;
+		for (unsigned n=nKeys,base=0; n>0; ) {
+			unsigned k=n>>1; if ((cmp=cmpBinOpt(pkey,lkey,pos=base+k,lKeys,lPage,fOK))==0 || !fOK) break;
+			if (cmp<0) n=k; else {base+=k+1; n-=k+1; pos++;}
+		}
+		if (!fOK) return INVALID_PAGEID; if (cmp!=0 && pos--==0) return left;
+		return pos<nKeys?((const volatile VarKey*)(this+1))[pos].pageID:INVALID_PAGEID;
+	}
+	if (!fmt.isNumKey() || lPref!=0 && (key.type!=KT_UINT || lPref!=sizeof(uint32_t) && lPref!=sizeof(uint32_t)+sizeof(uint16_t))) return INVALID_PAGEID;
+	if (lk>sizeof(uint64_t) || nEnt!=nKeys+(sib!=INVALID_PAGEID?1:0) || sizeof(TreePage)+nEnt*(lk-lPref)>fs || fs+nKeys*sizeof(PageID)>lPage-FOOTERSIZE) return INVALID_PAGEID;
+	switch (key.type) {
+	default: break;
+	case KT_UINT:
+		if (lk!=sizeof(uint64_t)) break;
+		if (lPref!=0 && ((key.v.u^prefix)&~0ULL<<(sizeof(uint64_t)-lPref)*8)!=0) return key.v.u<prefix?left:sib!=INVALID_PAGEID?INVALID_PAGEID:((const PageID*)((const byte*)this+fs))[0];
+		return lPref==0?findChildOpt(key.v.u,nKeys,sib!=INVALID_PAGEID,left,fs):lPref==sizeof(uint32_t)?findChildOpt((uint32_t)key.v.u,nKeys,sib!=INVALID_PAGEID,left,fs):
+			findChildOpt((uint16_t)key.v.u,nKeys,sib!=INVALID_PAGEID,left,fs);
+	case KT_INT: if (lk==sizeof(int64_t)) return findChildOpt(key.v.i,nKeys,sib!=INVALID_PAGEID,left,fs); break;
+	case KT_FLOAT: if (lk==sizeof(float)) return findChildOpt(key.v.f,nKeys,sib!=INVALID_PAGEID,left,fs); break;
+	case KT_DOUBLE: if (lk==sizeof(double)) return findChildOpt(key.v.d,nKeys,sib!=INVALID_PAGEID,left,fs); break;
+	}
+	return INVALID_PAGEID;
+}
+
 template<typename T> bool TreePageMgr::TreePage::findNumKeyVar(T sKey,unsigned nEnt,unsigned& pos) const {
 	const static unsigned lElt=(sizeof(T)+1&~1)+sizeof(PagePtr)+sizeof(T)-1&~(sizeof(T)-1);
 	for (unsigned n=nEnt,base=0; n>0 ;) {
@@ -2391,8 +2554,12 @@ bool TreePageMgr::TreePage::findKey(const SearchKey& skey,unsigned& pos) const
 			} else switch (info.lPrefix) {
 			default: assert(0);
 			case 0: return fFixed?findNumKey(skey.v.i,nEnt,pos):findNumKeyVar(skey.v.i,nEnt,pos);
-			case sizeof(uint32_t): return fFixed?findNumKey((int32_t)skey.v.i,nEnt,pos):findNumKeyVar((int32_t)skey.v.i,nEnt,pos);
-			case sizeof(uint32_t)+sizeof(uint16_t): return fFixed?findNumKey((int16_t)skey.v.i,nEnt,pos):findNumKeyVar((int16_t)skey.v.i,nEnt,pos);
+			case sizeof(uint32_t):
+				if ((int32_t(skey.v.i)^*(int32_t*)(this+1))<0) {pos=int32_t(skey.v.i)<0?nEnt:0; break;}
+				return fFixed?findNumKey((int32_t)skey.v.i,nEnt,pos):findNumKeyVar((int32_t)skey.v.i,nEnt,pos);
+			case sizeof(uint32_t)+sizeof(uint16_t):
+				if ((int16_t(skey.v.i)^*(int16_t*)(this+1))<0) {pos=int16_t(skey.v.i)<0?nEnt:0; break;}	// suffix sign differs from the page's suffixes
+				return fFixed?findNumKey((int16_t)skey.v.i,nEnt,pos):findNumKeyVar((int16_t)skey.v.i,nEnt,pos);
 			case sizeof(uint64_t): assert(info.nEntries==1); pos=0; return true;
 			}
 			break;
@@ -2690,6 +2857,21 @@ void TreePageMgr::TreePage::copyEntries(TreePage *page,uint16_t prefLen,uint16_t
 	}
 }
 
+void TreePageMgr::TreePage::getImage(byte *rec) const
+{
+	memcpy(rec,&info,sizeof(TreePageInfo)); rec+=sizeof(TreePageInfo);
+	size_t ll=info.nEntries*info.calcEltSize(); memcpy(rec,this+1,ll);
+	memcpy(rec+ll,(byte*)this+info.freeSpace,hdr.length()-FOOTERSIZE-info.freeSpace);
+}
+
+RC TreePageMgr::TreePage::setImage(const byte *rec,size_t lrec)
+{
+	if (lrec<sizeof(TreePageInfo)) return RC_CORRUPTED;
+	memcpy(&info,rec,sizeof(TreePageInfo)); rec+=sizeof(TreePageInfo); lrec-=sizeof(TreePageInfo);
+	size_t ll=info.nEntries*info.calcEltSize(); if (ll>lrec || info.freeSpace+lrec-ll>hdr.length()-FOOTERSIZE) return RC_CORRUPTED;
+	memcpy(this+1,rec,ll); memcpy((byte*)this+info.freeSpace,rec+ll,lrec-ll); return RC_OK;
+}
+
 RC TreePageMgr::TreePage::prefixFromKey(const void *pk,uint16_t prefSize)
 {
 	const byte *key=(const byte *)pk;
@@ -2723,7 +2905,8 @@ uint16_t TreePageMgr::TreePage::calcPrefixSize(const SearchKey &key,unsigned idx
 		}
 		u^=key.v.u;
 		if (key.type==KT_INT) {
-			//...
+			if ((u&0x8000)!=0) u|=0x10000;				// suffixes are compared as signed, keep their sign bits in the prefix
+			if ((u&0x80000000)!=0) u|=0x100000000ULL;
 		}
 		return uint32_t(u>>32)!=0?0:(uint32_t(u)&0xFFFF0000)!=0?sizeof(uint32_t):sizeof(uint32_t)+sizeof(uint16_t);
 	}
@@ -2766,10 +2949,10 @@ uint16_t TreePageMgr::TreePage::calcPrefixSize(unsigned start,unsigned end) cons
 	case sizeof(uint64_t): //????
 	case sizeof(uint32_t)+sizeof(uint16_t): return info.lPrefix;
 	case sizeof(uint32_t):
-		{uint32_t t=*(uint32_t*)p1^*(uint32_t*)p2; return (t&0xFFFF0000)!=0?info.lPrefix:info.lPrefix+sizeof(uint16_t);}
+		{uint32_t t=*(uint32_t*)p1^*(uint32_t*)p2; if (info.fmt.keyType()==KT_INT && (t&0x8000)!=0) t|=0x10000; return (t&0xFFFF0000)!=0?info.lPrefix:info.lPrefix+sizeof(uint16_t);}
 	case 0:
 		assert(info.lPrefix==0);
-		{uint64_t t=*(uint64_t*)p1^*(uint64_t*)p2; return uint32_t(t>>32)!=0?0:(uint32_t(t)&0xFFFF0000)!=0?sizeof(uint32_t):sizeof(uint32_t)+sizeof(uint16_t);}
+		{uint64_t t=*(uint64_t*)p1^*(uint64_t*)p2; if (info.fmt.keyType()==KT_INT) {if ((t&0x8000)!=0) t|=0x10000; if ((t&0x80000000)!=0) t|=0x100000000ULL;} return uint32_t(t>>32)!=0?0:(uint32_t(t)&0xFFFF0000)!=0?sizeof(uint32_t):sizeof(uint32_t)+sizeof(uint16_t);}
 	}
 	if (info.fmt.isFixedLenKey()) {
 		lCmp=info.fmt.keyLength()-info.lPrefix; assert(info.lPrefix<=sizeof(info.prefix));
@@ -3002,11 +3185,7 @@ RC SubTreeInit::insert(Session *ses,const byte *key)
 		tp->compact(true);
 #endif
 		tp2->info.nSearchKeys=tp2->info.nEntries=2;
-		if (ctx->memory!=NULL) stack[didx]->resetNewPage();
-		else {
-			// rec, lrec
-			ctx->logMgr->insert(ses,LR_CREATE,(MO_PAGEINIT<<TRO_SHIFT|TRO_MULTI)<<PGID_SHIFT|ctx->trpgMgr->getPGID(),stack[didx]->getPageID(),NULL,NULL,0,LRC_LUNDO,stack[didx]);
-		}
+		if (ctx->memory!=NULL) stack[didx]->resetNewPage(); else ctx->trpgMgr->logImage(stack[didx],ses);
 		stack[didx]->release(QMGR_UFORCE); stack[didx]=pb;
 		if (didx==0) {
 			if (sizeof(TreePageMgr::SubTreePageKey)+l<=freeSpaceLength) {
@@ -3042,11 +3221,7 @@ RC SubTreeInit::flush(Session *ses)
 		StoreCtx *ctx=ses->getStore();
 		for (unsigned i=depth; i--!=0; ) {
 			PBlock *pb=stack[i];
-			if (ctx->memory!=NULL) pb->resetNewPage();
-			else {
-				// rec, lrec
-				ctx->logMgr->insert(ses,LR_CREATE,(MO_PAGEINIT<<TRO_SHIFT|TRO_MULTI)<<PGID_SHIFT|ctx->trpgMgr->getPGID(),pb->getPageID(),NULL,NULL,0,LRC_LUNDO,pb);
-			}
+			if (ctx->memory!=NULL) pb->resetNewPage(); else ctx->trpgMgr->logImage(pb,ses);
 #ifdef _DEBUG
 			((TreePageMgr::TreePage*)pb->getPageBuf())->compact(true);
 #endif
@@ -3064,3 +3239,110 @@ RC SubTreeInit::flush(Session *ses)
 	}
 	return rc;
 }
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------
+
+TreeLoader::TreeLoader(Session *s,IndexFormat fm) : ses(s),ctx(s->getStore()),fmt(fm),lPage(ctx->bufMgr->getPageSize()),rec(NULL),nLevels(0)
+{
+}
+
+TreeLoader::~TreeLoader()
+{
+	for (unsigned i=0; i<nLevels; i++) {
+		if (levels[i].tp!=NULL) ses->free(levels[i].tp);
+		if (levels[i].key!=NULL) ses->free(levels[i].key);
+		if (levels[i].data!=NULL) ses->free(levels[i].data);
+	}
+	if (rec!=NULL) ses->free(rec);
+}
+
+RC TreeLoader::load(IMultiKey& mk,PageID& root,unsigned& height,PageID& first)
+{
+	const SearchKey *key; const void *val; ushort lVal; unsigned multi; RC rc; const size_t xSize=ctx->trpgMgr->xSize;
+	first=INVALID_PAGEID; if (fmt.isSeq() || fmt.isKeyOnly()) return RC_OK;
+	while ((rc=mk.nextKey(key,val,lVal,multi))==RC_OK) {
+		uint16_t n=uint16_t(multi&0xFFFF),start=uint16_t(multi>>16);
+		if (n==1 && start!=0xFFFF && !fmt.isFixedLenData()) {val=TreePageMgr::getK(val,start,lVal); n=start=0;}
+		if (start!=0 || fmt.isFixedLenData() && (n!=0 || lVal!=fmt.dataLength()) || key->type!=fmt.keyType() || lVal>xSize/6 || key->extra()>xSize/8
+			|| nLevels!=0 && key->cmp(*levels[0].key)<=0) {mk.push_back(); break;}		// the rest is inserted in the built tree
+		if ((rc=add(0,*key,val,lVal,n))!=RC_OK) return rc;
+	}
+	if (rc!=RC_OK && rc!=RC_EOF) return rc;
+	for (unsigned i=0; i<nLevels; i++) {
+		if (levels[i].fPending && (rc=place(i,NULL))!=RC_OK) return rc;
+		if ((rc=write(levels[i],NULL,INVALID_PAGEID))!=RC_OK) return rc;
+	}
+	if (nLevels!=0) {root=levels[nLevels-1].tp->hdr.pageID; height=nLevels-1; first=levels[0].first;}
+	return RC_OK;
+}
+
+RC TreeLoader::add(unsigned lvl,const SearchKey& key,const void *data,uint16_t lData,uint16_t nData)
+{
+	Level& lv=levels[lvl]; RC rc;
+	if (lvl>=nLevels) {
+		if (lvl>=TREE_MAX_DEPTH) return RC_NOMEM;
+		lv.tp=NULL; lv.key=NULL; lv.data=NULL; lv.fPending=false; nLevels++;
+		if ((lv.tp=(TreePageMgr::TreePage*)ses->malloc(lPage))==NULL || (lv.key=(SearchKey*)ses->malloc(sizeof(SearchKey)+ctx->trpgMgr->xSize))==NULL
+			|| (lv.data=(byte*)ses->malloc(lvl==0?ctx->trpgMgr->xSize:sizeof(PageID)))==NULL) return RC_NOMEM;
+		if ((rc=ctx->fsMgr->allocPages(1,&lv.first))!=RC_OK) return rc;
+		ctx->trpgMgr->initPage((byte*)lv.tp,lPage,lv.first); lv.tp->info.fmt=fmt; lv.tp->info.level=uint8_t(lvl);
+		if (lvl!=0) {lv.tp->info.fmt.makeInternal(); lv.tp->info.leftMost=levels[lvl-1].first;}
+	} else if (lv.fPending && (rc=place(lvl,&key))!=RC_OK) return rc;
+	*lv.key=key; if (key.type>=KT_BIN && key.type<KT_ALL) lv.key->v.ptr.p=lv.key+1;
+	memcpy(lv.data,data,lData); lv.lData=lData; lv.nData=nData; lv.fPending=true; return RC_OK;
+}
+
+bool TreeLoader::fits(const Level& lv,const SearchKey *next) const
+{
+	const TreePageMgr::TreePage *tp=lv.tp; const TreePageMgr::TreePageInfo& info=tp->info; uint16_t lp=info.lPrefix,l;
+	if (lp!=0 && (l=tp->calcPrefixSize(*lv.key,0))<lp) lp=l;
+	if (lp!=0 && next!=NULL && (l=tp->calcPrefixSize(*next,0))<lp) lp=l;
+	const bool fVarKey=!info.fmt.isFixedLenKey(); size_t lElt=info.calcEltSize(lp),lNeed=lElt+info.calcVarSize(*lv.key,lv.lData,lp);
+	if (lp<info.lPrefix) lNeed+=info.nEntries*(lElt-info.calcEltSize()+(fVarKey?info.lPrefix-lp:0));
+	if (next!=NULL) lNeed+=lElt+(fVarKey?next->v.ptr.l-lp:0);
+	return lNeed+size_t(ctx->trpgMgr->xSize*(1.-LOAD_FILL_THR))<=size_t(info.freeSpaceLength+info.scatteredFreeSpace);
+}
+
+RC TreeLoader::place(unsigned lvl,const SearchKey *next)
+{
+	Level& lv=levels[lvl]; TreePageMgr::TreePage *tp=lv.tp; RC rc; lv.fPending=false;
+	if (tp->info.nEntries!=0 && !fits(lv,next)) {
+		SearchKey *sep=lv.key; uint16_t l;
+		if (lvl==0 && !tp->info.fmt.isFixedLenKey() && !tp->info.fmt.isRefKeyOnly()) {
+			// separator is truncated to the shortest prefix still sorting after the last key of this page
+			if ((sep=(SearchKey*)alloca(sizeof(SearchKey)+lv.key->v.ptr.l))==NULL) return RC_NOMEM; *sep=*lv.key;
+			if (tp->info.fmt.keyType()==KT_VAR) {const byte *pl=tp->getVarKey(tp->info.nEntries-1,l); sep->v.ptr.l=truncMSeg(pl,l,(byte*)(sep+1),sep->v.ptr.l);}
+			else if ((l=tp->calcPrefixSize(*lv.key,tp->info.nEntries-1,true))!=0 && ++l<sep->v.ptr.l) sep->v.ptr.l=l;
+		}
+		PageID pid; if ((rc=ctx->fsMgr->allocPages(1,&pid))!=RC_OK || (rc=write(lv,sep,pid))!=RC_OK) return rc;
+		const IndexFormat pfmt=tp->info.fmt; ctx->trpgMgr->initPage((byte*)tp,lPage,pid); tp->info.fmt=pfmt; tp->info.level=uint8_t(lvl);
+		if ((rc=add(lvl+1,*sep,&pid,sizeof(PageID),0))!=RC_OK) return rc;
+		if (lvl!=0) {tp->info.leftMost=*(PageID*)lv.data; return RC_OK;}
+	}
+	byte *sk=(byte*)alloca(lv.key->extLength()); if (sk==NULL) return RC_NOMEM; lv.key->serialize(sk);
+	if (tp->info.nEntries==0) {if (tp->info.fmt.keyType()<KT_REF && (rc=tp->prefixFromKey(sk))!=RC_OK) return rc;}
+	else if (tp->info.lPrefix!=0) {uint16_t lp=tp->calcPrefixSize(*lv.key,0); if (lp<tp->info.lPrefix) tp->changePrefixSize(lp);}
+	return tp->insertKey(tp->info.nEntries,sk,lv.data,lv.lData,lv.nData,tp->info.calcVarSize(*lv.key,lv.lData,tp->info.lPrefix));
+}
+
+RC TreeLoader::write(Level& lv,const SearchKey *hkey,PageID sibling)
+{
+	TreePageMgr::TreePage *tp=lv.tp; PBlock *pb; RC rc;
+	if (hkey!=NULL) {
+		if (!tp->info.fmt.isNumKey() || tp->info.fmt.isPrefNumKey())
+			{uint16_t lp=tp->calcPrefixSize(*hkey,0,true); if (lp!=tp->info.lPrefix) tp->changePrefixSize(lp);}
+		if (tp->info.scatteredFreeSpace>0) tp->compact();
+		byte *sk=(byte*)alloca(hkey->extLength()); if (sk==NULL) return RC_NOMEM; hkey->serialize(sk);
+		uint16_t lElt=tp->info.calcEltSize(); tp->storeKey(sk,(byte*)(tp+1)+lElt*tp->info.nEntries);
+		assert(tp->info.freeSpaceLength>=lElt); tp->info.freeSpaceLength-=lElt; tp->info.nEntries++; tp->info.sibling=sibling;
+	}
+#ifdef _DEBUG
+	if (!tp->info.fmt.isFixedLenKey()||!tp->info.fmt.isFixedLenData()) tp->compact(true);
+#endif
+	if (rec==NULL && (rec=(byte*)ses->malloc(lPage+sizeof(TreePageMgr::TreePageMulti)))==NULL) return RC_NOMEM;
+	size_t lrec=TreePageMgr::makeImage(tp,rec);
+	if ((pb=ctx->bufMgr->newPage(tp->hdr.pageID,ctx->trpgMgr,NULL,0,ses))==NULL) return RC_NOMEM;
+	if ((rc=ctx->txMgr->update(pb,ctx->trpgMgr,MO_IMAGE<<TRO_SHIFT|TRO_MULTI,rec,lrec))!=RC_OK) pb->release(PGCTL_DISCARD|QMGR_UFORCE,ses);
+	else pb->release(0,ses);
+	return rc;
+}
@@ -71,11 +71,17 @@ enum TREE_OP
  */
 enum MULTI_OP
 {
-	MO_INSERT, MO_DELETE, MO_INIT, MO_PAGEINIT
+	MO_INSERT, MO_DELETE, MO_INIT, MO_PAGEINIT, MO_IMAGE
 };
 
 #define	SPAWN_THR			0.8		/**< spawn threshold */
 #define	SPAWN_N_THR			4		/**< spawn number of keys threshold */
+#define	LOAD_FILL_THR		0.9		/**< page fill factor for bottom-up tree construction */
+
+#define	KEY_SEARCH_THR		256		/**< minimum size of numeric key array (in bytes) for vectorized search */
+#define	KEY_SEARCH_WINDOW	128		/**< size of the key window (in bytes) compared with vector instructions */
+
+#define	OPT_READ_RETRIES	8		/**< number of failed optimistic page reads before falling back to latched descent */
 
 #define	PTX_NOPRNTREL		0x0001
 #define	PTX_NOLEAFREL		0x0002
@@ -113,12 +119,14 @@ struct TreeCtx
 	RC						findPage(const SearchKey *);
 	RC						findPrevPage(const SearchKey *,bool fUpd=false);
 	RC						findPageForUpdate(const SearchKey *,bool fIns=false);
+	bool					optDescent(const SearchKey&,PageID&,int& level,unsigned);
 	RC						getParentPage(const SearchKey&,unsigned);
 	RC						getPreviousPage(bool fRead=true);
 	PageID					startPage(const SearchKey*,int& level,bool=true,bool=false);
 	PageID					prevStartPage(PageID pid);
 	void					getStamps(unsigned stamps[TREE_NODETYPE_ALL]) const;
 	RC						postPageOp(const SearchKey& key,PageID pageID,bool fDel=false) const;
+	RC						mergePages(const SearchKey& key,PageID child);
 };
 
 /**
@@ -183,7 +191,7 @@ public:
 		PageID		leftMost;
 		uint32_t	stamp;
 		uint16_t	nSearchKeys;
-		uint16_t	filler;
+		uint16_t	vers;
 
 		void		initFree(size_t lPage) {freeSpace=uint16_t(lPage-FOOTERSIZE); freeSpaceLength=uint16_t(lPage-sizeof(TreePage)-FOOTERSIZE); scatteredFreeSpace=lPrefix=0;}
 		uint16_t	keyLength() const {assert(!fmt.isKeyOnly()); return fmt.isSeq()?0:!fmt.isFixedLenKey()?sizeof(PagePtr):(uint16_t)ceil(fmt.keyLength()-lPrefix,sizeof(uint16_t));}
@@ -205,6 +213,9 @@ public:
 				!fmt.isNumKey()?uint16_t(ceil(fmt.keyLength()-newPrefLen,sizeof(uint16_t))-ceil(fmt.keyLength()-lPrefix,sizeof(uint16_t))):
 				uint16_t(ceil(fmt.keyLength()-newPrefLen+sizeof(PagePtr),fmt.keyLength()-newPrefLen)-ceil(fmt.keyLength()-lPrefix+sizeof(PagePtr),fmt.keyLength()-lPrefix));
 		}
+		uint16_t	growEltSize(uint16_t oldPrefLen,uint16_t newPrefLen) const {
+			return calcEltSize(newPrefLen)-calcEltSize(oldPrefLen)+(fmt.isFixedLenKey()?0:oldPrefLen-newPrefLen);
+		}
 		uint16_t	calcVarSize(const SearchKey& key,uint16_t lData,uint16_t prefLen) const {
 			assert(!fmt.isSeq()); return fmt.isFixedLenKey()?lData:fmt.isFixedLenData()?key.v.ptr.l-prefLen:key.v.ptr.l-prefLen+lData;
 		}
@@ -299,6 +310,7 @@ public:
 		}
 		template<typename T> bool findNumKey(T key,unsigned,unsigned& pos) const;
 		template<typename T> bool findNumKeyVar(T key,unsigned,unsigned& pos) const;
+		template<typename T> PageID	findChildOpt(T key,unsigned nKeys,bool fSib,PageID left,unsigned fs) const;
 		void		compact(bool fCheckOnly=false,unsigned extIdx=~0u,uint16_t lext=0);
 		void		changePrefixSize(uint16_t prefLen);
 		void		copyEntries(TreePage *,uint16_t prefLen,uint16_t start) const;
@@ -306,15 +318,21 @@ public:
 		uint16_t	calcPrefixSize(unsigned start,unsigned end) const;
 		void		storeKey(const void *key,void *ptr);
 		RC			prefixFromKey(const void *key,uint16_t prefSize=uint16_t(~0u));
+		size_t		imageLength() const {return sizeof(TreePageInfo)+hdr.length()-sizeof(TreePage)-FOOTERSIZE-info.freeSpaceLength;}
+		void		getImage(byte *rec) const;
+		RC			setImage(const byte *rec,size_t lrec);
 		void		moveMulti(const TreePage *src,const PagePtr& from,PagePtr& to);
 		bool		hasSibling() const {return info.sibling!=INVALID_PAGEID;}
 		bool		isLeaf() const {return info.level==0;}
+		uint16_t	getVers() const {return *(const volatile uint16_t*)&info.vers;}
 		bool		checkPage(bool fWrite) const;
 		PageID		getChild(const SearchKey& key,unsigned& pos,bool fBefore) const {
 			assert(!isLeaf() && info.fmt.isFixedLenData() && info.fmt.dataLength()==sizeof(PageID));
 			if (info.nSearchKeys==0) {pos=~0u; return info.leftMost;}
 			if (!findKey(key,pos)||fBefore) --pos; return getPageID(pos);
 		}
+		PageID		getChildOpt(const SearchKey& key,size_t lPage,unsigned& level) const;
+		int			cmpBinOpt(const byte *pkey,unsigned lk,unsigned idx,unsigned lKeys,size_t lPage,bool& fOK) const;
 		PageID		getPageID(unsigned idx) const {
 			assert(!isLeaf()&&(idx<info.nSearchKeys||idx==~0u&&info.leftMost!=INVALID_PAGEID)); 
 			return idx==~0u?info.leftMost : !info.fmt.isFixedLenKey() ? ((VarKey*)(this+1))[idx].pageID :
@@ -342,6 +360,10 @@ public:
 		uint16_t	getKeyExtra(uint16_t idx) const {return info.fmt.isNumKey()?0:getKeySize(idx);}
 		uint16_t	getKeySize(uint16_t idx) const;
 		void		getKey(uint16_t idx,SearchKey& key) const;
+		const byte	*getVarKey(uint16_t idx,uint16_t& l) const {
+			const byte *p=(const byte*)(this+1)+idx*info.calcEltSize(); assert(info.lPrefix==0 && idx<info.nEntries);
+			if (info.fmt.isKeyOnly()) return getK(p,l); l=((PagePtr*)p)->len; return (const byte*)this+((PagePtr*)p)->offset;
+		}
 		void		serializeKey(uint16_t idx,void *buf) const;
 		bool		isSubTree(const PagePtr& dp) const {return (dp.len&TRO_MANY)!=0 && ((SubTreePage*)((byte*)this+dp.offset))->fSubPage==0xFFFF;}
 		const SubTreePageKey *findExtKey(const void *key,size_t lkey,const SubTreePageKey *tpk,unsigned nKeys,uint16_t *poff=NULL) const;
@@ -377,6 +399,7 @@ public:
 	RC		truncate(TreeCtx& tctx,const SearchKey& key,uint64_t val,bool fCount);
 	RC		remove(TreeCtx& tctx,const SearchKey&,const void *value,uint16_t lValue,unsigned multi=0);
 	RC		merge(PBlock *left,PBlock *right,PBlock *par,Tree& tr,const SearchKey&,unsigned idx);
+	static	void	addToFilter(class KeyFilter *kf,const struct TreePageAppend *tpa);
 	RC		drop(PBlock *&pb,TreeFreeData*);
 
 	size_t		contentSize() const {return xSize;}
@@ -387,6 +410,8 @@ private:
 	static		PageID	startSubPage(const TreePage *tp,const PagePtr& vp,const SearchKey *key,int& level,bool fRead,bool fBefore);
 	static		PageID	prevStartSubPage(const TreePage *tp,const PagePtr& vp,PageID);
 	void		addNewPage(TreeCtx& tctx,const SearchKey& key,PageID pid,bool fTry=false);
+	static	size_t	makeImage(const TreePage *tp,byte *rec);
+	void		logImage(PBlock *pb,Session *ses);
 	uint16_t	packMulti(byte *buf,const void *pv,unsigned start,unsigned end,TreePage *tp=NULL);
 	uint16_t	calcXSz(const byte *pv,unsigned from,unsigned to,const TreePage *tp=NULL);
 	static	size_t	calcChunkSize(const byte *pv,unsigned start,unsigned end);
@@ -395,10 +420,43 @@ private:
 	RC			split(TreeCtx& tctx,const SearchKey *key,unsigned& idx,uint16_t splitIdx,bool fInsR,PBlock **right=NULL);
 	RC			spawn(TreeCtx& tctx,size_t lInsert,unsigned idx=~0u);
 	friend	class	SubTreeInit;
+	friend	class	TreeLoader;
 	friend	struct	TreeCtx;
 	friend	class	TreeRQ;
 };
 
+/**
+ * Bottom-up construction of a whole index tree from sorted keys
+ * pages of each level are packed in a scratch buffer and written with one log record per page
+ */
+class TreeLoader
+{
+	struct Level {
+		TreePageMgr::TreePage	*tp;			/**< page being filled */
+		SearchKey	*key;						/**< pending key */
+		byte		*data;						/**< pending data */
+		uint16_t	lData;
+		uint16_t	nData;
+		bool		fPending;
+		PageID		first;						/**< first page of this level */
+	};
+	Session		*const	ses;
+	StoreCtx	*const	ctx;
+	const	IndexFormat	fmt;
+	const	size_t		lPage;
+	byte				*rec;
+	unsigned			nLevels;
+	Level				levels[TREE_MAX_DEPTH];
+	RC					add(unsigned lvl,const SearchKey& key,const void *data,uint16_t lData,uint16_t nData);
+	RC					place(unsigned lvl,const SearchKey *next);
+	bool				fits(const Level& lv,const SearchKey *next) const;
+	RC					write(Level& lv,const SearchKey *hkey,PageID sibling);
+public:
+	TreeLoader(Session *s,IndexFormat fm);
+	~TreeLoader();
+	RC					load(IMultiKey& mk,PageID& root,unsigned& height,PageID& first);
+};
+
 };
 
 #endif
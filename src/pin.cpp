@@ -582,6 +582,46 @@ PIN *PIN::getPIN(const PID& id,VersionID vid,Session *ses,unsigned md)
 	return NULL;
 }
 
+struct PIDAddr
+{
+	PageAddr	addr;
+	unsigned	idx;
+};
+
+static int __cdecl cmpPIDAddr(const void *p1,const void *p2)
+{
+	const PageAddr &a1=((const PIDAddr*)p1)->addr,&a2=((const PIDAddr*)p2)->addr;
+	int c=cmp3(a1.pageID,a2.pageID); return c!=0?c:cmp3(a1.idx,a2.idx);
+}
+
+RC PIN::getPINs(const PID *ids,unsigned nIds,IPIN **pins,Session *ses,unsigned md)
+{
+	if (nIds==0) return RC_OK; if (ids==NULL || pins==NULL) return RC_INVPARAM;
+	if ((ses=Session::getSession())==NULL) return RC_NOSESSION; StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN;
+	PIDAddr *pa=(PIDAddr*)ses->malloc(nIds*(sizeof(PIDAddr)+sizeof(PageID))); if (pa==NULL) {memset(pins,0,nIds*sizeof(IPIN*)); return RC_NOMEM;}
+	PageID *pages=(PageID*)(pa+nIds); unsigned nLocal=0,nPages=0; RC rc=RC_OK;
+	for (unsigned i=0; i<nIds; i++) {
+		PageAddr addr; pins[i]=NULL;
+		if (!isRemote(ids[i]) && addr.convert(uint64_t(ids[i].pid))) {pa[nLocal].addr=addr; pa[nLocal++].idx=i;}
+		else pins[i]=getPIN(ids[i],STORE_CURRENT_VERSION,ses,md);
+	}
+	if (nLocal>1) qsort(pa,nLocal,sizeof(PIDAddr),cmpPIDAddr);
+	for (unsigned i=0; i<nLocal; i++) if (nPages==0 || pages[nPages-1]!=pa[i].addr.pageID) pages[nPages++]=pa[i].addr.pageID;
+	for (unsigned i=nPages; i--!=0;) if (ctx->fsMgr->isFreePage(pages[i])) {if (i+1<nPages) memmove(&pages[i],&pages[i+1],(nPages-i-1)*sizeof(PageID)); --nPages;}
+	if (nPages>1) ctx->bufMgr->prefetch(pages,nPages,ctx->heapMgr);
+	TxGuard txg(ses); PINx cb(ses);
+	for (unsigned i=0; i<nLocal; i++) {
+		// PINs are loaded in page order, the page stays latched in cb while consecutive PINs are on it
+		PIN *pin=NULL; cb.reset(ids[pa[i].idx]); if ((md&LOAD_EXT_ADDR)!=0) ses->setExtAddr(pa[i].addr);
+		if ((rc=cb.getBody(TVO_READ,(md&MODE_DELETED)!=0?GB_DELETED:0))==RC_OK && (rc=cb.loadPIN(pin,md|LOAD_CLIENT))==RC_OK) pins[pa[i].idx]=pin;
+		else {delete pin; if (rc==RC_NOMEM) break;}
+		ses->setExtAddr(PageAddr::noAddr); rc=RC_OK;
+	}
+	// on error nothing is returned to the caller: PINs loaded so far are destroyed
+	if (rc!=RC_OK) for (unsigned i=0; i<nIds; i++) if (pins[i]!=NULL) {pins[i]->destroy(); pins[i]=NULL;}
+	ses->setExtAddr(PageAddr::noAddr); ses->free(pa); return rc;
+}
+
 RC PIN::checkSet(const Value *&pv,const Value& w)
 {
 	assert(properties!=NULL && nProperties!=0);
@@ -667,7 +707,7 @@ void PINx::checkNotHeld(PBlock *p)
 
 void PINx::moveTo(PINx& cb)
 {
-	cb.id=id; cb.addr=addr; cb.properties=properties; cb.nProperties=nProperties; cb.mode=mode; cb.meta=meta; pb.moveTo(cb.pb); cb.hpin=hpin; cb.epr=epr; cb.tv=tv;
+	cb.releaseTV(); cb.id=id; cb.addr=addr; cb.properties=properties; cb.nProperties=nProperties; cb.mode=mode; cb.meta=meta; pb.moveTo(cb.pb); cb.hpin=hpin; cb.epr=epr; cb.tv=tv;
 	id=PIN::noPID; addr=PageAddr::noAddr; properties=NULL; nProperties=0; mode=0; meta=0; hpin=NULL; tv=NULL; epr.buf[0]=0; epr.flags=0;
 }
 
@@ -781,8 +821,8 @@ uint32_t PINx::estimateSize() const
 
 RC PINx::getBody(TVOp tvo,unsigned flags,VersionID vid)
 {
-	RC rc; PageAddr extAddr; StoreCtx *ctx=ses->getStore();
-	bool fRemote=false,fTry=true,fWrite=tvo!=TVO_READ; epr.flags&=~PINEX_ADDRSET;
+	RC rc; PageAddr extAddr; StoreCtx *ctx=ses->getStore(); unsigned nRetry=0;
+	bool fRemote=false,fTry=true,fFwd=false,fWrite=tvo!=TVO_READ; epr.flags&=~PINEX_ADDRSET;
 	if (id.isEmpty() && (rc=unpack())!=RC_OK) return rc;
 	if (!addr.defined()) {fTry=false; if (isRemote(id)) fRemote=true; else if (!addr.convert(id.pid)) return RC_CORRUPTED;}
 	if ((epr.flags&PINEX_EXTPID)!=0 && extAddr.convert(uint64_t(id.pid))) ses->setExtAddr(extAddr);
@@ -791,7 +831,12 @@ RC PINx::getBody(TVOp tvo,unsigned flags,VersionID vid)
 		else if ((rc=ctx->netMgr->getPage(id,fctl,addr.idx,pb,ses))!=RC_OK) return rc;
 		else {fRemote=fTry=false; addr.pageID=pb->getPageID();}
 
-		if (pb.isNull()) return RC_NOTFOUND;
+		if (pb.isNull()) {
+			// the address hint or the forward may point to a page released by heap compaction
+			if (fTry) fTry=false; else if (!fFwd || nRetry++!=0) return RC_NOTFOUND; else fFwd=false;
+			if (isRemote(id)) fRemote=true; else if (!addr.convert(id.pid)) return RC_CORRUPTED;
+			continue;
+		}
 		if (fWrite && pb->isULocked()) {fctl|=QMGR_UFORCE; pb.set(QMGR_UFORCE);}
 		
 		if (fill()==NULL) {
@@ -800,13 +845,13 @@ RC PINx::getBody(TVOp tvo,unsigned flags,VersionID vid)
 			}
 		} else if (hpin->hdr.getType()==HO_FORWARD) {
 			if ((flags&GB_FORWARD)!=0) {if ((epr.flags&PINEX_EXTPID)!=0) ses->setExtAddr(PageAddr::noAddr); return RC_OK;}
-			memcpy(&addr,(const byte*)hpin+sizeof(HeapPageMgr::HeapObjHeader),PageAddrSize); continue;
+			memcpy(&addr,(const byte*)hpin+sizeof(HeapPageMgr::HeapObjHeader),PageAddrSize); fFwd=true; continue;
 		} else {
 			PID id; IdentityID iid;
 			if ((epr.flags&PINEX_EXTPID)!=0) ses->setExtAddr(PageAddr::noAddr);
 			if (hpin->hdr.getType()!=HO_PIN) return RC_CORRUPTED;
 			if (!hpin->getAddr(id)) {id.pid=uint64_t(addr); id.ident=STORE_OWNER;}
-			if (id==id) {
+			if (id.pid==this->id.pid) {
 				epr.flags|=PINEX_ADDRSET; rc=RC_OK;
 				if (isRemote(id)) {
 					//???
@@ -837,6 +882,8 @@ RC PINx::getBody(TVOp tvo,unsigned flags,VersionID vid)
 			}
 		}
 		if (!fTry) {
+			// the PIN could have been moved back to its home slot by heap compaction while the forward was followed
+			if (fFwd && nRetry++==0 && !isRemote(id) && addr.convert(id.pid)) {fFwd=false; continue;}
 			if (hpin!=NULL && (epr.flags&PINEX_EXTPID)==0) 
 				report(MSG_ERROR,"getBody: page %08X corruption\n",pb->getPageID());
 			return RC_NOTFOUND;
@@ -1001,7 +1048,7 @@ void PINx::copy(const PIN *pin,unsigned flags)
 	addr=pin->addr; properties=pin->properties; nProperties=pin->nProperties; mode=pin->mode; fNoFree=1; fPartial=0; meta=pin->meta; epr.buf[0]=0;
 	if (!id.isPID() && (pin->fPINx==0 || (((PINx*)pin)->epr.flags&(PINEX_DERIVED|PINEX_COMM))!=0)) epr.flags=PINEX_DERIVED;
 	else if (pin->fPINx!=0) {
-		const PINx *px=(const PINx *)pin; fPartial=px->fPartial; epr=px->epr; tv=px->tv; if (id.isEmpty() && epr.buf[0]!=0) unpack();
+		const PINx *px=(const PINx *)pin; fPartial=px->fPartial; epr=px->epr; releaseTV(); if ((tv=px->tv)!=NULL) tv->fix(); if (id.isEmpty() && epr.buf[0]!=0) unpack();
 		if (!px->pb.isNull() && pb.getPage(px->pb->getPageID(),px->pb->getPageMgr(),flags,ses)!=NULL) fill();
 	}
 }
@@ -1013,6 +1060,11 @@ void PINx::free()
 	//if (tv!=NULL) ???
 }
 
+void PINx::releaseTV()
+{
+	if (tv!=NULL) {tv->unfix(); tv=NULL;}
+}
+
 //------------------------------------------------------------------------------------------------
 
 static int __cdecl cmpValues(const void *v1, const void *v2)
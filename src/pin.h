@@ -121,6 +121,7 @@ public:
 	__forceinline const Value *findProperty(PropertyID pid) {const Value *pv=VBIN::find(pid,properties,nProperties); return pv!=NULL||fPartial==0?pv:loadProperty(pid);}
 	ElementID	getPrefix(StoreCtx *ctx) const {return !id.isPID()?ctx->getPrefix():StoreCtx::genPrefix(ushort(id.pid>>48));}
 	static PIN*	getPIN(const PID& id,VersionID vid,Session *ses,unsigned mode=0);
+	static RC	getPINs(const PID *ids,unsigned nIds,IPIN **pins,Session *ses,unsigned mode=0);
 	static const Value *findElement(const Value *pv,unsigned eid) {
 		assert(pv!=NULL && pv->type==VT_COLLECTION && !pv->isNav());
 		if (pv->length!=0) {
@@ -155,6 +156,8 @@ public:
 	friend	class	LoadOp;
 	friend	class	CommOp;
 	friend	class	BatchInsert;
+	friend	class	FTParseRQ;
+	friend	class	FTPipeline;
 	friend	class	StartListener;
 	friend	class	SOutCtx;
 	friend	class	Expr;
@@ -85,8 +85,9 @@ public:
 public:
 	PINx(Session *s,const PID& i) : PIN(s),LatchHolder(s),ses(s),hpin(NULL),tv(NULL) {id=i; fPINx=1; fPartial=1; epr.flags=0; epr.buf[0]=0;}
 	PINx(Session *s,const Value *pv=NULL,unsigned nv=0) : PIN(s,0,(Value*)pv,nv),LatchHolder(s),ses(s),hpin(NULL),tv(NULL) {fPINx=1; if (pv==NULL) fPartial=1; epr.flags=0; epr.buf[0]=0;}
-	~PINx()		{pb.release(ses); free();}
-	void		cleanup() {id=PIN::noPID; addr=PageAddr::noAddr; pb.release(ses); hpin=NULL; free(); tv=NULL; epr.flags=0; epr.buf[0]=0; fPartial=1;}
+	~PINx()		{pb.release(ses); free(); releaseTV();}
+	void		cleanup() {id=PIN::noPID; addr=PageAddr::noAddr; pb.release(ses); hpin=NULL; free(); releaseTV(); epr.flags=0; epr.buf[0]=0; fPartial=1;}
+	void		reset(const PID& pid) {id=pid; addr=PageAddr::noAddr; hpin=NULL; free(); releaseTV(); epr.flags=0; epr.buf[0]=0; fPartial=1;}	// keeps the page latched for the next PIN on the same page
 	void		setProps(const Value *props,unsigned nProps,bool f=true) {properties=(Value*)props; nProperties=nProps; fPartial=0; fNoFree=f?1:0;}	// meta?
 	void		resetProps() {if (properties!=NULL) {if (fNoFree==0) freeV((Value*)properties,nProperties,ses); properties=NULL; nProperties=0;} fPartial=1; meta=0;}
 	void		releaseLatches(PageID pid,PageMgr*,bool);
@@ -126,6 +127,7 @@ private:
 	RC			getRefSafe(const PID& id,Value *&vals,unsigned& nValues,unsigned mode);
 	RC			unpack() const;
 	void		free();
+	void		releaseTV();
 	friend	class	DataEvent;
 	friend	class	DataEventRegistry;
 	friend	class	DataEventMgr;
@@ -545,6 +545,8 @@ RC EncodePB::encode(unsigned char *buf,size_t& lbuf)
 				case 0: 
 					os.state++; sz64=os.str->length(); VAR_OUT(os.tag,afy_enc64,sz64);
 				case 1:
+					{size_t l; void *h; const void *ps;
+					while (po<end && (ps=os.str->getSlice(l,h))!=NULL) {if (l>size_t(end-po)) l=end-po; memcpy(po,ps,l); po+=l; os.str->releaseSlice(h,l);}}
 					sz=uint32_t(end-po); if ((i=(uint32_t)os.str->read(po,sz))>=sz) return RC_OK;
 					po+=i; break;
 				}
@@ -277,6 +277,12 @@ public:
 		}
 		return t;
 	}
+	T* pin(KeyArg key) {
+		typename QEHash::Find findQE(hashTable,key); T *t=NULL; QE *qe=findQE.findLock(RW_S_LOCK);
+		if (qe!=NULL && (t=qe->rsrc)!=NULL && !qe->fDiscard && qe->rc==RC_OK && !qe->lock.isXLocked()) ++qe->fixCount; else t=NULL;
+		findQE.unlock(); return t;
+	}
+	void unpin(T *t) {QE *qe=t->getQE(); assert(qe!=NULL && qe->mgr==this); release(t,qe);}
 	T* trylock(T *t,RW_LockType lt) {
 		QE *qe=t->getQE(); assert(qe!=NULL && !qe->fDiscard && qe->mgr==this);
 		hashTable.lock(qe,RW_X_LOCK); ++qe->fixCount;
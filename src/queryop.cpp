@@ -101,6 +101,16 @@ RC QueryOp::count(uint64_t& cnt,unsigned nAbort)
 	cnt=c; return rc==RC_EOF?RC_OK:rc;
 }
 
+uint64_t QueryOp::estimate()
+{
+	return ~0ULL;
+}
+
+RC QueryOp::aggregate(const Values&,AggAcc *)
+{
+	return RC_FALSE;
+}
+
 RC QueryOp::loadData(PINx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,MemAlloc *ma)
 {
 	return queryOp!=NULL?queryOp->loadData(qr,pv,nv,eid,fSort,ma):RC_NOTFOUND;
@@ -108,7 +108,9 @@ public:
 	virtual	RC			advance(const PINx *skip=NULL) = 0;
 	virtual	RC			rewind();
 	virtual	RC			count(uint64_t& cnt,unsigned nAbort=~0u);
+	virtual	uint64_t	estimate();
 	virtual	RC			loadData(PINx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
+	virtual	RC			aggregate(const Values& aggs,AggAcc *ac);
 	virtual	void		unique(bool);
 	virtual	void		reverse();
 	virtual	void		print(SOutCtx& buf,int level) const;
@@ -169,6 +171,7 @@ public:
 	RC			advance(const PINx *skip=NULL);
 	RC			rewind();
 	RC			count(uint64_t& cnt,unsigned nAbort=~0u);
+	uint64_t	estimate();
 	void		print(SOutCtx& buf,int level) const;
 };
 
@@ -205,6 +208,7 @@ class IndexScan : public QueryOp
 	Value				*vals;
 	void				initInfo();
 	RC					setScan(unsigned=0);
+	bool				isExact(unsigned i) const;
 	void				printKey(const SearchKey& key,SOutCtx& buf,const char *def,size_t ldef) const;
 public:
 	IndexScan(EvalCtx *qx,DataIndex& idx,unsigned flg,unsigned np,unsigned md);
@@ -214,7 +218,9 @@ public:
 	RC					advance(const PINx *skip=NULL);
 	RC					rewind();
 	RC					count(uint64_t& cnt,unsigned nAbort=~0u);
+	uint64_t			estimate();
 	RC					loadData(PINx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
+	RC					aggregate(const Values& aggs,AggAcc *ac);
 	void				unique(bool);
 	void				reverse();
 	void				print(SOutCtx& buf,int level) const;
@@ -99,6 +99,7 @@ class QueryPrc
 	RC		findCandidateSSVs(CandidateSSVs& cs,const Value *pv,unsigned nv,bool fSplit,MemAlloc *ma,const AllocCtrl *act=NULL,PropertyID=STORE_INVALID_URIID,struct ModInfo *mi=NULL);
 	RC		persistValue(const Value& v,ushort& sht,HType& vt,ushort& offs,byte *buf,size_t *plrec,const PageAddr &addr,ElementID *keygen=NULL,MemAlloc *pinAlloc=NULL);
 	RC		putHeapMod(HeapPageMgr::HeapPropMod *hpm,struct ModInfo *pm,byte *buf,ushort& sht,PINx&,bool=false);
+	RC		modifyInPlace(const EvalCtx& ectx,PINx& cb,const Value& v,PIN *pin);
 
 private:
 	IStoreNotification	*const	notification;
@@ -118,9 +119,10 @@ public:
 	RC		modifyPIN(const EvalCtx& ectx,const PID& id,const Value *v,unsigned nv,PINx *pcb,PIN *pin=NULL,unsigned mode=0,const ElementID *eids=NULL,unsigned* =NULL);
 	RC		deletePINs(const EvalCtx& ectx,const PIN *const *pins,const PID *pids,unsigned nPins,unsigned mode,PINx *pcb=NULL);
 	RC		undeletePINs(const EvalCtx& ectx,const PID *pids,unsigned nPins);
+	RC		relocatePIN(Session *ses,const PageAddr& home);
 	RC		loadData(const PageAddr& addr,byte *&p,size_t& len,MemAlloc *ma);
 	RC		persistData(IStream *stream,const byte *str,size_t lstr,PageAddr& addr,uint64_t&,const PageAddr* =NULL,PBlockP* =NULL);
-	RC		deleteData(const PageAddr& addr,Session *ses=NULL,PBlockP *pbp=NULL);
+	RC		deleteData(const PageAddr& addr,Session *ses=NULL,PBlockP *pbp=NULL,bool fDedup=true);
 	bool	test(PIN *,DataEventID,const EvalCtx& ectx,bool fIgnore=false);
 	RC		transform(const PINx **vars,unsigned nVars,PIN **pins,unsigned nPins,unsigned &nOut,Session*) const;
 	RC		getDataEventInfo(Session *ses,PIN *pin);
@@ -212,6 +212,11 @@ RC ClassScan::count(uint64_t& cnt,unsigned nAbort)
 	return rc;
 }
 
+uint64_t ClassScan::estimate()
+{
+	uint64_t cnt; return meta!=0?~0ULL:count(cnt)==RC_OK?cnt:~0ULL;
+}
+
 void ClassScan::print(SOutCtx& buf,int level) const
 {
 	buf.fill('\t',level); buf.append("class: ",7);
@@ -308,6 +313,7 @@ IndexScan::IndexScan(EvalCtx *qc,DataIndex& idx,unsigned flg,unsigned nr,unsigne
 			if (j>=pl.nProps) {pl.props[pl.nProps++]=is.propID; break;} else if (is.propID==pl.props[j]) break;
 			else if (is.propID<pl.props[j]) {memmove(&pl.props[j+1],&pl.props[j],(pl.nProps-j)*sizeof(PropertyID)); pl.props[j]=is.propID; pl.nProps++; break;}
 	}
+	if ((index.indexSegs[0].flags&SEG_ZORDER)!=0) {sort=NULL; nSegs=0;}		// Z-order keys are not sorted by any of the segments
 	if (qc->ses->getIdentity()!=STORE_OWNER && (((DataEvent&)idx).getFlags()&META_PROP_ACL)!=0) {
 		//
 	}
@@ -391,9 +397,35 @@ RC IndexScan::rewind()
 	return rc;
 }
 
+bool IndexScan::isExact(unsigned i) const
+{
+	const SearchKey *key=&((const SearchKey*)(this+1))[i*2];
+	return (flags&(SCAN_PREFIX|SCAN_EXCLUDE_START|SCAN_EXCLUDE_END))==0 && key[0].isSet() && key[1].isSet() && key[0].cmp(key[1])==0;
+}
+
+uint64_t IndexScan::estimate()
+{
+	if (nRanges!=0) {
+		// exact keys: value counts are kept in leaf entries and secondary tree headers
+		uint64_t est=0,n; unsigned i=0;
+		for (; i<nRanges && isExact(i); i++) if (index.countValues(((const SearchKey*)(this+1))[i*2],n)==RC_OK) est+=n;
+		if (i>=nRanges) return est;
+	}
+	const KeyStats *ks=index.getStats(); if (ks==NULL || (index.indexSegs[0].flags&SEG_ZORDER)!=0) return ~0ULL;
+	if (nRanges==0) return ks->getNValues(); const SearchKey *keys=(const SearchKey*)(this+1); uint64_t est=0;
+	for (unsigned i=0; i<nRanges; i++) est+=ks->estimate(&keys[i*2],&keys[i*2+1]);
+	return min(est,ks->getNValues());
+}
+
 RC IndexScan::count(uint64_t& cnt,unsigned nAbort)
 {
 	uint64_t c=0; RC rc=RC_EOF; PINx cb(ctx->ses);
+	if ((state&QST_INIT)!=0 && nSkip==0 && nRanges==1 && isExact(0)) {
+		// one key: the count is taken from the leaf entry or the secondary tree header, O(log n) page reads
+		if ((rc=index.countValues(*(const SearchKey*)(this+1),c))==RC_NOTFOUND) {c=0; rc=RC_OK;}
+		if (rc==RC_OK) {cnt=c; return c>=nAbort?RC_TIMEOUT:RC_OK;}
+		c=0; rc=RC_EOF;
+	}
 	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if ((rc=init())!=RC_OK) return rc;}
 	while (scan!=NULL) {
 		size_t l; const byte *er; rc=RC_OK;
@@ -414,6 +446,51 @@ RC IndexScan::count(uint64_t& cnt,unsigned nAbort)
 	cnt=c; return rc;
 }
 
+/**
+ * index-only aggregation over a whole family index
+ * the leaves of a family index hold one (key,PIN) entry per indexed value, i.e. they form the column of the indexed properties
+ * for all PINs of the family; every key is decoded once and folded into the accumulators together with the number of its values
+ */
+RC IndexScan::aggregate(const Values& aggs,AggAcc *ac)
+{
+	const IndexSeg *is=index.getIndexSegs(); const unsigned nsg=index.getNSegs(); unsigned *sg; Value *kv;
+	if ((state&QST_INIT)==0 || nSkip!=0 || nRanges!=0 || aggs.nValues==0 || index.fmt.keyType()==KT_ALL || ctx->ses->getIdentity()!=STORE_OWNER) return RC_FALSE;
+	if ((sg=(unsigned*)alloca(aggs.nValues*sizeof(unsigned)))==NULL || (kv=(Value*)alloca(nsg*sizeof(Value)))==NULL) return RC_NOMEM;
+	for (unsigned i=0; i<aggs.nValues; i++) {
+		const Value& v=aggs.vals[i]; const ExprOp op=ac[i].op;
+		if (v.type!=VT_VARREF || v.refV.refN!=0 || v.length==0 || (v.refV.flags&VAR_TYPE_MASK)!=0 || v.eid!=STORE_COLLECTION_ID || ac[i].flags!=0) return RC_FALSE;
+		if (op!=OP_COUNT && op!=OP_MIN && op!=OP_MAX && unsigned(op-OP_SUM)>unsigned(OP_STDDEV_SAMP-OP_SUM)) return RC_FALSE;
+		for (sg[i]=0; sg[i]<nsg && is[sg[i]].propID!=v.refV.id; sg[i]++);
+		if (sg[i]>=nsg) return RC_FALSE;
+	}
+	struct KeyCB : public IKeyCallback {bool fNew; KeyCB() : fNew(false) {} void newKey() {fNew=true;}} kcb;
+	TreeScan *ts=index.scan(ctx->ses,NULL,NULL,flags,is,nsg,&kcb); if (ts==NULL) return RC_NOMEM;
+	for (unsigned i=0; i<nsg; i++) kv[i].setError(is[i].propID);
+	uint64_t n=0,nRows=0; size_t l; const byte *er; RC rc=RC_OK;
+	for (;;) {
+		er=(const byte*)ts->nextValue(l);
+		if (kcb.fNew || er==NULL) {
+			if (n!=0) {for (unsigned i=0; i<aggs.nValues; i++) if (kv[sg[i]].type!=VT_ERROR && kv[sg[i]].type!=VT_ANY && (rc=ac[i].next(kv[sg[i]],n))!=RC_OK) break; nRows+=n; n=0;}
+			if (er==NULL || rc!=RC_OK || (rc=ctx->ses->testAbortQ())!=RC_OK) break;
+			for (unsigned i=0; i<nsg; i++) {freeV(kv[i]); kv[i].setError(is[i].propID);}
+			if ((rc=ts->getKey().getValues(kv,nsg,is,nsg,ctx->ses))!=RC_OK) break; kcb.fNew=false;
+		}
+		if ((qflags&QO_HIDDEN)==0 && PINRef::isHidden(er)) continue;
+		if ((qflags&(QO_RAW|QO_FORUPDATE))==0 && PINRef::isSpecial(er)) {rc=RC_FALSE; break;}
+		if ((qflags&QO_UNIQUE)!=0 && PINRef::isColl(er)) {
+			PINx pex(ctx->ses); memcpy(pex.epr.buf,er,l);
+			if (pids!=NULL) {if ((*pids)[pex]) continue;}
+			else if ((pids=new(ctx->ma) PIDStore(ctx->ses))==NULL) {rc=RC_NOMEM; break;}
+			(*pids)+=pex;
+		}
+		n++;
+	}
+	ts->destroy(); for (unsigned i=0; i<nsg; i++) freeV(kv[i]);
+	if (pids!=NULL) {pids->~PIDStore(); pids=NULL;}
+	if (rc==RC_FALSE) {for (unsigned i=0; i<aggs.nValues; i++) ac[i].reset(); return RC_FALSE;}		// communication PINs: fall back to row-by-row processing
+	state=state&~QST_INIT|QST_EOF; return rc!=RC_OK?rc:nRows!=0?RC_OK:RC_EOF;
+}
+
 RC IndexScan::loadData(PINx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,MemAlloc *ma)
 {
 	if (scan==NULL) return RC_NOTFOUND;
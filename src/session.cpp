@@ -195,7 +195,7 @@ Session::Session(StoreCtx *ct,MemAlloc *ma)
 	: ctx(ct),mem(ma),txid(INVALID_TXID),txcid(NO_TXCID),txState(TX_NOTRAN),sFlags(0),identity(STORE_INVALID_IDENTITY),list(this),lockReq(this),heldLocks(NULL),latched(NULL),nLatched(0),xLatched(0),
 	firstLSN(0),undoNextLSN(0),flushLSN(0),sesLSN(0),nLogRecs(0),tx(this),subTxCnt(0),mini(NULL),nTotalIns(0),xHeapPage(INVALID_PAGEID),forcedPage(INVALID_PAGEID),
 	classLocked(RW_NO_LOCK),fAbort(false),repl(NULL),itf(0),xOnCommit(DEFAULT_MAX_ON_COMMIT),nSyncStack(0),xSyncStack(DEFAULT_MAX_SYNC_ACTION),
-	nSesObjects(0),xSesObjects(DEFAULT_MAX_OBJ_SESSION),serviceTab(NULL),iTrace(NULL),traceMode(0),codeTrace(0),nSrvCtx(0),xSrvCtx(MAX_SERV_CTX),active(NULL),defExpiration(0),tzShift(0)
+	nSesObjects(0),xSesObjects(DEFAULT_MAX_OBJ_SESSION),serviceTab(NULL),iTrace(NULL),iProgress(NULL),traceMode(0),codeTrace(0),nSrvCtx(0),xSrvCtx(MAX_SERV_CTX),active(NULL),defExpiration(0),tzShift(0)
 {
 	extAddr.pageID=INVALID_PAGEID; extAddr.idx=INVALID_INDEX;
 #ifdef WIN32
@@ -318,6 +318,11 @@ void Session::setTrace(ITrace *trc)
 	try {iTrace=trc;} catch (...) {report(MSG_ERROR,"Exception in ISession::setTrace()\n");}
 }
 
+void Session::setIndexProgress(IIndexProgress *prg)
+{
+	try {iProgress=prg;} catch (...) {report(MSG_ERROR,"Exception in ISession::setIndexProgress()\n");}
+}
+
 void Session::changeTraceMode(unsigned mask,bool fReset)
 {
 	try {if (fReset) traceMode&=~mask; else traceMode|=mask;} catch (...) {report(MSG_ERROR,"Exception in ISession::changeTraceMode()\n");}
@@ -655,6 +660,12 @@ IPIN *Session::getPIN(const Value& v,unsigned md)
 	return NULL;
 }
 
+RC Session::getPINs(const PID *ids,unsigned nIds,IPIN **pins,unsigned md)
+{
+	try {return ctx->inShutdown()?RC_SHUTDOWN:PIN::getPINs(ids,nIds,pins,this,md|LOAD_EXT_ADDR|LOAD_CLIENT);}
+	catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::getPINs(...)\n"); return RC_INTERNAL;}
+}
+
 RC Session::getValue(Value& res,const PID& id,PropertyID pid,ElementID eid)
 {
 	try {
@@ -52,6 +52,8 @@ class	PIN;
 #define PRCF_CMPXCHG16B		0x00000001
 #define PRCF_AESNI			0x00000002
 #define	PRCF_PCLMULQDQ		0x00000004
+#define	PRCF_SSE42			0x00000008
+#define	PRCF_AVX2			0x00000010
 
 struct ProcFlags
 {
@@ -410,6 +412,19 @@ struct TxReuse
 	void			cleanup() {if (pinPages!=NULL) {free(pinPages,SES_HEAP); pinPages=NULL;} if (ssvPages!=NULL) {free(ssvPages,SES_HEAP); ssvPages=NULL;} nPINPages=nSSVPages=0;}
 };
 
+/**
+ * change of the dedup index of SSV/BLOB values (see BigMgr) made by a transaction
+ * registrations and releases are applied after commit, acquired references are dropped on rollback
+ */
+struct DedupOp
+{
+	enum DedupOpType {DDP_REGISTER, DDP_ACQUIRED, DDP_RELEASE};
+	DedupOp			*next;
+	DedupOpType		op;
+	PageAddr		addr;
+	byte			digest[SHA_DIGEST_BYTES];
+};
+
 class	TxIndex;
 typedef	SimpleQueue<OnCommit,&OnCommit::next> OnCommitQ;
 
@@ -426,6 +441,7 @@ struct SubTx
 	OnCommitQ	onCommit;
 	TxIndex		*txIndex;
 	TxPurgeArr	txPurge;
+	DedupOp		*dedup;
 	PageSet		defHeap;
 	PageSet		defClass;
 	PageSet		defFree;
@@ -437,6 +453,7 @@ struct SubTx
 	RC			addToHeap(const PageID *pids,unsigned nPages,bool fC) {return fC?defClass.add(pids,nPages):defHeap.add(pids,nPages);}
 	bool		testHeap(PageID pid) {for (SubTx *tx=this; tx!=NULL; tx=tx->next) if (tx->defHeap[pid]) return true; return false;}
 	RC			queueForPurge(const PageAddr& addr,PurgeType pt,const void *data);
+	void		finishDedup(bool fCommit);
 	void		cleanup();
 };
 
@@ -496,7 +513,7 @@ class Session : public MemAlloc, public ISession
 	class MiniTx	*mini;
 	TxReuse			reuse;
 	unsigned		nTotalIns;
-	PageID			xHeapPage;
+	PageID			xHeapPage;		/**< heap page this session inserted into last, retried first by the next insert */
 	PageID			forcedPage;
 	RW_LockType		classLocked;
 	volatile bool	fAbort;
@@ -509,6 +526,7 @@ class Session : public MemAlloc, public ISession
 
 	ServiceTab		*serviceTab;
 	ITrace			*iTrace;
+	IIndexProgress	*iProgress;
 	unsigned		traceMode;
 	uint64_t		codeTrace;
 
@@ -567,6 +585,8 @@ public:
 	void			removeServiceCtx(const PID& id);
 	
 	void			setTrace(ITrace *trc);
+	void			setIndexProgress(IIndexProgress *prg);
+	IIndexProgress	*getIndexProgress() const {return iProgress;}
 	void			changeTraceMode(unsigned mask,bool fReset);
 	unsigned		getTraceMode() const {return traceMode;}
 	void			trace(long code,const char *msg,...);
@@ -670,6 +690,7 @@ public:
 
 	IPIN			*getPIN(const PID& id,unsigned=0);
 	IPIN			*getPIN(const Value& id,unsigned=0);
+	RC				getPINs(const PID *ids,unsigned nIds,IPIN **pins,unsigned=0);
 	RC				getValue(Value& res,const PID& id,PropertyID,ElementID=STORE_COLLECTION_ID);
 	RC				getPINEvents(DataEventID *&devs,unsigned& ndevs,const PID& id);
 	bool			isCached(const PID& id);
@@ -732,6 +753,7 @@ public:
 	friend	class	PINPageMgr;
 	friend	class	SSVPageMgr;
 	friend	class	QueryPrc;
+	friend	class	BigMgr;
 	friend	class	SInCtx;
 	friend	class	SOutCtx;
 	friend	class	DataEventMgr;
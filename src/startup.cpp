@@ -159,7 +159,19 @@ ProcFlags::ProcFlags() : flg(0)
 #endif
 	if ((CPUInfo[2]&0x2)!=0) flg|=PRCF_PCLMULQDQ;
 	if ((CPUInfo[2]&0x2000)!=0) flg|=PRCF_CMPXCHG16B;
+	if ((CPUInfo[2]&0x100000)!=0) flg|=PRCF_SSE42;
 	if ((CPUInfo[2]&0x2000000)!=0) flg|=PRCF_AESNI;
+	if ((CPUInfo[2]&0x18000000)==0x18000000) {		// OSXSAVE and AVX, check that OS saves YMM state
+#if defined(_M_X64) || defined(_M_AMD64)
+		if ((_xgetbv(0)&6)==6) {__cpuidex(CPUInfo,7,0); if ((CPUInfo[1]&0x20)!=0) flg|=PRCF_AVX2;}
+#elif defined(__x86_64__)
+		uint32_t xcr0,xcr0h; __asm__ __volatile__ ("xgetbv":"=a" (xcr0), "=d" (xcr0h) : "c" (0));
+		if ((xcr0&6)==6) {
+			__asm__ __volatile__ ("cpuid":"=a" (CPUInfo[0]), "=b" (CPUInfo[1]), "=c" (CPUInfo[2]), "=d" (CPUInfo[3]) : "a" (7), "c" (0));
+			if ((CPUInfo[1]&0x20)!=0) flg|=PRCF_AVX2;
+		}
+#endif
+	}
 #endif
 }
 
@@ -340,7 +352,7 @@ RC openStore(const StartupParameters& params,IAffinity *&aff)
 			}
 			Session::terminateSession();
 		} else if ((params.mode&STARTUP_RT)!=0 && (rc=ctx->logMgr->init())!=RC_OK) {report(MSG_CRIT,"Cannot initialize logging(%d)\n",rc); throw rc;}
-		else {ctx->theCB->preload(ctx); ctx->heapMgr->initPartial(); ctx->ssvMgr->initPartial();}
+		else {ctx->theCB->preload(ctx); HeapPageMgr::initPartial(ctx->heapMgr,ctx->ssvMgr);}
 
 		if ((rc=ctx->namedMgr->initStorePrefix())!=RC_OK) {report(MSG_CRIT,"Cannot initialize store prefix(%d)\n",rc); throw rc;}
 
@@ -542,6 +554,8 @@ RC getStoreCreationParameters(StoreCreationParameters& params,IAffinity *aff)
 		params.password=NULL;
 		params.mode=(ctx->theCB->flags&STFLG_ENCRYPTED)!=0?STORE_CREATE_ENCRYPTED:0;
 		if ((ctx->theCB->flags&STFLG_PAGEHMAC)!=0) params.mode|=STORE_CREATE_PAGE_INTEGRITY;
+		if ((ctx->theCB->flags&STFLG_COMPRESSED)!=0) params.mode|=STORE_CREATE_PAGE_COMPRESSION;
+		if ((ctx->theCB->flags&STFLG_DEDUP)!=0) params.mode|=STORE_CREATE_DEDUP;
 		params.maxSize=ctx->theCB->maxSize;
 		params.pctFree=ctx->theCB->pctFree;
 		params.logSegSize=ctx->theCB->logSegSize;
@@ -611,6 +625,7 @@ RC StoreCtx::shutdown()
 		}
 
 		shutdownServices();
+		HeapPageMgr::savePartial(heapMgr,ssvMgr);
 
 		netMgr->close();		//make all close() -> RC
 		fsMgr->close();
@@ -620,6 +635,7 @@ RC StoreCtx::shutdown()
 		}
 
 		if ((mode&STARTUP_PRINT_STATS)!=0) {
+			HeapPageMgr::reportCompression(heapMgr,ssvMgr); heapMgr->reportCompaction();
 			Session *ses=Session::createSession(this);
 			reportTree(theCB->mapRoots[MA_FTINDEX],"FT",this);
 			reportTree(theCB->mapRoots[MA_DATAEVENTINDEX],"DataEvent",this);
@@ -646,7 +662,6 @@ RC StoreCtx::shutdown()
 		if ((rc=bufMgr->close(0,true))!=RC_OK) return rc;
 		if ((rc=logMgr->close())!=RC_OK) return rc;
 
-		HeapPageMgr::savePartial(heapMgr,ssvMgr);
 		theCB->xPropID=namedMgr->getXPropID();
 
 		bool fDelLog=false;
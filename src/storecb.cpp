@@ -103,6 +103,8 @@ RC StoreCB::create(StoreCtx *ctx,const char *fname,const StoreCreationParameters
 	if ((cpar.mode&STORE_CREATE_ENCRYPTED)!=0) theCB->flags|=STFLG_ENCRYPTED;
 	if ((cpar.mode&STORE_CREATE_PAGE_INTEGRITY)!=0) theCB->flags|=STFLG_PAGEHMAC;
 	if ((cpar.mode&STORE_CREATE_NO_PREFIX)!=0) theCB->flags|=STFLG_NO_PREFIX;
+	if ((cpar.mode&STORE_CREATE_PAGE_COMPRESSION)!=0) theCB->flags|=STFLG_COMPRESSED;
+	if ((cpar.mode&STORE_CREATE_DEDUP)!=0) theCB->flags|=STFLG_DEDUP;
 	ctx->cryptoMgr->randomBytes(theCB->encKey,ENC_KEY_SIZE);
 	memcpy(ctx->encKey,theCB->encKey,ENC_KEY_SIZE);
 	SHA256 pub; pub.add(ctx->encKey,ENC_KEY_SIZE);
@@ -141,7 +143,7 @@ void StoreCB::preload(StoreCtx *ctx) const
 	static const PGID mapRootsPGIDs[MA_ALL]={
 		PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,
 		PGID_INDEX,PGID_INDEX,PGID_HEAPDIR,PGID_HEAPDIR,PGID_HEAPDIR,PGID_HEAPDIR,
-		PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL};
+		PGID_FSPACE,PGID_INDEX,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL};
 	PageID pages[MA_ALL]; PageMgr *pmgrs[MA_ALL]; unsigned cnt=0;
 	for (unsigned i=0; i<MA_ALL; i++) if (mapRoots[i]!=INVALID_PAGEID)
 		{pages[cnt]=mapRoots[i]; pmgrs[cnt]=ctx->getPageMgr(mapRootsPGIDs[i]); cnt++;}
@@ -48,6 +48,8 @@ namespace AfyKernel
 #define	STFLG_ENCRYPTED		0x0001
 #define	STFLG_PAGEHMAC		0x0002
 #define	STFLG_NO_PREFIX		0x0004
+#define	STFLG_COMPRESSED	0x0008
+#define	STFLG_DEDUP			0x0010
 
 /**
  * store state enumeration
@@ -78,7 +80,9 @@ enum MapAnchor
 	MA_PINEXTURI,						/**< PIN external URI map root page (not implemented yet) */
 	MA_HEAPDIRFIRST, MA_HEAPDIRLAST,	/**< first and last pages in the directory of heap pages */
 	MA_DATAEVENTDIRFIRST, MA_DATAEVENTDIRLAST,	/**< first and last pages in the directory of data event PIN pages */
-	MA_RESERVED1, MA_RESERVED2, MA_RESERVED3, MA_RESERVED4, MA_RESERVED5, MA_RESERVED6, MA_RESERVED7, MA_RESERVED8,		/**< reserved for future use */
+	MA_FREESPACE,						/**< first page of the persistent free space map */
+	MA_DEDUP,							/**< SSV/BLOB deduplication index root page */
+	MA_RESERVED3, MA_RESERVED4, MA_RESERVED5, MA_RESERVED6, MA_RESERVED7, MA_RESERVED8,		/**< reserved for future use */
 	MA_ALL
 };
 
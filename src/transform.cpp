@@ -82,10 +82,14 @@ RC TransOp::init()
 
 RC TransOp::advance(const PINx *)
 {
-	RC rc=RC_OK; Value *newV=NULL;
+	RC rc=RC_OK; Value *newV=NULL; bool fAgg=false;
 	if (queryOp==NULL) state|=QST_EOF;
-	else for (;;) {
-		if ((rc=queryOp->next())!=RC_OK) {
+	else if ((state&QST_BOF)!=0 && nGroup==0 && ac!=NULL && nIns==1 && (qflags&(QO_AUGMENT|QO_LOADALL))==0 && (rc=queryOp->aggregate(aggs,ac))!=RC_FALSE) {
+		// aggregates computed by the source operator without producing rows
+		if (rc!=RC_OK) {state|=QST_EOF; return rc;} fAgg=true; state&=~QST_BOF;
+	}
+	if (queryOp!=NULL) for (;;) {
+		if ((rc=fAgg?RC_EOF:queryOp->next())!=RC_OK) {
 			state|=QST_EOF; if (rc!=RC_EOF || nGroup+aggs.nValues==0 || (state&QST_BOF)!=0) return rc;
 			for (unsigned i=0; i<aggs.nValues; i++) {
 				if (nGroup!=0) freeV((Value&)ctx->params[QV_AGGS].vals[i]);
@@ -26,6 +26,7 @@ Written by Mark Venguerov 2004-2014
 #include "startup.h"
 #include "fsmgr.h"
 #include "dataevent.h"
+#include "blob.h"
 
 using namespace Afy;
 using namespace AfyKernel;
@@ -120,6 +121,18 @@ void TxMgr::releaseSnapshot(TXCID txcid)
 	}
 }
 
+LSN TxMgr::getOldestLSN()
+{
+	// first log record of the oldest transaction which can still be rolled back, including transactions suspended by mini-transactions
+	LSN oldest(~0ULL); MutexP lck(&lock);
+	for (HChain<Session>::it it(&activeList); ++it; ) {
+		Session *ses=it.get(); if (!ses->firstLSN.isNull() && ses->firstLSN<oldest) oldest=ses->firstLSN;
+		for (MiniTx *mtx=ses->mini; mtx!=NULL; mtx=mtx->next)
+			if ((mtx->state&TX_WASINLIST)!=0 && !mtx->firstLSN.isNull() && mtx->firstLSN<oldest) oldest=mtx->firstLSN;
+	}
+	return oldest;
+}
+
 //--------------------------------------------------------------------------------------------------------
 
 RC TxMgr::start(Session *ses,unsigned flags)
@@ -179,9 +192,10 @@ RC TxMgr::commit(Session *ses,bool fAll,bool fFlush)
 			if (fUnlock) ctx->fsMgr->txUnlock();
 	// unlock dirHeap
 			if (ses->reuse.pinPages!=NULL) for (unsigned i=0; i<ses->reuse.nPINPages; i++)
-				ctx->heapMgr->HeapPageMgr::reuse(ses->reuse.pinPages[i].pid,ses->reuse.pinPages[i].space,ctx);
+				ctx->heapMgr->HeapPageMgr::reuse(ses->xHeapPage=ses->reuse.pinPages[i].pid,ses->reuse.pinPages[i].space,ctx);
 			if (ses->reuse.ssvPages!=NULL) for (unsigned i=0; i<ses->reuse.nSSVPages; i++)
 				ctx->ssvMgr->HeapPageMgr::reuse(ses->reuse.ssvPages[i].pid,ses->reuse.ssvPages[i].space,ctx);
+			ses->tx.finishDedup(true);
 			ses->txState=ses->txState&~0xFFFFul|TX_COMMITTED;
 			if (ses->repl!=NULL) {
 				// pass replication stream to ctx->queryMgr->replication
@@ -210,7 +224,7 @@ RC TxMgr::abort(Session *ses,AbortType at)
 		else if (at!=TXA_ALL) ses->txState=save;
 	} while (at==TXA_EXTERNAL && (save&TX_INTERNAL)!=0);
 	if (at==TXA_ALL) {
-		assert(ses->tx.next==NULL);
+		assert(ses->tx.next==NULL); ses->tx.finishDedup(false);
 		if ((ses->txState&TX_READONLY)==0 && !ses->firstLSN.isNull()) abortLSN=ctx->logMgr->insert(ses,LR_ABORT);
 		ses->txState=ses->txState&~0xFFFFul|TX_ABORTED; cleanup(ses,true);
 	}
@@ -222,7 +236,7 @@ void TxMgr::cleanup(Session *ses,bool fAbort)
 {
 	if (ses->heldLocks!=NULL) ctx->lockMgr->releaseLocks(ses,0,fAbort); ses->unlockClass();
 	if (ses->tx.next!=NULL) ses->popTx(false,true); ses->tx.defFree.cleanup(); ses->tx.cleanup(); ses->reuse.cleanup();
-	ses->xHeapPage=INVALID_PAGEID; ses->nTotalIns=0; delete ses->repl; ses->repl=NULL;
+	if (fAbort) ses->xHeapPage=INVALID_PAGEID; ses->nTotalIns=0; delete ses->repl; ses->repl=NULL;
 	if (ses->getTxState()!=TX_NOTRAN) {
 		if ((ses->txState&TX_READONLY)==0) {
 			MutexP lck(&lock); assert(ses->txcid==NO_TXCID); assert(nActive>0 && ses->list.isInList()); 
@@ -378,14 +392,18 @@ RC Session::popTx(bool fCommit,bool fAll)
 			st->defHeap+=tx.defHeap; st->defClass+=tx.defClass; st->defFree+=tx.defFree; st->nInserted+=tx.nInserted;
 			if (tx.txPurge!=0) {RC rc=st->txPurge.merge(tx.txPurge); if (rc!=RC_OK) return rc;}
 			if (tx.onCommit.head!=NULL) {st->onCommit+=tx.onCommit; tx.onCommit.reset();}
+			if (tx.dedup!=NULL) {DedupOp *dop=tx.dedup; while (dop->next!=NULL) dop=dop->next; dop->next=st->dedup; st->dedup=tx.dedup; tx.dedup=NULL;}
 			if (tx.txIndex!=NULL) {
 				// txIndex!!! merge to st
 				tx.txIndex=NULL;
 			}
-		} else if (fAll) st->nInserted=nTotalIns=0;
-		else {
-			ctx->lockMgr->releaseLocks(this,tx.subTxID,true); st->nInserted-=tx.nInserted; nTotalIns-=tx.nInserted;
-			if (repl!=NULL) repl->truncate(TR_REL_ALL,&tx.rmark);
+		} else {
+			tx.finishDedup(false);
+			if (fAll) st->nInserted=nTotalIns=0;
+			else {
+				ctx->lockMgr->releaseLocks(this,tx.subTxID,true); st->nInserted-=tx.nInserted; nTotalIns-=tx.nInserted;
+				if (repl!=NULL) repl->truncate(TR_REL_ALL,&tx.rmark);
+			}
 		}
 		st->lastLSN=tx.lastLSN;	//???
 		tx.next=NULL; tx.~SubTx(); memcpy(&tx,st,sizeof(SubTx)); free(st); if (!fAll) break;
@@ -393,7 +411,7 @@ RC Session::popTx(bool fCommit,bool fAll)
 	return RC_OK;
 }
 
-SubTx::SubTx(Session *s) : next(NULL),ses(s),subTxID(0),lastLSN(0),txIndex(NULL),txPurge((MemAlloc*)s),defHeap(s),defClass(s),defFree(s),nInserted(0)
+SubTx::SubTx(Session *s) : next(NULL),ses(s),subTxID(0),lastLSN(0),txIndex(NULL),txPurge((MemAlloc*)s),dedup(NULL),defHeap(s),defClass(s),defFree(s),nInserted(0)
 {
 }
 
@@ -401,15 +419,22 @@ SubTx::~SubTx()
 {
 	for (unsigned i=0,j=(unsigned)txPurge; i<j; i++) if (txPurge[i].bmp!=NULL) ses->free(txPurge[i].bmp);
 	for (OnCommit *oc=onCommit.head,*oc2; oc!=NULL; oc=oc2) {oc2=oc->next; oc->destroy(ses);}
+	for (DedupOp *dop=dedup,*dop2; dop!=NULL; dop=dop2) {dop2=dop->next; ses->free(dop);}
 	//delete txIndex;
 }
 
+void SubTx::finishDedup(bool fCommit)
+{
+	if (dedup!=NULL) {DedupOp *dl=dedup; dedup=NULL; ses->getStore()->bigMgr->finishDedup(ses,dl,fCommit);}
+}
+
 void SubTx::cleanup()
 {
 	if (next!=NULL) {next->cleanup(); next->~SubTx(); ses->free(next); next=NULL;}
 	for (OnCommit *oc=onCommit.head,*oc2; oc!=NULL; oc=oc2) {oc2=oc->next; oc->destroy(ses);}
 	for (unsigned i=0,j=(unsigned)txPurge; i<j; i++) if (txPurge[i].bmp!=NULL) ses->free(txPurge[i].bmp);
-	txPurge.clear(); onCommit.reset();
+	for (DedupOp *dop=dedup,*dop2; dop!=NULL; dop=dop2) {dop2=dop->next; ses->free(dop);}
+	txPurge.clear(); onCommit.reset(); dedup=NULL;
 	if (txIndex!=NULL) {
 		//...
 	}
@@ -90,6 +90,7 @@ public:
 	RC				commitTx(Session *ses,bool fAll);
 	TXCID			assignSnapshot();
 	void			releaseSnapshot(TXCID);
+	LSN				getOldestLSN();
 
 	RC				update(class PBlock *pb,PageMgr *,unsigned info,const byte *rec=NULL,size_t lrec=0,uint32_t f=0,class PBlock *newp=NULL) const;
 	TXID			getLastTXID() {lock.lock(); TXID txid=++nextTXID; lock.unlock(); return txid;}
@@ -528,12 +528,19 @@ RC AfyKernel::streamToValue(IStream *stream,Value& val,MemAlloc *ma)
 		val.setError();
 		if (ma==NULL && (ma=Session::getSession())==NULL && (ma=StoreCtx::get())==NULL) return RC_NOSESSION;
 		val.type=stream->dataType(); val.flags=ma->getAType();
-		byte buf[256],*p; size_t l=stream->read(buf,sizeof(buf)),xl=1024,extra=val.type==VT_BSTR?0:1; RC rc;
-		if ((p=(byte*)ma->malloc(l>=sizeof(buf)?xl:l+extra))==NULL) return RC_NOMEM;
-		memcpy(p,buf,l);
-		if (l>=sizeof(buf)) {
-			while ((l+=stream->read(p+l,xl-l))>=xl) if ((p=(byte*)ma->realloc(p,xl+=xl/2))==NULL) return RC_NOMEM;
-			if (l+extra!=xl && (p=(byte*)ma->realloc(p,l+extra))==NULL) return RC_NOMEM;
+		byte buf[256],*p; size_t l,xl=1024,extra=val.type==VT_BSTR?0:1; RC rc; const uint64_t ls=stream->length();
+		if (ls!=0 && ls<0x40000000) {
+			// length is known: read directly into the result, without intermediate copies; 0 may mean 'unknown'
+			if ((p=(byte*)ma->malloc(xl=size_t(ls)+1))==NULL) return RC_NOMEM;
+			for (l=0; (l+=stream->read(p+l,xl-l))>=xl; ) if ((p=(byte*)ma->realloc(p,xl+=xl/2+1))==NULL) return RC_NOMEM;
+		} else {
+			l=stream->read(buf,sizeof(buf));
+			if ((p=(byte*)ma->malloc(l>=sizeof(buf)?xl:l+extra))==NULL) return RC_NOMEM;
+			memcpy(p,buf,l);
+			if (l>=sizeof(buf)) {
+				while ((l+=stream->read(p+l,xl-l))>=xl) if ((p=(byte*)ma->realloc(p,xl+=xl/2))==NULL) return RC_NOMEM;
+				if (l+extra!=xl && (p=(byte*)ma->realloc(p,l+extra))==NULL) return RC_NOMEM;
+			}
 		}
 		switch (val.type) {
 		case VT_STRING: p[l]=0;